@@ -1,20 +1,193 @@
 #include <vector>
 #include <iostream>
-#include <utility> // for std::pair
-#include <iomanip> // for print formatting
-#include <limits>  // access to INT_MIN and INT_MAX
+#include <utility>     // for std::pair
+#include <iomanip>     // for print formatting
+#include <limits>      // identities for min and max aggregates
+#include <stdexcept>   // std::out_of_range, std::invalid_argument
+#include <type_traits> // detect whether an aggregate is maintained
+#include <set>         // tombstones for lazy deletion
+#include <map>         // buffered write messages, keyed for lookups
+#include <algorithm>   // binary search within blocks
+#include <chrono>      // compaction time budget
+#include <cstdint>     // Bloom filter words
+#include <functional>  // std::hash for Bloom filters
+#include <queue>       // k-way merge of sorted runs
+#include <string>      // page file names
+#include <cstring>     // std::memcpy for page encoding
+#include <fstream>     // page files
+#include <thread>      // page reader pool
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>      // record ids handed out by the workload driver
+#include <memory_resource> // blocks and their vectors come from a std::pmr::memory_resource
+#include <random>      // calibration lookup order
+#include <array>       // static storage for compile time trees
+
+#if defined(__GLIBC__)
+#include <malloc.h>    // malloc_trim hands freed pages back to the OS
+#endif
 
 // for the testing data
-#include <random>
-#include <algorithm>
 #include <numeric>
-#include <chrono>
+#include <cmath>       // zipf sampling and standard deviation
+#include <cstdio>      // std::remove for the page file test
+
+// aggregates cached in every Block. an aggregate supplies the type it folds values into,
+// the identity of combine, how to lift a single value, and an associative combine.
+
+template <typename V>
+struct No_Aggregate
+{
+    using type = char;
+    static type identity() { return 0; }
+    static type lift(const V &) { return 0; }
+    static type combine(const type &, const type &) { return 0; }
+};
+
+template <typename V>
+struct Sum_Aggregate
+{
+    using type = V;
+    static type identity() { return V(); }
+    static type lift(const V &value) { return value; }
+    static type combine(const type &a, const type &b) { return a + b; }
+};
+
+template <typename V>
+struct Min_Aggregate
+{
+    using type = V;
+    static type identity() { return std::numeric_limits<V>::max(); }
+    static type lift(const V &value) { return value; }
+    static type combine(const type &a, const type &b) { return b < a ? b : a; }
+};
+
+template <typename V>
+struct Max_Aggregate
+{
+    using type = V;
+    static type identity() { return std::numeric_limits<V>::lowest(); }
+    static type lift(const V &value) { return value; }
+    static type combine(const type &a, const type &b) { return a < b ? b : a; }
+};
+
+// the shape and memory footprint of a tree, see stats()
+struct Tree_Stats
+{
+    int height = 0; // levels, a lone root counts as one
+    long long blocks = 0;
+    long long pairs = 0; // pairs stored in blocks, tombstoned ones included
+    long long tombstones = 0;
+    long long buffered = 0;
+    std::vector<long long> blocks_per_level; // root level first
+    std::vector<long long> fill_histogram;   // the number of blocks holding i pairs at index i
+    long long underfull_blocks = 0;          // non root blocks below min_kv_pairs
+    double average_fill = 0;                 // pairs stored over the max_kv_pairs all blocks could hold
+    long long block_bytes = 0;               // blocks and the full capacity reserved for their vectors
+    long long slack_bytes = 0;               // the part of block_bytes reserved but unused
+    long long overhead_bytes = 0;            // the tree object, buffer, cache, tombstones and finger
+    long long total_bytes = 0;
+    double bytes_per_pair = 0;
+};
+
+// the share of each operation in a workload, for weighing degrees in calibrate()
+struct Operation_Mix
+{
+    int insert_percent = 50;
+    int find_percent = 50;
+    int erase_percent = 0;
+};
+
+// hot path counters, compiled in by building with -DB_TREE_STATS. every thread counts into its
+// own copy, so nothing is shared or locked, and without the flag each count compiles away
+struct Tree_Counters
+{
+    uint64_t blocks_visited = 0; // blocks searched for a key
+    uint64_t comparisons = 0;    // key comparisons made by those searches
+    uint64_t splits = 0;
+    uint64_t borrows_from_left = 0;
+    uint64_t borrows_from_right = 0;
+    uint64_t merges = 0;
+    uint64_t root_grows = 0;   // a new root raised the height
+    uint64_t root_shrinks = 0; // an emptied root was dropped, lowering the height
+
+    // fold in another thread's counters, for exporting a process wide total
+    void add(const Tree_Counters &other)
+    {
+        this->blocks_visited += other.blocks_visited;
+        this->comparisons += other.comparisons;
+        this->splits += other.splits;
+        this->borrows_from_left += other.borrows_from_left;
+        this->borrows_from_right += other.borrows_from_right;
+        this->merges += other.merges;
+        this->root_grows += other.root_grows;
+        this->root_shrinks += other.root_shrinks;
+    }
+};
+
+inline thread_local Tree_Counters thread_tree_counters;
+
+#ifdef B_TREE_STATS
+#define B_TREE_COUNT(counter) (thread_tree_counters.counter++)
+#else
+#define B_TREE_COUNT(counter) ((void)0)
+#endif
+
+// the calling thread's counters since its last reset, all zero unless built with B_TREE_STATS
+inline Tree_Counters snapshot_counters()
+{
+    return thread_tree_counters;
+}
+
+inline void reset_counters()
+{
+    thread_tree_counters = Tree_Counters();
+}
+
+// whether std::hash can hash T, the hot key cache needs it
+template <typename T, typename = void>
+struct Is_Hashable : std::false_type
+{
+};
+
+template <typename T>
+struct Is_Hashable<T, decltype(void(std::hash<T>()(std::declval<const T &>())))> : std::true_type
+{
+};
 
 template <typename K, typename V>
+class Frozen_Tree;
+
+template <typename K, typename V, typename Aggregate = No_Aggregate<V>>
 
 class B_Tree
 {
 private:
+    // the LSM front end drives its memtable through the quiet primitives
+    template <typename L_K, typename L_V>
+    friend class LSM_Tree;
+
+    // a frozen snapshot thaws into a tree through the quiet inserts
+    template <typename F_K, typename F_V>
+    friend class Frozen_Tree;
+
+    // the duplicate keyed trees keep their counts and posting lists in a quiet B_Tree
+    template <typename M_K>
+    friend class Multiset_Tree;
+    template <typename M_K, typename M_V>
+    friend class Multimap_Tree;
+
+    // the benchmark and workload drivers time the quiet primitives, free of printing
+    friend struct Benchmark;
+    friend struct Workload;
+
+    class Block;
+
+    // a block's vectors allocate from the same memory resource as the block itself
+    using Pair_Vector = std::pmr::vector<std::pair<K, V>>;
+    using Child_Vector = std::pmr::vector<Block *>;
+
     class Block
     {
     private:
@@ -26,11 +199,17 @@ private:
         int min_children;
         int max_children;
 
-        std::vector<std::pair<K, V>> kv_pairs;
-        std::vector<Block *> children;
+        Pair_Vector kv_pairs;
+        Child_Vector children;
+
+        // number of live kv pairs stored in this block and all of its descendants, buried ones left out
+        int subtree_size;
+
+        // Aggregate folded over every live value in this block and all of its descendants
+        typename Aggregate::type aggregate;
 
     public:
-        Block(int b_count)
+        Block(int b_count, std::pmr::memory_resource *resource) : kv_pairs(resource), children(resource)
         {
             this->b_count = b_count;
 
@@ -42,10 +221,13 @@ private:
 
             this->kv_pairs.reserve(this->max_kv_pairs + 1);
             this->children.reserve(this->max_children + 1);
+
+            this->subtree_size = 0;
+            this->aggregate = Aggregate::identity();
         }
 
-        std::vector<std::pair<K, V>> &get_kv_pairs() { return this->kv_pairs; }
-        std::vector<Block *> &get_children() { return this->children; }
+        Pair_Vector &get_kv_pairs() { return this->kv_pairs; }
+        Child_Vector &get_children() { return this->children; }
 
         int get_b_count() { return this->b_count; }
 
@@ -54,10 +236,104 @@ private:
 
         int get_min_children() { return this->min_children; }
         int get_max_children() { return this->max_children; }
+
+        int get_subtree_size() { return this->subtree_size; }
+        void set_subtree_size(int subtree_size) { this->subtree_size = subtree_size; }
+
+        typename Aggregate::type &get_aggregate() { return this->aggregate; }
+
+        // bytes this block holds, counting the full capacity reserved for its vectors
+        size_t footprint()
+        {
+            return sizeof(Block) + this->kv_pairs.capacity() * sizeof(std::pair<K, V>) + this->children.capacity() * sizeof(Block *);
+        }
+
+        // the part of footprint() reserved but not yet used
+        size_t slack()
+        {
+            return (this->kv_pairs.capacity() - this->kv_pairs.size()) * sizeof(std::pair<K, V>) +
+                   (this->children.capacity() - this->children.size()) * sizeof(Block *);
+        }
     };
 
     Block *root;
 
+    // every block, and every vector a block holds, is allocated from here
+    std::pmr::memory_resource *resource;
+
+    // lazy deletion : removed keys are only recorded here and purged from the blocks later
+    bool lazy_delete;
+    std::set<K> tombstones;
+
+    // each insert purges this many tombstones while lazy deletion is on
+    static constexpr int purge_per_write = 2;
+
+    // lookups interleaved by multi_get, enough to keep many cache misses in flight
+    static constexpr int group_size = 16;
+
+    // hot key cache : open addressed slots remembering the block a recently found key lives in.
+    // a hit is checked against the block itself, so pairs moved by splits, borrows and merges or
+    // removed keys simply miss. a slot is only trusted while no block has been freed since it was
+    // written, cache_epoch counts the frees
+    struct Cache_Slot
+    {
+        K key;
+        Block *block;
+        uint64_t epoch;
+        bool used;
+    };
+
+    std::vector<Cache_Slot> cache;
+    uint64_t cache_epoch;
+    long long cache_hit_count;
+    long long cache_miss_count;
+
+    // slots tried from a key's home slot before giving up
+    static constexpr int cache_probes = 4;
+
+    // finger : the leaf the last insert landed in, its ancestors and the separators around it.
+    // an insert strictly between those separators goes straight to that leaf. it is only trusted
+    // while shape_epoch, which counts every split, borrow, merge, removal and handoff, is unchanged
+    Block *finger;
+    std::vector<Block *> finger_path;
+    bool finger_has_low;
+    bool finger_has_high;
+    K finger_low;
+    K finger_high;
+    uint64_t finger_epoch;
+    uint64_t shape_epoch;
+
+    // share of the pairs moved right when an append at the end of the right spine splits a block
+    static constexpr int append_right_percent = 10;
+
+    // the default degree is fitted to these
+    static constexpr int cache_line_bytes = 64;
+    static constexpr int memory_page_bytes = 4096;
+    static constexpr int block_target_lines = 16;
+
+    // degrees tried by calibrate(), and how many times each is timed
+    static constexpr int calibration_degrees[] = {2, 4, 8, 16, 32, 64, 128};
+    static constexpr int calibration_rounds = 3;
+
+    // a buffered insert carries its value, a buffered remove does not use it
+    struct Message
+    {
+        bool insert;
+        V value;
+    };
+    using Buffer = std::map<K, Message>;
+
+    // buffered writes : inserts and removes wait here as one message per key, a newer message
+    // for a key replaces the older one
+    bool buffered;
+    int buffer_capacity;
+    Buffer buffer;
+
+    // what the buffered messages add to size(), worked out again on the first size() after the
+    // buffer changes. the blocks only change under a buffered key when its message is applied
+    int buffer_delta;
+    bool buffer_delta_known;
+
     bool is_leaf(Block *block)
     {
         return block->get_children().empty();
@@ -68,15 +344,168 @@ private:
         return block == this->root;
     }
 
+    static constexpr bool has_aggregate = !std::is_same<Aggregate, No_Aggregate<V>>::value;
+
+    // recompute a block's subtree size and aggregate from its own live pairs and its children
+    void refresh_block(Block *block)
+    {
+        int size = live_count(block, block->get_kv_pairs().size());
+        for (Block *child : block->get_children())
+        {
+            size += child->get_subtree_size();
+        }
+        block->set_subtree_size(size);
+
+        if constexpr (has_aggregate)
+        {
+            Pair_Vector &kv_pairs = block->get_kv_pairs();
+            Child_Vector &children = block->get_children();
+            typename Aggregate::type total = Aggregate::identity();
+
+            // fold in key order so non-commutative aggregates see values sorted by key
+            for (int i = 0; i < kv_pairs.size(); i++)
+            {
+                if (!children.empty())
+                {
+                    total = Aggregate::combine(total, children.at(i)->get_aggregate());
+                }
+                if (!is_buried(kv_pairs.at(i).first))
+                {
+                    total = Aggregate::combine(total, Aggregate::lift(kv_pairs.at(i).second));
+                }
+            }
+
+            if (!children.empty())
+            {
+                total = Aggregate::combine(total, children.back()->get_aggregate());
+            }
+            block->get_aggregate() = total;
+        }
+    }
+
+    // how many of the first count pairs of block are not buried
+    int live_count(Block *block, int count)
+    {
+        if (this->tombstones.empty())
+        {
+            return count;
+        }
+
+        int live = 0;
+        for (int i = 0; i < count; i++)
+        {
+            live += is_buried(block->get_kv_pairs().at(i).first) ? 0 : 1;
+        }
+        return live;
+    }
+
+    // block gained or lost delta live pairs or had a value replaced, fix it and every ancestor on path
+    void refresh_path(Block *block, std::vector<Block *> &path, int delta)
+    {
+        // aggregates cannot be undone by a delta, refold bottom up instead
+        if constexpr (has_aggregate)
+        {
+            refresh_block(block);
+            for (int i = path.size() - 1; i >= 0; i--)
+            {
+                refresh_block(path.at(i));
+            }
+            return;
+        }
+
+        block->set_subtree_size(block->get_subtree_size() + delta);
+        for (Block *ancestor : path)
+        {
+            ancestor->set_subtree_size(ancestor->get_subtree_size() + delta);
+        }
+    }
+
+    // ask the cache for address ahead of use, a hint only
+    static void prefetch(const void *address)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(address);
+#endif
+    }
+
+    // the pair stored for each key in keys, or nullptr. lookups advance a level at a time in
+    // groups of group_size, so the cache misses of a whole group are in flight together
+    std::vector<std::pair<K, V> *> multi_find(std::vector<K> &keys)
+    {
+        std::vector<std::pair<K, V> *> found(keys.size(), nullptr);
+        std::vector<Block *> current(group_size);
+
+        for (int start = 0; start < keys.size(); start += group_size)
+        {
+            int count = std::min(group_size, (int)keys.size() - start);
+            int active = count;
+
+            // a key the cache knows the block of skips the descent
+            for (int i = 0; i < count; i++)
+            {
+                found.at(start + i) = cache_find(keys.at(start + i));
+                current.at(i) = found.at(start + i) == nullptr ? this->root : nullptr;
+                active -= found.at(start + i) != nullptr ? 1 : 0;
+            }
+
+            while (active > 0)
+            {
+                // each block was prefetched last round, now fetch the pair arrays they point to
+                for (int i = 0; i < count; i++)
+                {
+                    if (current.at(i) != nullptr)
+                    {
+                        prefetch(current.at(i)->get_kv_pairs().data());
+                    }
+                }
+
+                for (int i = 0; i < count; i++)
+                {
+                    Block *trav = current.at(i);
+
+                    if (trav == nullptr)
+                    {
+                        continue;
+                    }
+
+                    K key = keys.at(start + i);
+                    int index = get_index(trav, key);
+
+                    if (index > 0 && trav->get_kv_pairs().at(index - 1).first == key)
+                    {
+                        found.at(start + i) = &trav->get_kv_pairs().at(index - 1);
+                        cache_store(key, trav);
+                        current.at(i) = nullptr;
+                        active--;
+                    }
+                    else if (is_leaf(trav))
+                    {
+                        current.at(i) = nullptr;
+                        active--;
+                    }
+                    else
+                    {
+                        current.at(i) = trav->get_children().at(index);
+                        prefetch(current.at(i));
+                    }
+                }
+            }
+        }
+        return found;
+    }
+
     int get_index(Block *block, K key)
     {
-        std::vector<std::pair<K, V>> &kv_pairs = block->get_kv_pairs();
+        Pair_Vector &kv_pairs = block->get_kv_pairs();
         int left = 0;
         int right = kv_pairs.size();
 
+        B_TREE_COUNT(blocks_visited);
+
         while (left < right)
         {
             int mid = (left + right) / 2;
+            B_TREE_COUNT(comparisons);
             if (kv_pairs.at(mid).first > key)
             {
                 right = mid;
@@ -89,22 +518,6 @@ private:
         return left;
     }
 
-    int get_child_index(Block *parent, Block *child)
-    {
-        std::vector<Block *> &children = parent->get_children();
-
-        for (int i = 0; i < children.size(); i++)
-        {
-            if (children.at(i) == child)
-            {
-                return i;
-            }
-        }
-
-        // should never happen
-        return INT_MIN;
-    }
-
     void insert_helper(Block *trav, K key, V value, std::vector<Block *> &path)
     {
         // recursively go to leaf
@@ -119,28 +532,106 @@ private:
 
         // at leaf
 
-        std::vector<std::pair<K, V>> &kv_pairs = trav->get_kv_pairs();
+        Pair_Vector &kv_pairs = trav->get_kv_pairs();
         int insert_index = get_index(trav, key);
         kv_pairs.emplace(kv_pairs.begin() + insert_index, key, value);
 
+        // a separator put back by join_roots keeps the tombstone it carried
+        refresh_path(trav, path, is_buried(key) ? 0 : 1);
+
         // overflow : needs restructure
         if (kv_pairs.size() > trav->get_max_kv_pairs())
         {
-            insert_restructure(trav, path);
+            bool append = insert_index == kv_pairs.size() - 1 && on_right_spine(trav, path);
+            insert_restructure(trav, path, append);
+        }
+        else
+        {
+            set_finger(trav, path, key);
+        }
+    }
+
+    // whether block is the last block of its level, path holding its ancestors
+    bool on_right_spine(Block *block, std::vector<Block *> &path)
+    {
+        for (int i = 0; i < path.size(); i++)
+        {
+            Block *child = i + 1 < path.size() ? path.at(i + 1) : block;
+
+            if (path.at(i)->get_children().back() != child)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // remember leaf and its ancestors on path as the finger around key
+    void set_finger(Block *leaf, std::vector<Block *> &path, K key)
+    {
+        if (&path != &this->finger_path)
+        {
+            this->finger_path = path;
+        }
+
+        this->finger = leaf;
+        this->finger_has_low = false;
+        this->finger_has_high = false;
+
+        // deeper ancestors hold the tighter separators
+        for (Block *ancestor : path)
+        {
+            Pair_Vector &kv_pairs = ancestor->get_kv_pairs();
+            int index = get_index(ancestor, key);
+
+            if (index > 0)
+            {
+                this->finger_low = kv_pairs.at(index - 1).first;
+                this->finger_has_low = true;
+            }
+
+            if (index < kv_pairs.size())
+            {
+                this->finger_high = kv_pairs.at(index).first;
+                this->finger_has_high = true;
+            }
+        }
+        this->finger_epoch = this->shape_epoch;
+    }
+
+    // the finger leaf when key falls strictly between its separators, or nullptr
+    Block *finger_leaf(K key)
+    {
+        if (this->finger == nullptr || this->finger_epoch != this->shape_epoch)
+        {
+            return nullptr;
+        }
+
+        if ((this->finger_has_low && !(this->finger_low < key)) || (this->finger_has_high && !(key < this->finger_high)))
+        {
+            return nullptr;
         }
+        return this->finger;
     }
 
-    void insert_restructure(Block *block, std::vector<Block *> &path)
+    // split an overflowing block around its middle pair, or near its end when append is set: an
+    // append at the end of the right spine moves only append_right_percent of the pairs right, so
+    // the blocks it leaves behind stay nearly full. the new right block may hold fewer than
+    // min_kv_pairs until later appends fill it
+    void insert_restructure(Block *block, std::vector<Block *> &path, bool append = false)
     {
         int b_count = block->get_b_count();
+        this->shape_epoch++;
+        B_TREE_COUNT(splits);
 
         Block *parent = nullptr;
 
         // root block has no parent
         if (path.empty())
         {
-            Block *new_root = new Block(b_count);
+            Block *new_root = new_block(b_count);
             this->root = new_root;
+            B_TREE_COUNT(root_grows);
             parent = new_root;
             parent->get_children().push_back(block);
         }
@@ -151,559 +642,5079 @@ private:
         }
 
         // treat the block needing restructure as the "left_half"
-        std::vector<std::pair<K, V>> &pairs_to_restructure = block->get_kv_pairs();
-        std::vector<Block *> &children_to_restructure = block->get_children();
+        Pair_Vector &pairs_to_restructure = block->get_kv_pairs();
+        Child_Vector &children_to_restructure = block->get_children();
+
+        int split_index = b_count;
+
+        if (append)
+        {
+            int right_count = std::max(1, (int)pairs_to_restructure.size() * append_right_percent / 100);
+            split_index = pairs_to_restructure.size() - 1 - right_count;
+        }
 
-        std::pair<K, V> pair_to_move_up = pairs_to_restructure.at(b_count);
+        std::pair<K, V> pair_to_move_up = pairs_to_restructure.at(split_index);
 
-        Block *right_half = new Block(b_count);
-        std::vector<std::pair<K, V>> &right_half_kv_pairs = right_half->get_kv_pairs();
-        std::vector<Block *> &right_half_children = right_half->get_children();
+        Block *right_half = new_block(b_count);
+        Pair_Vector &right_half_kv_pairs = right_half->get_kv_pairs();
+        Child_Vector &right_half_children = right_half->get_children();
 
-        // first b stay in left half [index 0 to b_count - 1]
-        // the next entry goes into the parent [index b_count]
-        // the last b-1 go into right half [index b_count + 1 to size - 1]
+        // first split_index stay in left half [index 0 to split_index - 1]
+        // the next entry goes into the parent [index split_index]
+        // the rest go into right half [index split_index + 1 to size - 1]
 
         // move entries to right half
-        for (int i = b_count + 1; i < pairs_to_restructure.size(); i++)
+        for (int i = split_index + 1; i < pairs_to_restructure.size(); i++)
         {
             right_half_kv_pairs.push_back(pairs_to_restructure.at(i));
         }
 
         // remove middle key and everything to the right from left block
-        pairs_to_restructure.erase(pairs_to_restructure.begin() + b_count, pairs_to_restructure.end());
+        pairs_to_restructure.erase(pairs_to_restructure.begin() + split_index, pairs_to_restructure.end());
 
         // move children if not a leaf
         if (!is_leaf(block))
         {
-            for (int i = b_count + 1; i < children_to_restructure.size(); i++)
+            for (int i = split_index + 1; i < children_to_restructure.size(); i++)
             {
                 right_half_children.push_back(children_to_restructure.at(i));
             }
 
-            children_to_restructure.erase(children_to_restructure.begin() + b_count + 1, children_to_restructure.end());
+            children_to_restructure.erase(children_to_restructure.begin() + split_index + 1, children_to_restructure.end());
         }
 
-        std::vector<std::pair<K, V>> &parent_kv_pairs = parent->get_kv_pairs();
-        std::vector<Block *> &parent_children = parent->get_children();
+        refresh_block(block);
+        refresh_block(right_half);
+
+        Pair_Vector &parent_kv_pairs = parent->get_kv_pairs();
+        Child_Vector &parent_children = parent->get_children();
 
         int parent_index = get_index(parent, pair_to_move_up.first);
 
         parent_kv_pairs.insert(parent_kv_pairs.begin() + parent_index, pair_to_move_up);
         parent_children.insert(parent_children.begin() + parent_index + 1, right_half);
+        refresh_block(parent);
 
         if (parent_kv_pairs.size() > parent->get_max_kv_pairs())
         {
-            insert_restructure(parent, path);
+            // the parent keeps appending when the new pair landed at its end
+            insert_restructure(parent, path, append && parent_index == parent_kv_pairs.size() - 1);
         }
     }
 
-    void search_helper(Block *trav, K target_key, std::vector<Block *> &path)
+    // fold the values of every key in [low, high) below trav, or in (low, high) when low_open is
+    // set. an unbounded side lets whole subtrees contribute their cached aggregate, so only the
+    // two boundary paths are walked
+    typename Aggregate::type aggregate_helper(Block *trav, K low, K high, bool low_bounded, bool high_bounded, bool low_open = false)
     {
-        path.push_back(trav);
-        std::vector<std::pair<K, V>> &travs_kv_pairs = trav->get_kv_pairs();
-        int index = get_index(trav, target_key);
-
-        // base case : target key exists in current blocks keys
-        if (index > 0 && travs_kv_pairs.at(index - 1).first == target_key)
+        if (!low_bounded && !high_bounded)
         {
-            return;
+            return trav->get_aggregate();
         }
 
-        // else, recursively find the block where the key may exist
-        std::vector<Block *> &travs_children = trav->get_children();
-        if (!travs_children.empty() && travs_children.at(index) != nullptr)
+        Pair_Vector &kv_pairs = trav->get_kv_pairs();
+        Child_Vector &children = trav->get_children();
+
+        // first pair >= low (> low when open) and first pair >= high
+        int low_index = low_bounded ? get_index(trav, low) : 0;
+        int high_index = high_bounded ? get_index(trav, high) : kv_pairs.size();
+
+        if (low_bounded && !low_open && low_index > 0 && kv_pairs.at(low_index - 1).first == low)
         {
-            return search_helper(travs_children.at(index), target_key, path);
+            low_index--;
+        }
+        if (high_bounded && high_index > 0 && kv_pairs.at(high_index - 1).first == high)
+        {
+            high_index--;
         }
 
-        // key is not found
-        return;
-    }
-
-    void remove_helper(Block *target_block, K key, std::vector<Block *> &path)
-    {
-        std::vector<std::pair<K, V>> &target_pairs = target_block->get_kv_pairs();
-        int index = get_index(target_block, key);
+        typename Aggregate::type total = Aggregate::identity();
+        bool leaf = children.empty();
 
-        if (is_leaf(target_block))
+        // the range lies entirely inside one child
+        if (low_index == high_index)
         {
-            if (index > 0 && target_pairs.at(index - 1).first == key)
+            if (leaf)
             {
-                target_pairs.erase(target_pairs.begin() + index - 1);
-            }
-
-            // underflow can only occur when removing a key from a leaf
-            if (target_pairs.size() < target_block->get_min_kv_pairs())
-            {
-                remove_restructure(target_block, path);
+                return total;
             }
+            return aggregate_helper(children.at(low_index), low, high, low_bounded, high_bounded, low_open);
         }
-        else
+
+        if (!leaf)
         {
-            std::vector<Block *> &children = target_block->get_children();
-            Block *replacement_block = nullptr;
-            std::pair<K, V> replacement_pair;
-            path.push_back(target_block);
+            total = aggregate_helper(children.at(low_index), low, high, low_bounded, false, low_open);
+        }
 
-            if (index > 0 && children.at(index - 1) != nullptr)
+        for (int i = low_index; i < high_index; i++)
+        {
+            if (!is_buried(kv_pairs.at(i).first))
             {
-                Block *left_child = children.at(index - 1);
-                // find max key of left subtree
-                replacement_block = get_replacement(left_child, false, true, path);
-
-                if (replacement_block != nullptr)
-                {
-                    replacement_pair = replacement_block->get_kv_pairs().back();
-                }
+                total = Aggregate::combine(total, Aggregate::lift(kv_pairs.at(i).second));
             }
 
-            else if (index < children.size() && children.at(index) != nullptr)
+            if (!leaf)
             {
-                Block *right_child = children.at(index);
-                // find min key of right subtree
-                replacement_block = get_replacement(right_child, true, false, path);
-
-                if (replacement_block != nullptr)
-                {
-                    replacement_pair = replacement_block->get_kv_pairs().front();
-                }
+                // children strictly between the two boundaries are fully covered
+                Block *child = children.at(i + 1);
+                typename Aggregate::type child_total = i + 1 == high_index
+                                                           ? aggregate_helper(child, low, high, false, high_bounded)
+                                                           : child->get_aggregate();
+                total = Aggregate::combine(total, child_total);
             }
-
-            target_pairs.at(index - 1) = replacement_pair;
-            path.pop_back();
-            remove_helper(replacement_block, replacement_pair.first, path);
         }
+        return total;
     }
 
-    void remove_restructure(Block *block, std::vector<Block *> &path)
+    void search_helper(Block *trav, K target_key, std::vector<Block *> &path)
     {
-        // an edge cases arise from merging the only two children of a root
-        // edge case 1: root has a child and is now empty.
+        path.push_back(trav);
+        Pair_Vector &travs_kv_pairs = trav->get_kv_pairs();
+        int index = get_index(trav, target_key);
 
-        if (is_root(block))
+        // base case : target key exists in current blocks keys
+        if (index > 0 && travs_kv_pairs.at(index - 1).first == target_key)
         {
-            if (!is_leaf(block) && block->get_kv_pairs().empty())
-            {
-                Block *old_root = block;
-                this->root = block->get_children().front();
-                old_root->get_children().clear;
-                delete old_root;
-            }
             return;
         }
 
-        // this method is active when block underflowed
-        Block *parent = path.back();
-        path.pop_back();
-        std::vector<std::pair<K, V>> &parent_kv_pairs = parent->get_kv_pairs();
+        // else, recursively find the block where the key may exist
+        Child_Vector &travs_children = trav->get_children();
+        if (!travs_children.empty() && travs_children.at(index) != nullptr)
+        {
+            return search_helper(travs_children.at(index), target_key, path);
+        }
 
-        Block *left_sibling = get_sibling(parent, block, true, false);
-        Block *right_sibling = get_sibling(parent, block, false, true);
+        // key is not found
+        return;
+    }
 
-        std::vector<std::pair<K, V>> &block_kv_pairs = block->get_kv_pairs();
+    // take the separator at slot down into block and move the right sibling's first pair up
+    void borrow_from_right(Block *parent, int slot)
+    {
+        this->shape_epoch++;
+        B_TREE_COUNT(borrows_from_right);
+        Block *block = parent->get_children().at(slot);
+        Block *right_sibling = parent->get_children().at(slot + 1);
 
-        // two additional edge cases, however you should always try stealing from a sibling
-        // edge case 1: stealing a key from the sibling causes underflow, requiring a merge of the 2 siblings
-        // edge case 2: merging requires bridging the gap by pulling down a key from the parent block. if this
-        //              causes the parent block to underflow, must recursively restructure the parent block.
+        Pair_Vector &parent_kv_pairs = parent->get_kv_pairs();
+        Pair_Vector &block_kv_pairs = block->get_kv_pairs();
+        Pair_Vector &right_sibling_kv_pairs = right_sibling->get_kv_pairs();
 
-        // edge case 2 will be handled within merge
+        block_kv_pairs.push_back(parent_kv_pairs.at(slot));
+        parent_kv_pairs.at(slot) = right_sibling_kv_pairs.front();
+        right_sibling_kv_pairs.erase(right_sibling_kv_pairs.begin());
 
-        // always steal from a sibling
-        if (right_sibling != nullptr) // slightly more efficient on average, prioritze
+        if (!is_leaf(right_sibling))
         {
-            int index_of_parent_key = get_child_index(parent, block);
-
-            std::vector<std::pair<K, V>> &right_sibling_kv_pairs = right_sibling->get_kv_pairs();
-
-            // edge case 1 (size - 1 because this checks if after stealing, right will be under min keys)
-            if (right_sibling_kv_pairs.size() - 1 < right_sibling->get_min_kv_pairs())
-            {
-                merge(parent, right_sibling, block, true, false, path);
-                return;
-            }
+            block->get_children().push_back(right_sibling->get_children().front());
+            right_sibling->get_children().erase(right_sibling->get_children().begin());
+        }
 
-            // push the parent key to the back of block_keys, move up and erase the first key of right_sibling
-            block_kv_pairs.push_back(parent_kv_pairs.at(index_of_parent_key));
-            parent_kv_pairs.at(index_of_parent_key) = right_sibling_kv_pairs.front();
-            right_sibling_kv_pairs.erase(right_sibling_kv_pairs.begin());
+        refresh_block(block);
+        refresh_block(right_sibling);
+    }
 
-            if (!is_leaf(right_sibling))
-            {
-                block->get_children().push_back(right_sibling->get_children().front());
-                right_sibling->get_children().erase(right_sibling->get_children().begin());
-            }
-        }
-        else if (left_sibling != nullptr)
-        {
-            int index_of_parent_key = get_child_index(parent, block) - 1;
-            std::vector<std::pair<K, V>> &left_sibling_kv_pairs = left_sibling->get_kv_pairs();
+    // take the separator left of slot down into block and move the left sibling's last pair up
+    void borrow_from_left(Block *parent, int slot)
+    {
+        this->shape_epoch++;
+        B_TREE_COUNT(borrows_from_left);
+        Block *block = parent->get_children().at(slot);
+        Block *left_sibling = parent->get_children().at(slot - 1);
 
-            // edge case 1 (size - 1 because this checks if after stealing, left will be under min keys)
-            if (left_sibling_kv_pairs.size() - 1 < left_sibling->get_min_kv_pairs())
-            {
-                merge(parent, left_sibling, block, false, true, path);
-                return;
-            }
+        Pair_Vector &parent_kv_pairs = parent->get_kv_pairs();
+        Pair_Vector &block_kv_pairs = block->get_kv_pairs();
+        Pair_Vector &left_sibling_kv_pairs = left_sibling->get_kv_pairs();
 
-            // push the parent key to the front of block_keys, move up and erase the last element of left_sibling
-            block_kv_pairs.insert(block_kv_pairs.begin(), parent_kv_pairs.at(index_of_parent_key));
-            parent_kv_pairs.at(index_of_parent_key) = left_sibling_kv_pairs.back();
-            left_sibling_kv_pairs.pop_back();
+        block_kv_pairs.insert(block_kv_pairs.begin(), parent_kv_pairs.at(slot - 1));
+        parent_kv_pairs.at(slot - 1) = left_sibling_kv_pairs.back();
+        left_sibling_kv_pairs.pop_back();
 
-            if (!is_leaf(left_sibling))
-            {
-                block->get_children().insert(block->get_children().begin(), left_sibling->get_children().back());
-                left_sibling->get_children().pop_back();
-            }
+        if (!is_leaf(left_sibling))
+        {
+            block->get_children().insert(block->get_children().begin(), left_sibling->get_children().back());
+            left_sibling->get_children().pop_back();
         }
+
+        refresh_block(block);
+        refresh_block(left_sibling);
     }
 
-    Block *get_replacement(Block *trav, bool search_min, bool search_max, std::vector<Block *> &path)
+    // fold the child right of slot and the separator between them into the child at slot
+    void merge(Block *parent, int slot)
     {
-        path.push_back(trav);
+        B_TREE_COUNT(merges);
+        Pair_Vector &parent_pairs = parent->get_kv_pairs();
+        Child_Vector &parent_children = parent->get_children();
 
-        if (is_leaf(trav))
-        {
-            return trav;
-        }
+        Block *to = parent_children.at(slot);
+        Block *from = parent_children.at(slot + 1);
 
-        // else, recursively find the next block
-        std::vector<Block *> &travs_children = trav->get_children();
+        Pair_Vector &to_pairs = to->get_kv_pairs();
+        Pair_Vector &from_pairs = from->get_kv_pairs();
 
-        if (search_min)
-        {
-            return get_replacement(travs_children.front(), true, false, path);
-        }
+        // transfer all pairs, erase parent pair, erase child pointer and delete block
+        // if not a leaf node, must also handle the transfer of children
+        to_pairs.push_back(parent_pairs.at(slot));
+        to_pairs.insert(to_pairs.end(), from_pairs.begin(), from_pairs.end());
 
-        if (search_max)
+        if (!is_leaf(to))
         {
-            return get_replacement(travs_children.back(), false, true, path);
+            Child_Vector &to_children = to->get_children();
+            Child_Vector &from_children = from->get_children();
+
+            to_children.insert(to_children.end(), from_children.begin(), from_children.end());
+            from_children.clear();
         }
 
-        // replacement key is not found (should always be found)
-        return nullptr;
+        parent_pairs.erase(parent_pairs.begin() + slot);
+        parent_children.erase(parent_children.begin() + slot + 1);
+        release_block(from);
+
+        refresh_block(to);
     }
 
-    Block *get_sibling(Block *parent, Block *target_child, bool left, bool right)
+    // block lost a pair. path holds its ancestors and slots[i] is the position of path[i + 1]
+    // (or block itself, for the last entry) among path[i]'s children, so siblings are found
+    // without scanning the parent. borrowing from a sibling ends the repair, merging moves it
+    // one level up
+    void remove_restructure(Block *block, std::vector<Block *> &path, std::vector<int> &slots)
     {
-        std::vector<Block *> &children = parent->get_children();
-        int index = -1;
-
-        for (int i = 0; i < children.size(); i++)
+        while (!is_root(block) && block->get_kv_pairs().size() < block->get_min_kv_pairs())
         {
-            if (children.at(i) == target_child)
+            Block *parent = path.back();
+            int slot = slots.back();
+            Child_Vector &siblings = parent->get_children();
+
+            // always try stealing from a sibling first, merge when that would underflow it
+            // the right sibling is slightly more efficient on average, prioritze
+            if (slot + 1 < siblings.size())
             {
-                index = i;
-                break;
+                Block *right_sibling = siblings.at(slot + 1);
+
+                if (right_sibling->get_kv_pairs().size() - 1 < right_sibling->get_min_kv_pairs())
+                {
+                    merge(parent, slot);
+                }
+                else
+                {
+                    borrow_from_right(parent, slot);
+                    continue;
+                }
+            }
+            else
+            {
+                Block *left_sibling = siblings.at(slot - 1);
+
+                if (left_sibling->get_kv_pairs().size() - 1 < left_sibling->get_min_kv_pairs())
+                {
+                    merge(parent, slot - 1);
+                }
+                else
+                {
+                    borrow_from_left(parent, slot);
+                    continue;
+                }
             }
+
+            // the merge pulled a pair out of parent, which may underflow in turn
+            block = parent;
+            path.pop_back();
+            slots.pop_back();
         }
 
-        if (left && index > 0)
+        // merging the only two children of the root leaves it empty, its child becomes the root
+        if (is_root(block) && !is_leaf(block) && block->get_kv_pairs().empty())
         {
-            // sibling with keys < target_child's keys
-            return children.at(index - 1);
+            Block *old_root = block;
+            this->root = block->get_children().front();
+            B_TREE_COUNT(root_shrinks);
+            old_root->get_children().clear();
+            release_block(old_root);
         }
-        else if (right && index + 1 < children.size())
+    }
+
+    // physically remove up to count tombstoned keys, smallest first. remove_key drops the tombstone
+    void purge_tombstones(int count)
+    {
+        while (count-- > 0 && !this->tombstones.empty())
         {
-            // sibling with keys > target_child's keys
-            return children.at(index + 1);
+            remove_key(*this->tombstones.begin());
         }
-
-        // no valid siblings
-        return nullptr;
     }
 
-    void merge(Block *parent, Block *from, Block *to, bool right_to_left, bool left_to_right, std::vector<Block *> &path)
+    // the pair stored for key in the blocks, tombstoned or not, or nullptr
+    std::pair<K, V> *find_in_blocks(K key)
     {
-        int to_index = get_child_index(parent, to);
-        int parent_pair_index;
+        std::vector<Block *> path;
+        search_helper(this->root, key, path);
 
-        if (right_to_left)
-        {
-            parent_pair_index = to_index;
-        }
-        else if (left_to_right)
+        if (path.empty())
+            return nullptr;
+
+        Block *last_block_seen = path.back();
+        int index = get_index(last_block_seen, key);
+
+        if (index > 0 && last_block_seen->get_kv_pairs().at(index - 1).first == key)
         {
-            parent_pair_index = to_index - 1;
+            // remember where the pair was found for the next lookup of the same key
+            cache_store(key, last_block_seen);
+            return &last_block_seen->get_kv_pairs().at(index - 1);
         }
+        return nullptr;
+    }
 
-        std::vector<std::pair<K, V>> &parent_pairs = parent->get_kv_pairs();
-        std::vector<Block *> &parent_children = parent->get_children();
+    // every block of this tree is allocated here
+    Block *new_block(int b_count)
+    {
+        void *memory = this->resource->allocate(sizeof(Block), alignof(Block));
+        return new (memory) Block(b_count, this->resource);
+    }
 
-        std::vector<std::pair<K, V>> &to_pairs = to->get_kv_pairs();
-        std::vector<std::pair<K, V>> &from_pairs = from->get_kv_pairs();
+    // every block of this tree is deleted here, so the cache learns that its block pointers may dangle
+    void release_block(Block *block)
+    {
+        this->cache_epoch++;
+        this->shape_epoch++;
+        block->~Block();
+        this->resource->deallocate(block, sizeof(Block), alignof(Block));
+    }
 
-        bool leaf = is_leaf(to);
+    // blocks were handed to another tree, no slot or finger written so far may be trusted
+    void invalidate_cache()
+    {
+        this->cache_epoch++;
+        this->shape_epoch++;
+    }
 
-        // transfer all keys, erase parent key, erase child pointer and delete block
-        // if not a leaf node, must also handle the transfer of children
+    int cache_home(K key)
+    {
+        uint64_t h = std::hash<K>()(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h & (this->cache.size() - 1);
+    }
 
-        if (right_to_left)
+    // the pair for key through the cache, or nullptr on a miss
+    std::pair<K, V> *cache_find(K key)
+    {
+        if constexpr (Is_Hashable<K>::value)
         {
-            to_pairs.push_back(parent_pairs.at(parent_pair_index));
-            to_pairs.insert(to_pairs.end(), from_pairs.begin(), from_pairs.end());
+            if (this->cache.empty())
+            {
+                return nullptr;
+            }
 
-            if (!leaf)
+            int home = cache_home(key);
+
+            for (int i = 0; i < cache_probes; i++)
             {
-                std::vector<Block *> &to_children = to->get_children();
-                std::vector<Block *> &from_children = from->get_children();
+                Cache_Slot &slot = this->cache.at((home + i) & (this->cache.size() - 1));
 
-                to_children.insert(to_children.end(), from_children.begin(), from_children.end());
-            }
+                if (!slot.used)
+                {
+                    break;
+                }
 
-            parent_pairs.erase(parent_pairs.begin() + parent_pair_index);
-            parent_children.erase(parent_children.begin() + get_child_index(parent, from));
-            delete from;
+                if (slot.epoch == this->cache_epoch && slot.key == key)
+                {
+                    int index = get_index(slot.block, key);
+
+                    if (index > 0 && slot.block->get_kv_pairs().at(index - 1).first == key)
+                    {
+                        this->cache_hit_count++;
+                        return &slot.block->get_kv_pairs().at(index - 1);
+                    }
+                    break;
+                }
+            }
+            this->cache_miss_count++;
         }
-        else if (left_to_right)
+        return nullptr;
+    }
+
+    // remember that key lives in block, taking the key's own slot, a free or stale one, or the home slot
+    void cache_store(K key, Block *block)
+    {
+        if constexpr (Is_Hashable<K>::value)
         {
-            to_pairs.insert(to_pairs.begin(), parent_pairs.at(parent_pair_index));
-            to_pairs.insert(to_pairs.begin(), from_pairs.begin(), from_pairs.end());
+            if (this->cache.empty())
+            {
+                return;
+            }
 
-            if (!leaf)
+            int home = cache_home(key);
+            int target = home;
+
+            for (int i = 0; i < cache_probes; i++)
             {
-                std::vector<Block *> &to_children = to->get_children();
-                std::vector<Block *> &from_children = from->get_children();
+                int index = (home + i) & (this->cache.size() - 1);
+                Cache_Slot &slot = this->cache.at(index);
 
-                to_children.insert(to_children.begin(), from_children.begin(), from_children.end());
+                if (!slot.used || slot.epoch != this->cache_epoch || slot.key == key)
+                {
+                    target = index;
+                    break;
+                }
             }
 
-            parent_pairs.erase(parent_pairs.begin() + parent_pair_index);
-            parent_children.erase(parent_children.begin() + get_child_index(parent, from));
-            delete from;
-        }
-
-        if (parent_pairs.size() < parent->get_min_kv_pairs())
-        {
-            return remove_restructure(parent, path);
+            this->cache.at(target) = Cache_Slot{key, block, this->cache_epoch, true};
         }
     }
 
-public:
-    B_Tree()
+    // the pair for key, from the cache when it knows the block or by a descent, or nullptr
+    std::pair<K, V> *lookup(K key)
     {
-        this->root = new Block(2);
+        std::pair<K, V> *pair = cache_find(key);
+        return pair != nullptr ? pair : find_in_blocks(key);
     }
 
-    B_Tree(int b_count)
+    bool is_buried(K key)
     {
-        this->root = new Block(b_count);
+        return !this->tombstones.empty() && this->tombstones.count(key) > 0;
     }
 
-    void insert(K key, V value)
+    // record key as deleted without touching the blocks, returns false when key was not present.
+    // the buried value is copied to removed_value when one is given
+    bool bury_key(K key, V *removed_value = nullptr)
     {
         std::vector<Block *> path;
         search_helper(this->root, key, path);
 
-        if (path.empty())
-            return;
-
-        Block *last_block_seen = path.back();
-        path.pop_back();
-        int index = get_index(last_block_seen, key);
+        Block *block = path.back();
+        int index = get_index(block, key);
 
-        if (index > 0 && last_block_seen->get_kv_pairs().at(index - 1).first == key)
+        if (index == 0 || !(block->get_kv_pairs().at(index - 1).first == key) || is_buried(key))
         {
-            // replace the value associated with that key
-            V prev_val = last_block_seen->get_kv_pairs().at(index - 1).second;
-            last_block_seen->get_kv_pairs().at(index - 1).second = value;
-            std::cout << "the key " << key << " with previous value " << prev_val << " was reassigned with value " << value << std::endl;
+            return false;
         }
-        else
+
+        if (removed_value != nullptr)
         {
-            insert_helper(last_block_seen, key, value, path);
+            *removed_value = block->get_kv_pairs().at(index - 1).second;
         }
+
+        // the pair stays in its block but no longer counts towards sizes and aggregates
+        this->tombstones.insert(key);
+        path.pop_back();
+        refresh_path(block, path, -1);
+        return true;
     }
 
-    void remove(K key)
+    // insert without printing, returns false and leaves the tree untouched when key was already present
+    bool insert_key(K key, V value)
     {
+        // inserts next to the last one, appends above all, skip the descent
         std::vector<Block *> path;
-        search_helper(this->root, key, path);
-
-        if (path.empty() || path.back() == nullptr)
-            return;
-
-        Block *target_block = path.back();
+        std::vector<Block *> *leaf_path = &this->finger_path;
+        Block *last_block_seen = finger_leaf(key);
 
-        int index = get_index(target_block, key);
-
-        if (index > 0 && block_containing_key->get_kv_pairs().at(index - 1).first == key)
+        if (last_block_seen == nullptr)
         {
-            path.pop_back();
-            V value = block_containing_key->get_kv_pairs().at(index - 1).second;
-            remove_helper(block_containing_key, key, path);
-
-            std::cout << "the key " << key << " and its value " << value << " were removed from the tree";
-        }
-    }
+            search_helper(this->root, key, path);
 
-    void search(K key)
-    {
-        std::vector<Block *> path;
-        search_helper(this->root, key, path);
+            if (path.empty())
+                return false;
 
-        if (path.empty())
-        {
-            std::cout << "the tree is empty." << std::endl;
-            return;
+            last_block_seen = path.back();
+            path.pop_back();
+            leaf_path = &path;
         }
 
-        Block *last_block_seen = path.back();
-        path.pop_back();
-
         int index = get_index(last_block_seen, key);
 
         if (index > 0 && last_block_seen->get_kv_pairs().at(index - 1).first == key)
         {
-            std::cout << key << " was found in the tree, and is paired with the value " << last_block_seen->get_kv_pairs().at(index - 1).second << std::endl;
-        }
-        else
-        {
-            std::cout << key << " was not found in the tree" << std::endl;
+            // a buried key is still in its block, inserting it again revives it with the new value
+            if (is_buried(key))
+            {
+                this->tombstones.erase(key);
+                last_block_seen->get_kv_pairs().at(index - 1).second = value;
+                refresh_path(last_block_seen, *leaf_path, 1);
+                return true;
+            }
+            return false;
         }
+
+        insert_helper(last_block_seen, key, value, *leaf_path);
+        return true;
     }
 
-    V &at(K key)
+    // insert or reassign without printing, returns false when an existing value was reassigned.
+    // the value it replaced is copied to prev_value when one is given
+    bool put_key(K key, V value, V *prev_value = nullptr)
     {
+        // inserts next to the last one, appends above all, skip the descent
         std::vector<Block *> path;
-        search_helper(this->root, key, path);
+        std::vector<Block *> *leaf_path = &this->finger_path;
+        Block *last_block_seen = finger_leaf(key);
 
-        if (path.empty())
+        if (last_block_seen == nullptr)
         {
-            throw std::out_of_range("tree is empty");
+            search_helper(this->root, key, path);
+
+            if (path.empty())
+                return false;
+
+            last_block_seen = path.back();
+            path.pop_back();
+            leaf_path = &path;
         }
 
-        Block *last_block_seen = path.back();
         int index = get_index(last_block_seen, key);
 
-        if (index > 0 && last_block->get_kv_pairs().at(index - 1).first == key)
+        if (index > 0 && last_block_seen->get_kv_pairs().at(index - 1).first == key)
         {
-            return last_block_seen->get_kv_pairs().at(index - 1).second;
+            if (prev_value != nullptr)
+            {
+                *prev_value = last_block_seen->get_kv_pairs().at(index - 1).second;
+            }
+
+            // a buried key is revived rather than reassigned
+            bool revived = this->tombstones.erase(key) > 0;
+
+            last_block_seen->get_kv_pairs().at(index - 1).second = value;
+            refresh_path(last_block_seen, *leaf_path, revived ? 1 : 0);
+            return revived;
         }
 
-        throw std::out_of_range("key not found");
+        insert_helper(last_block_seen, key, value, *leaf_path);
+        return true;
     }
 
-    bool in_tree(K key)
+    // apply fn to the value of key where it lives, in one descent and without copying it out.
+    // when key is absent and create is set, fn is applied to V() and the result inserted.
+    // returns whether key was present
+    template <typename Fn>
+    bool modify_key(K key, Fn &fn, bool create)
     {
-        std::vector<Block *> path;
-        search_helper(this->root, key, path);
+        // the buffered message for key holds its value or hides the blocks
+        Message *message = find_message(key);
 
-        if (path.empty())
+        if (message != nullptr)
+        {
+            if (message->insert)
+            {
+                fn(message->value);
+                return true;
+            }
+
+            if (create)
+            {
+                V value = V();
+                fn(value);
+                buffer_message(key, true, value);
+            }
             return false;
+        }
 
-        Block *last_block_seen = path.back();
-        path.pop_back();
+        // with no aggregate nothing above the pair depends on its value, so a cached block will do
+        if constexpr (!has_aggregate)
+        {
+            std::pair<K, V> *pair = cache_find(key);
 
-        int index = get_index(last_block_seen, key);
+            if (pair != nullptr && !is_buried(key))
+            {
+                fn(pair->second);
+                return true;
+            }
+        }
 
-        if (index > 0 && last_block_seen->get_kv_pairs().at(index - 1).first == key)
+        std::vector<Block *> path;
+        std::vector<Block *> *leaf_path = &this->finger_path;
+        Block *last_block_seen = finger_leaf(key);
+
+        if (last_block_seen == nullptr)
         {
-            return true;
+            search_helper(this->root, key, path);
+            last_block_seen = path.back();
+            path.pop_back();
+            leaf_path = &path;
         }
-        return false;
-    }
-};
 
-std::vector<int> data_gen(int count)
-{
-    std::vector<int> result(count);
+        Pair_Vector &kv_pairs = last_block_seen->get_kv_pairs();
+        int index = get_index(last_block_seen, key);
 
-    // 1. Fill with 1, 2, 3, ... count
-    // std::iota is a clean way to fill a range with increasing values
-    std::iota(result.begin(), result.end(), 1);
+        if (index > 0 && kv_pairs.at(index - 1).first == key)
+        {
+            V &value = kv_pairs.at(index - 1).second;
+            bool buried = is_buried(key);
 
-    // 2. Shuffle using a stable random engine
-    static std::random_device rd;
-    static std::mt19937 engine(rd());
-    std::shuffle(result.begin(), result.end(), engine);
+            if (buried)
+            {
+                if (!create)
+                {
+                    return false;
+                }
 
-    return result;
-}
+                // a buried key is revived starting from a fresh value
+                this->tombstones.erase(key);
+                value = V();
+            }
 
-void run_comprehensive_test(int b_count)
-{
-    std::cout << "\n=== STARTING COMPREHENSIVE B-TREE MAP TEST (b=" << b_count << ") ===\n";
-    B_Tree<int, int> tree(b_count);
-    int total_items = 1000;
+            fn(value);
+            refresh_path(last_block_seen, *leaf_path, buried ? 1 : 0);
+            cache_store(key, last_block_seen);
+            return !buried;
+        }
 
-    // TEST 1: Insertion & Correct Value Mapping
-    std::cout << "[TEST 1] Inserting " << total_items << " items... ";
-    for (int i = 1; i <= total_items; i++)
-    {
-        tree.insert(i, i * 10); // Value is 10x the key
+        if (create)
+        {
+            V value = V();
+            fn(value);
+            insert_helper(last_block_seen, key, value, *leaf_path);
+            purge_tombstones(purge_per_write);
+        }
+        return false;
     }
 
-    bool insert_ok = true;
-    for (int i = 1; i <= total_items; i++)
+    // queue a message, flushing the whole batch once the buffer holds capacity keys
+    void buffer_message(K key, bool insert, V value)
     {
-        if (!tree.in_tree(i))
+        this->buffer[key] = Message{insert, value};
+        this->buffer_delta_known = false;
+
+        if (this->buffer.size() >= this->buffer_capacity)
         {
-            std::cout << "\nFAILED: Key " << i << " missing after insertion.";
-            insert_ok = false;
-            break;
+            flush_buffer();
         }
     }
-    if (insert_ok)
-        std::cout << "PASSED\n";
-
-    // TEST 2: Map Update Logic (Upsert)
-    std::cout << "[TEST 2] Testing Value Updates... ";
-    tree.insert(500, 9999); // Overwrite old value (5000) with 9999
-    // Note: You might need to add a 'get' or 'at' method to your B_Tree
-    // to verify the value 9999 is actually there.
-    if (tree.in_tree(500))
-        std::cout << "PASSED (Key exists)\n";
-    else
-        std::cout << "FAILED (Key lost during update)\n";
 
-    // TEST 3: Non-Leaf Deletion (Internal Node)
-    // In a tree with 1000 items, low numbers like 10 or 20 are likely in internal nodes
-    std::cout << "[TEST 3] Deleting Internal Node Keys... ";
-    int internal_key = 10;
-    tree.remove(internal_key);
-    if (tree.in_tree(internal_key))
-    {
-        std::cout << "FAILED: Key " << internal_key << " still exists after remove.\n";
-    }
-    else
+    // apply one message through the regular single key paths
+    void apply_message(K key, Message &message)
     {
-        std::cout << "PASSED\n";
+        if (message.insert)
+        {
+            put_key(key, message.value);
+            purge_tombstones(purge_per_write);
+        }
+        else if (this->lazy_delete)
+        {
+            bury_key(key);
+        }
+        else
+        {
+            remove_key(key);
+        }
     }
 
-    // TEST 4: Massive Random Deletion (Triggers Borrow & Merge)
-    std::cout << "[TEST 4] Random Deletion (Borrow/Merge Stress)... ";
-    std::vector<int> random_keys = data_gen(total_items);
-    bool delete_ok = true;
-    for (int key : random_keys)
+    // apply every buffered message in key order. one descent serves every message that lands
+    // strictly between the separators around a leaf, for as long as the leaf can take them
+    // without a split or a borrow. the message that would need one goes the regular way
+    void flush_buffer()
     {
-        if (key == internal_key)
-            continue; // already deleted
-        tree.remove(key);
-        if (tree.in_tree(key))
+        // the buffer is already in key order with one message per key
+        Buffer batch;
+        batch.swap(this->buffer);
+        this->buffer_delta_known = false;
+
+        auto message = batch.begin();
+
+        while (message != batch.end())
         {
-            std::cout << "\nFAILED: Key " << key << " still found after removal.";
-            delete_ok = false;
-            break;
-        }
-    }
-    if (delete_ok)
-        std::cout << "PASSED\n";
+            std::vector<Block *> path;
+            Block *trav = this->root;
+            bool has_high = false;
+            bool in_internal = false;
+            K high;
 
-    // TEST 5: Empty Tree Integrity
-    std::cout << "[TEST 5] Empty Tree State... ";
-    if (tree.in_tree(1))
-        std::cout << "FAILED (Tree should be empty)\n";
-    else
-        std::cout << "PASSED\n";
+            while (!is_leaf(trav))
+            {
+                Pair_Vector &kv_pairs = trav->get_kv_pairs();
+                int index = get_index(trav, message->first);
 
-    std::cout << "=== ALL TESTS COMPLETE ===\n\n";
-}
+                if (index > 0 && kv_pairs.at(index - 1).first == message->first)
+                {
+                    in_internal = true;
+                    break;
+                }
+
+                if (index < kv_pairs.size())
+                {
+                    high = kv_pairs.at(index).first;
+                    has_high = true;
+                }
+
+                path.push_back(trav);
+                trav = trav->get_children().at(index);
+            }
+
+            if (in_internal)
+            {
+                apply_message(message->first, message->second);
+                message++;
+                continue;
+            }
+
+            Block *leaf = trav;
+            Pair_Vector &kv_pairs = leaf->get_kv_pairs();
+            int delta = 0;
+            int inserted = 0;
+            bool blocked = false;
+
+            // messages are sorted, so the batch stays above the leaf's lower separator
+            while (message != batch.end() && (!has_high || message->first < high))
+            {
+                int index = get_index(leaf, message->first);
+                bool present = index > 0 && kv_pairs.at(index - 1).first == message->first;
+
+                if (message->second.insert)
+                {
+                    inserted++;
+
+                    if (present)
+                    {
+                        kv_pairs.at(index - 1).second = message->second.value;
+                        delta += this->tombstones.erase(message->first);
+                    }
+                    else if (kv_pairs.size() >= leaf->get_max_kv_pairs())
+                    {
+                        blocked = true;
+                        break;
+                    }
+                    else
+                    {
+                        kv_pairs.insert(kv_pairs.begin() + index, std::make_pair(message->first, message->second.value));
+                        delta++;
+                    }
+                }
+                else if (present && this->lazy_delete)
+                {
+                    delta -= this->tombstones.insert(message->first).second ? 1 : 0;
+                }
+                else if (present)
+                {
+                    if (!is_root(leaf) && kv_pairs.size() <= leaf->get_min_kv_pairs())
+                    {
+                        blocked = true;
+                        break;
+                    }
+
+                    // a buried pair was already left out of the counts
+                    kv_pairs.erase(kv_pairs.begin() + index - 1);
+                    delta -= this->tombstones.erase(message->first) > 0 ? 0 : 1;
+                }
+                message++;
+            }
+
+            refresh_path(leaf, path, delta);
+
+            if (blocked)
+            {
+                inserted--;
+                apply_message(message->first, message->second);
+                message++;
+            }
+            purge_tombstones(purge_per_write * inserted);
+        }
+    }
+
+    // apply the buffered message for key on its own and drop it from the buffer, if there is one
+    void flush_message(K key)
+    {
+        if (find_message(key) != nullptr)
+        {
+            auto message = this->buffer.extract(key);
+            this->buffer_delta_known = false;
+            apply_message(key, message.mapped());
+        }
+    }
+
+    // the buffered message for key, or nullptr
+    Message *find_message(K key)
+    {
+        if (this->buffer.empty())
+        {
+            return nullptr;
+        }
+
+        auto message = this->buffer.find(key);
+        return message == this->buffer.end() ? nullptr : &message->second;
+    }
+
+    // the net change the messages in [first, last) make to the number of live pairs
+    int buffered_delta(typename Buffer::iterator first, typename Buffer::iterator last)
+    {
+        int delta = 0;
+
+        for (auto message = first; message != last; ++message)
+        {
+            bool live = lookup(message->first) != nullptr && !is_buried(message->first);
+
+            if (message->second.insert && !live)
+            {
+                delta++;
+            }
+            else if (!message->second.insert && live)
+            {
+                delta--;
+            }
+        }
+        return delta;
+    }
+
+    // merge the messages in [first, last) into pairs, which holds the live pairs of the same
+    // key range in key order
+    void overlay_buffer(std::vector<std::pair<K, V>> &pairs, typename Buffer::iterator first, typename Buffer::iterator last)
+    {
+        if (first == last)
+        {
+            return;
+        }
+
+        std::vector<std::pair<K, V>> merged;
+        merged.reserve(pairs.size() + std::distance(first, last));
+        auto pair = pairs.begin();
+
+        for (auto message = first; message != last; ++message)
+        {
+            while (pair != pairs.end() && pair->first < message->first)
+            {
+                merged.push_back(*pair++);
+            }
+            if (pair != pairs.end() && pair->first == message->first)
+            {
+                pair++;
+            }
+            if (message->second.insert)
+            {
+                merged.push_back(std::make_pair(message->first, message->second.value));
+            }
+        }
+        merged.insert(merged.end(), pair, pairs.end());
+        pairs.swap(merged);
+    }
+
+    // number of live pairs in the blocks with a key strictly less than key. buried pairs are left
+    // out of the subtree sizes and skipped on the way down, so no tombstone has to be purged first
+    int rank_in_blocks(K key)
+    {
+        int rank = 0;
+        Block *trav = this->root;
+
+        while (true)
+        {
+            Pair_Vector &kv_pairs = trav->get_kv_pairs();
+            Child_Vector &children = trav->get_children();
+            int index = get_index(trav, key);
+            bool found = index > 0 && kv_pairs.at(index - 1).first == key;
+
+            // pairs of this block below key, plus every subtree left of the one key falls into
+            int below = found ? index - 1 : index;
+            rank += live_count(trav, below);
+
+            if (children.empty())
+            {
+                return rank;
+            }
+
+            for (int i = 0; i < below; i++)
+            {
+                rank += children.at(i)->get_subtree_size();
+            }
+
+            if (found)
+            {
+                return rank + children.at(below)->get_subtree_size();
+            }
+
+            trav = children.at(below);
+        }
+    }
+
+    // the i-th smallest live pair in the blocks, counting from 0
+    std::pair<K, V> &select_in_blocks(int i)
+    {
+        Block *trav = this->root;
+
+        while (true)
+        {
+            Pair_Vector &kv_pairs = trav->get_kv_pairs();
+            Child_Vector &children = trav->get_children();
+
+            if (children.empty())
+            {
+                // step over buried pairs to the i-th live one
+                for (int j = 0;; j++)
+                {
+                    if (is_buried(kv_pairs.at(j).first))
+                    {
+                        continue;
+                    }
+                    if (i-- == 0)
+                    {
+                        return kv_pairs.at(j);
+                    }
+                }
+            }
+
+            for (int j = 0; j < children.size(); j++)
+            {
+                int child_size = children.at(j)->get_subtree_size();
+
+                if (i < child_size)
+                {
+                    trav = children.at(j);
+                    break;
+                }
+
+                i -= child_size;
+
+                // i lands on the separator right after child j, unless it is buried
+                if (is_buried(kv_pairs.at(j).first))
+                {
+                    continue;
+                }
+                if (i == 0)
+                {
+                    return kv_pairs.at(j);
+                }
+                i--;
+            }
+        }
+    }
+
+    // remove without printing, returns false when key was not present. one descent records the
+    // path and each child slot taken. a pair found in an internal block is swapped with its
+    // predecessor, the largest pair of its left subtree, so a pair always leaves a leaf.
+    // the removed value is copied to removed_value when one is given
+    bool remove_key(K key, V *removed_value = nullptr)
+    {
+        // the key may be a separator, and blocks may borrow or merge
+        this->shape_epoch++;
+
+        std::vector<Block *> path;
+        std::vector<int> slots;
+        Block *trav = this->root;
+        int index;
+
+        while (true)
+        {
+            index = get_index(trav, key);
+
+            if (index > 0 && trav->get_kv_pairs().at(index - 1).first == key)
+            {
+                break;
+            }
+
+            if (is_leaf(trav))
+            {
+                return false;
+            }
+
+            path.push_back(trav);
+            slots.push_back(index);
+            trav = trav->get_children().at(index);
+        }
+
+        if (removed_value != nullptr)
+        {
+            *removed_value = trav->get_kv_pairs().at(index - 1).second;
+        }
+
+        // a buried key already left the counts, count it back in so it can leave them the regular way
+        if (this->tombstones.erase(key) > 0)
+        {
+            refresh_path(trav, path, 1);
+        }
+
+        // ancestors above target_depth lose key, those below only see the predecessor move up
+        int target_depth = path.size();
+        int moved = 1;
+
+        if (!is_leaf(trav))
+        {
+            // continue to the rightmost leaf of the left subtree
+            Block *target_block = trav;
+            int target_index = index - 1;
+
+            path.push_back(trav);
+            slots.push_back(target_index);
+            trav = trav->get_children().at(target_index);
+
+            while (!is_leaf(trav))
+            {
+                path.push_back(trav);
+                slots.push_back(trav->get_children().size() - 1);
+                trav = trav->get_children().back();
+            }
+
+            Pair_Vector &leaf_pairs = trav->get_kv_pairs();
+            target_block->get_kv_pairs().at(target_index) = leaf_pairs.back();
+            index = leaf_pairs.size();
+            moved = is_buried(leaf_pairs.back().first) ? 0 : 1;
+        }
+
+        Pair_Vector &leaf_pairs = trav->get_kv_pairs();
+        leaf_pairs.erase(leaf_pairs.begin() + index - 1);
+
+        if (moved == 1 || has_aggregate)
+        {
+            refresh_path(trav, path, -1);
+        }
+        else
+        {
+            // a buried predecessor never counted below the block it moved up into
+            for (int i = 0; i <= target_depth; i++)
+            {
+                path.at(i)->set_subtree_size(path.at(i)->get_subtree_size() - 1);
+            }
+        }
+
+        // underflow can only occur when removing a pair from a leaf
+        if (leaf_pairs.size() < trav->get_min_kv_pairs())
+        {
+            remove_restructure(trav, path, slots);
+        }
+        return true;
+    }
+
+    // the pair stored first, or last when largest is set, under block, buried or not
+    std::pair<K, V> &edge_pair(Block *block, bool largest)
+    {
+        while (!is_leaf(block))
+        {
+            block = largest ? block->get_children().back() : block->get_children().front();
+        }
+        return largest ? block->get_kv_pairs().back() : block->get_kv_pairs().front();
+    }
+
+    // number of levels below block, a leaf has height 0
+    int height(Block *block)
+    {
+        int height = 0;
+        while (!is_leaf(block))
+        {
+            block = block->get_children().front();
+            height++;
+        }
+        return height;
+    }
+
+    bool is_empty(Block *block)
+    {
+        return is_leaf(block) && block->get_kv_pairs().empty();
+    }
+
+    // index of the first pair whose key >= key
+    int get_lower_index(Block *block, K key)
+    {
+        int index = get_index(block, key);
+        if (index > 0 && block->get_kv_pairs().at(index - 1).first == key)
+        {
+            index--;
+        }
+        return index;
+    }
+
+    // hand freed heap pages back to the OS where the allocator supports it
+    static void trim_heap()
+    {
+#if defined(__GLIBC__)
+        malloc_trim(0);
+#endif
+    }
+
+    // release every block under block with an explicit stack instead of recursion
+    void free_subtree(Block *block)
+    {
+        std::vector<Block *> pending;
+        pending.push_back(block);
+
+        while (!pending.empty())
+        {
+            Block *trav = pending.back();
+            pending.pop_back();
+
+            Child_Vector &children = trav->get_children();
+            pending.insert(pending.end(), children.begin(), children.end());
+            release_block(trav);
+        }
+    }
+
+    // append every live pair of block's subtree to out in key order
+    void collect(Block *block, std::vector<std::pair<K, V>> &out)
+    {
+        Pair_Vector &kv_pairs = block->get_kv_pairs();
+        Child_Vector &children = block->get_children();
+
+        for (int i = 0; i < kv_pairs.size(); i++)
+        {
+            if (!children.empty())
+            {
+                collect(children.at(i), out);
+            }
+            if (!is_buried(kv_pairs.at(i).first))
+            {
+                out.push_back(kv_pairs.at(i));
+            }
+        }
+
+        if (!children.empty())
+        {
+            collect(children.back(), out);
+        }
+    }
+
+    // append the live pairs of block's subtree with keys in [low, high) to out in key order,
+    // skipping children whose whole range falls outside
+    void collect_range(Block *block, K low, K high, std::vector<std::pair<K, V>> &out)
+    {
+        Pair_Vector &kv_pairs = block->get_kv_pairs();
+        Child_Vector &children = block->get_children();
+        int first = get_index(block, low);
+
+        // the pair equal to low sits just left of first, ahead of everything in child first
+        if (first > 0 && kv_pairs.at(first - 1).first == low && !is_buried(low))
+        {
+            out.push_back(kv_pairs.at(first - 1));
+        }
+
+        for (int i = first; i <= kv_pairs.size(); i++)
+        {
+            if (!children.empty())
+            {
+                collect_range(children.at(i), low, high, out);
+            }
+
+            if (i == kv_pairs.size() || !(kv_pairs.at(i).first < high))
+            {
+                return;
+            }
+            if (!is_buried(kv_pairs.at(i).first))
+            {
+                out.push_back(kv_pairs.at(i));
+            }
+        }
+    }
+
+    // leave the tree empty with its settings kept
+    void release_contents()
+    {
+        int b_count = this->root->get_b_count();
+
+        free_subtree(this->root);
+        this->root = new_block(b_count);
+
+        Buffer().swap(this->buffer);
+        this->buffer_delta_known = false;
+        this->tombstones.clear();
+        std::vector<Block *>().swap(this->finger_path);
+        this->finger = nullptr;
+        std::fill(this->cache.begin(), this->cache.end(), Cache_Slot());
+        invalidate_cache();
+    }
+
+    // exchange everything but the memory resources, which stay with their trees
+    void swap_contents(B_Tree<K, V, Aggregate> &other)
+    {
+        std::swap(this->root, other.root);
+        std::swap(this->lazy_delete, other.lazy_delete);
+        std::swap(this->tombstones, other.tombstones);
+        std::swap(this->cache, other.cache);
+        std::swap(this->cache_epoch, other.cache_epoch);
+        std::swap(this->cache_hit_count, other.cache_hit_count);
+        std::swap(this->cache_miss_count, other.cache_miss_count);
+        std::swap(this->finger, other.finger);
+        std::swap(this->finger_path, other.finger_path);
+        std::swap(this->finger_has_low, other.finger_has_low);
+        std::swap(this->finger_has_high, other.finger_has_high);
+        std::swap(this->finger_low, other.finger_low);
+        std::swap(this->finger_high, other.finger_high);
+        std::swap(this->finger_epoch, other.finger_epoch);
+        std::swap(this->shape_epoch, other.shape_epoch);
+        std::swap(this->buffered, other.buffered);
+        std::swap(this->buffer_capacity, other.buffer_capacity);
+        std::swap(this->buffer, other.buffer);
+        std::swap(this->buffer_delta, other.buffer_delta);
+        std::swap(this->buffer_delta_known, other.buffer_delta_known);
+    }
+
+    // build a tree bottom up from pairs sorted by distinct keys. each level is cut into as few
+    // blocks as fill pairs apiece allows, spreading pairs evenly so no block drops below
+    // min_kv_pairs, and the pair between two neighbouring blocks moves up a level as their separator
+    Block *build_sorted(std::vector<std::pair<K, V>> &sorted_pairs, int b_count, int fill)
+    {
+        std::vector<std::pair<K, V>> items = sorted_pairs;
+        std::vector<Block *> level;
+        bool leaf_level = true;
+
+        while (true)
+        {
+            int count = items.size();
+            int min_kv_pairs = b_count - 1;
+            int blocks = (count + 1 + fill) / (fill + 1);
+
+            while (blocks > 1 && (count - (blocks - 1)) / blocks < min_kv_pairs)
+            {
+                blocks--;
+            }
+            blocks = std::max(1, blocks);
+
+            int per_block = (count - (blocks - 1)) / blocks;
+            int extra = (count - (blocks - 1)) % blocks;
+
+            std::vector<std::pair<K, V>> separators;
+            std::vector<Block *> next_level;
+            int item = 0;
+            int child = 0;
+
+            for (int i = 0; i < blocks; i++)
+            {
+                Block *block = new_block(b_count);
+                int take = per_block + (i < extra ? 1 : 0);
+
+                block->get_kv_pairs().assign(items.begin() + item, items.begin() + item + take);
+                item += take;
+
+                if (!leaf_level)
+                {
+                    block->get_children().assign(level.begin() + child, level.begin() + child + take + 1);
+                    child += take + 1;
+                }
+
+                refresh_block(block);
+                next_level.push_back(block);
+
+                if (i + 1 < blocks)
+                {
+                    separators.push_back(items.at(item));
+                    item++;
+                }
+            }
+
+            if (blocks == 1)
+            {
+                return next_level.front();
+            }
+
+            items.swap(separators);
+            level.swap(next_level);
+            leaf_level = false;
+        }
+    }
+
+    // a former root grafted below the spine may hold fewer than min_kv_pairs. walk the left or right
+    // spine down to the given height and borrow or merge until that block is full enough again
+    void repair_spine(int target_height, bool right_spine)
+    {
+        std::vector<Block *> path;
+        std::vector<int> slots;
+        Block *trav = this->root;
+
+        // the repaired block became the root, which has no minimum
+        for (int h = height(trav); h > target_height; h--)
+        {
+            int slot = right_spine ? trav->get_children().size() - 1 : 0;
+            path.push_back(trav);
+            slots.push_back(slot);
+            trav = trav->get_children().at(slot);
+        }
+
+        remove_restructure(trav, path, slots);
+    }
+
+    // concatenate two roots around pair, where every key under left < pair.first < every key under right.
+    // the shorter tree is grafted onto the matching level of the taller tree's spine, and only that
+    // spine is split or rebalanced. uses this->root as the working root and returns it
+    Block *join_roots(Block *left, int left_height, std::pair<K, V> pair, Block *right, int right_height)
+    {
+        if (is_empty(left) || is_empty(right))
+        {
+            this->root = is_empty(left) ? right : left;
+            release_block(is_empty(left) ? left : right);
+            insert_key(pair.first, pair.second);
+            return this->root;
+        }
+
+        if (left_height == right_height)
+        {
+            Block *new_root = new_block(left->get_b_count());
+            new_root->get_kv_pairs().push_back(pair);
+            new_root->get_children().push_back(left);
+            new_root->get_children().push_back(right);
+            refresh_block(new_root);
+            this->root = new_root;
+            B_TREE_COUNT(root_grows);
+
+            repair_spine(left_height, false);
+            repair_spine(right_height, true);
+            return this->root;
+        }
+
+        bool graft_right = left_height > right_height;
+        Block *taller = graft_right ? left : right;
+        int shorter_height = graft_right ? right_height : left_height;
+        this->root = taller;
+
+        // descend the taller tree's inner spine to the block one level above the shorter root
+        std::vector<Block *> path;
+        Block *trav = taller;
+        for (int h = height(taller); h > shorter_height + 1; h--)
+        {
+            path.push_back(trav);
+            trav = graft_right ? trav->get_children().back() : trav->get_children().front();
+        }
+
+        Pair_Vector &trav_pairs = trav->get_kv_pairs();
+        Child_Vector &trav_children = trav->get_children();
+
+        if (graft_right)
+        {
+            trav_pairs.push_back(pair);
+            trav_children.push_back(right);
+        }
+        else
+        {
+            trav_pairs.insert(trav_pairs.begin(), pair);
+            trav_children.insert(trav_children.begin(), left);
+        }
+
+        refresh_block(trav);
+        for (int i = path.size() - 1; i >= 0; i--)
+        {
+            refresh_block(path.at(i));
+        }
+
+        if (trav_pairs.size() > trav->get_max_kv_pairs())
+        {
+            insert_restructure(trav, path);
+        }
+
+        repair_spine(shorter_height, graft_right);
+        return this->root;
+    }
+
+    // split the subtree under block into keys < key (left) and keys >= key (right). every level
+    // contributes at most one piece to each side, which is joined onto the result from below
+    void split_helper(Block *block, int block_height, K key, Block *&left, int &left_height, Block *&right, int &right_height)
+    {
+        int b_count = block->get_b_count();
+        Pair_Vector &kv_pairs = block->get_kv_pairs();
+        int index = get_lower_index(block, key);
+
+        if (is_leaf(block))
+        {
+            Block *right_leaf = new_block(b_count);
+            right_leaf->get_kv_pairs().assign(kv_pairs.begin() + index, kv_pairs.end());
+            kv_pairs.erase(kv_pairs.begin() + index, kv_pairs.end());
+
+            refresh_block(block);
+            refresh_block(right_leaf);
+
+            left = block;
+            right = right_leaf;
+            left_height = right_height = 0;
+            return;
+        }
+
+        Pair_Vector block_pairs(this->resource);
+        Child_Vector block_children(this->resource);
+        block_pairs.swap(kv_pairs);
+        block_children.swap(block->get_children());
+        kv_pairs.reserve(block->get_max_kv_pairs() + 1);
+        block->get_children().reserve(block->get_max_children() + 1);
+
+        Block *sub_left;
+        Block *sub_right;
+        int sub_left_height;
+        int sub_right_height;
+        split_helper(block_children.at(index), block_height - 1, key, sub_left, sub_left_height, sub_right, sub_right_height);
+
+        // left piece : pairs [0, index - 1) with children [0, index), joined to sub_left by pairs[index - 1]
+        if (index == 0)
+        {
+            left = sub_left;
+            left_height = sub_left_height;
+            release_block(block);
+        }
+        else
+        {
+            Block *piece = block_children.front();
+            int piece_height = block_height - 1;
+
+            if (index > 1)
+            {
+                piece = block;
+                piece_height = block_height;
+                piece->get_kv_pairs().assign(block_pairs.begin(), block_pairs.begin() + index - 1);
+                piece->get_children().assign(block_children.begin(), block_children.begin() + index);
+                refresh_block(piece);
+            }
+            else
+            {
+                release_block(block);
+            }
+
+            left = join_roots(piece, piece_height, block_pairs.at(index - 1), sub_left, sub_left_height);
+            left_height = height(left);
+        }
+
+        // right piece : pairs (index, size) with children (index, size], joined to sub_right by pairs[index]
+        if (index == block_pairs.size())
+        {
+            right = sub_right;
+            right_height = sub_right_height;
+        }
+        else
+        {
+            Block *piece = block_children.back();
+            int piece_height = block_height - 1;
+
+            if (index + 1 < block_pairs.size())
+            {
+                piece = new_block(b_count);
+                piece_height = block_height;
+                piece->get_kv_pairs().assign(block_pairs.begin() + index + 1, block_pairs.end());
+                piece->get_children().assign(block_children.begin() + index + 1, block_children.end());
+                refresh_block(piece);
+            }
+
+            right = join_roots(sub_right, sub_right_height, block_pairs.at(index), piece, piece_height);
+            right_height = height(right);
+        }
+    }
+
+public:
+    // the degree whose full pair array spans block_target_lines cache lines, as in the Set. no
+    // pair array outgrows a memory page, and the degree is never below 2
+    static constexpr int default_b_count()
+    {
+        int pair_bytes = std::min<int>(block_target_lines * cache_line_bytes, memory_page_bytes);
+        int max_kv_pairs = pair_bytes / (int)sizeof(std::pair<K, V>);
+        return std::max(2, (max_kv_pairs + 1) / 2);
+    }
+
+    // time each of calibration_degrees on this host : insert sample_pairs in the given order, find
+    // every key in a shuffled order, then erase half of them, keeping the fastest of
+    // calibration_rounds. returns the degree with the lowest cost weighted by mix, and every
+    // degree with its weighted ns per operation in scores when given
+    static int calibrate(std::vector<std::pair<K, V>> &sample_pairs, Operation_Mix mix, std::vector<std::pair<int, double>> *scores = nullptr)
+    {
+        if (mix.insert_percent < 0 || mix.find_percent < 0 || mix.erase_percent < 0 ||
+            mix.insert_percent + mix.find_percent + mix.erase_percent != 100)
+        {
+            throw std::invalid_argument("operation mix percentages must be non negative and sum to 100");
+        }
+        if (sample_pairs.empty())
+        {
+            throw std::invalid_argument("calibration needs sample pairs");
+        }
+
+        std::vector<K> lookups;
+        lookups.reserve(sample_pairs.size());
+        for (std::pair<K, V> &pair : sample_pairs)
+        {
+            lookups.push_back(pair.first);
+        }
+        std::shuffle(lookups.begin(), lookups.end(), std::mt19937(1));
+        int erases = std::max<int>(1, lookups.size() / 2);
+
+        int best_b_count = default_b_count();
+        double best_cost = -1;
+
+        for (int b_count : calibration_degrees)
+        {
+            double cost = -1;
+
+            for (int round = 0; round < calibration_rounds; round++)
+            {
+                B_Tree<K, V, Aggregate> tree(b_count);
+
+                auto start = std::chrono::steady_clock::now();
+                for (std::pair<K, V> &pair : sample_pairs)
+                {
+                    tree.put_key(pair.first, pair.second);
+                }
+                auto inserted = std::chrono::steady_clock::now();
+                for (K &key : lookups)
+                {
+                    tree.lookup(key);
+                }
+                auto found = std::chrono::steady_clock::now();
+                for (int i = 0; i < erases; i++)
+                {
+                    tree.remove_key(lookups.at(i));
+                }
+                auto erased = std::chrono::steady_clock::now();
+
+                double insert_ns = std::chrono::duration<double, std::nano>(inserted - start).count() / sample_pairs.size();
+                double find_ns = std::chrono::duration<double, std::nano>(found - inserted).count() / lookups.size();
+                double erase_ns = std::chrono::duration<double, std::nano>(erased - found).count() / erases;
+                double round_cost = (mix.insert_percent * insert_ns + mix.find_percent * find_ns + mix.erase_percent * erase_ns) / 100;
+
+                if (cost < 0 || round_cost < cost)
+                {
+                    cost = round_cost;
+                }
+            }
+
+            if (scores != nullptr)
+            {
+                scores->push_back({b_count, cost});
+            }
+            if (best_cost < 0 || cost < best_cost)
+            {
+                best_cost = cost;
+                best_b_count = b_count;
+            }
+        }
+        return best_b_count;
+    }
+
+    B_Tree()
+    {
+        this->resource = std::pmr::get_default_resource();
+        this->root = new_block(default_b_count());
+        this->lazy_delete = false;
+        this->buffered = false;
+        this->buffer_capacity = 0;
+        this->buffer_delta = 0;
+        this->buffer_delta_known = false;
+        this->cache_epoch = 0;
+        this->cache_hit_count = 0;
+        this->cache_miss_count = 0;
+        this->finger = nullptr;
+        this->finger_has_low = false;
+        this->finger_has_high = false;
+        this->finger_epoch = 0;
+        this->shape_epoch = 0;
+    }
+
+    // blocks and their vectors are allocated from resource, which must outlive the tree
+    B_Tree(int b_count, std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+    {
+        this->resource = resource;
+        this->root = new_block(b_count);
+        this->lazy_delete = false;
+        this->buffered = false;
+        this->buffer_capacity = 0;
+        this->buffer_delta = 0;
+        this->buffer_delta_known = false;
+        this->cache_epoch = 0;
+        this->cache_hit_count = 0;
+        this->cache_miss_count = 0;
+        this->finger = nullptr;
+        this->finger_has_low = false;
+        this->finger_has_high = false;
+        this->finger_epoch = 0;
+        this->shape_epoch = 0;
+    }
+
+    // blocks are released with an explicit stack, so no tree is too deep to tear down
+    ~B_Tree()
+    {
+        free_subtree(this->root);
+    }
+
+    // a tree owns its blocks, so a copy would release them twice
+    B_Tree(const B_Tree &) = delete;
+    B_Tree &operator=(const B_Tree &) = delete;
+
+    // the blocks move along with the memory resource they came from, other is left empty
+    B_Tree(B_Tree &&other) : B_Tree(other.root->get_b_count(), other.resource)
+    {
+        swap_contents(other);
+    }
+
+    // like a std::pmr container, this tree keeps its own memory resource. the blocks change hands
+    // only when both resources can free each other's memory, otherwise the pairs are rebuilt in
+    // this tree's resource. other is left empty either way
+    B_Tree &operator=(B_Tree &&other)
+    {
+        if (this == &other)
+        {
+            return *this;
+        }
+
+        if (this->resource->is_equal(*other.resource))
+        {
+            swap_contents(other);
+            other.release_contents();
+            return *this;
+        }
+
+        other.compact();
+
+        int b_count = other.root->get_b_count();
+        std::vector<std::pair<K, V>> sorted;
+        sorted.reserve(other.size());
+        other.collect(other.root, sorted);
+
+        B_Tree<K, V, Aggregate> rebuilt(b_count, this->resource);
+        if (!sorted.empty())
+        {
+            rebuilt.release_block(rebuilt.root);
+            rebuilt.root = rebuilt.build_sorted(sorted, b_count, 2 * b_count - 1);
+        }
+        rebuilt.lazy_delete = other.lazy_delete;
+        rebuilt.buffered = other.buffered;
+        rebuilt.buffer_capacity = other.buffer_capacity;
+        rebuilt.cache.assign(other.cache.size(), Cache_Slot());
+
+        swap_contents(rebuilt);
+        other.release_contents();
+        return *this;
+    }
+
+    void insert(K key, V value)
+    {
+        if (this->buffered)
+        {
+            buffer_message(key, true, value);
+            std::cout << "the key " << key << " with value " << value << " was buffered for insertion" << std::endl;
+            return;
+        }
+
+        V prev_val;
+
+        // replace the value associated with that key when it is already present
+        if (!put_key(key, value, &prev_val))
+        {
+            std::cout << "the key " << key << " with previous value " << prev_val << " was reassigned with value " << value << std::endl;
+        }
+
+        purge_tombstones(purge_per_write);
+    }
+
+    // read-modify-write without printing : fn(V &value) updates the value of key in place, and an
+    // absent key is inserted with V() updated by fn. returns true when key was inserted
+    template <typename Fn>
+    bool upsert(K key, Fn fn)
+    {
+        return !modify_key(key, fn, true);
+    }
+
+    // fn(V &value) updates the value of key in place when key is present, returns whether it was
+    template <typename Fn>
+    bool update_if_present(K key, Fn fn)
+    {
+        return modify_key(key, fn, false);
+    }
+
+    void remove(K key)
+    {
+        if (this->buffered)
+        {
+            buffer_message(key, false, V());
+            std::cout << "the key " << key << " was buffered for removal" << std::endl;
+            return;
+        }
+
+        V value;
+        bool removed = this->lazy_delete ? bury_key(key, &value) : remove_key(key, &value);
+
+        if (removed)
+        {
+            std::cout << "the key " << key << " and its value " << value << " were removed from the tree";
+        }
+    }
+
+    void search(K key)
+    {
+        // the buffered message for key decides before the blocks are looked at
+        Message *message = find_message(key);
+
+        if (message != nullptr)
+        {
+            if (message->insert)
+            {
+                std::cout << key << " was found in the tree, and is paired with the value " << message->value << std::endl;
+            }
+            else
+            {
+                std::cout << key << " was not found in the tree" << std::endl;
+            }
+            return;
+        }
+
+        if (is_empty(this->root))
+        {
+            std::cout << "the tree is empty." << std::endl;
+            return;
+        }
+
+        std::pair<K, V> *pair = lookup(key);
+
+        if (pair != nullptr && !is_buried(key))
+        {
+            std::cout << key << " was found in the tree, and is paired with the value " << pair->second << std::endl;
+        }
+        else
+        {
+            std::cout << key << " was not found in the tree" << std::endl;
+        }
+    }
+
+    // with an aggregate the value is read-only; writes go through update_if_present so the path is refolded
+    std::conditional_t<has_aggregate, const V &, V &> at(K key)
+    {
+        // a reference into the buffer would dangle once it is flushed, so the message for key
+        // is applied to the blocks first and the reference points there
+        flush_message(key);
+
+        if (is_empty(this->root))
+        {
+            throw std::out_of_range("tree is empty");
+        }
+
+        std::pair<K, V> *pair = lookup(key);
+
+        if (pair != nullptr && !is_buried(key))
+        {
+            return pair->second;
+        }
+
+        throw std::out_of_range("key not found");
+    }
+
+    bool in_tree(K key)
+    {
+        Message *message = find_message(key);
+
+        if (message != nullptr)
+        {
+            return message->insert;
+        }
+
+        return lookup(key) != nullptr && !is_buried(key);
+    }
+
+    // copy the value of key into value without printing, returns whether key was found
+    bool find(K key, V &value)
+    {
+        Message *message = find_message(key);
+
+        if (message != nullptr)
+        {
+            if (message->insert)
+            {
+                value = message->value;
+            }
+            return message->insert;
+        }
+
+        std::pair<K, V> *pair = lookup(key);
+
+        if (pair == nullptr || is_buried(key))
+        {
+            return false;
+        }
+
+        value = pair->second;
+        return true;
+    }
+
+    int size()
+    {
+        // buried pairs are already left out of every subtree size, buffered messages are counted
+        // by whether they add or remove a live pair
+        if (!this->buffer_delta_known)
+        {
+            this->buffer_delta = buffered_delta(this->buffer.begin(), this->buffer.end());
+            this->buffer_delta_known = true;
+        }
+        return this->root->get_subtree_size() + this->buffer_delta;
+    }
+
+    // height, blocks per level, how full the blocks are and how many bytes the tree holds. the
+    // byte counts include reserved vector capacity but not the allocator's own bookkeeping
+    Tree_Stats stats()
+    {
+        Tree_Stats stats;
+        int max_pairs = this->root->get_max_kv_pairs();
+        long long capacity = 0;
+
+        stats.fill_histogram.assign(max_pairs + 2, 0);
+
+        std::vector<Block *> level;
+        level.push_back(this->root);
+
+        while (!level.empty())
+        {
+            std::vector<Block *> next_level;
+
+            stats.height++;
+            stats.blocks_per_level.push_back(level.size());
+
+            for (Block *block : level)
+            {
+                int count = block->get_kv_pairs().size();
+
+                stats.blocks++;
+                stats.pairs += count;
+                stats.fill_histogram.at(std::min(count, max_pairs + 1))++;
+                capacity += max_pairs;
+
+                if (block != this->root && count < block->get_min_kv_pairs())
+                {
+                    stats.underfull_blocks++;
+                }
+
+                stats.block_bytes += block->footprint();
+                stats.slack_bytes += block->slack();
+
+                Child_Vector &children = block->get_children();
+                next_level.insert(next_level.end(), children.begin(), children.end());
+            }
+            level.swap(next_level);
+        }
+
+        stats.tombstones = this->tombstones.size();
+        stats.buffered = this->buffer.size();
+        stats.average_fill = (double)stats.pairs / capacity;
+
+        // a buffered message and a tombstone are each a red-black tree node of three links and a
+        // colour around their payload
+        stats.overhead_bytes = sizeof(*this) + this->buffer.size() * (sizeof(std::pair<K, Message>) + 4 * sizeof(void *)) +
+                               this->cache.capacity() * sizeof(Cache_Slot) +
+                               this->tombstones.size() * (sizeof(K) + 4 * sizeof(void *)) +
+                               this->finger_path.capacity() * sizeof(Block *);
+        stats.total_bytes = stats.block_bytes + stats.overhead_bytes;
+        stats.bytes_per_pair = stats.pairs > 0 ? (double)stats.total_bytes / stats.pairs : 0;
+
+        return stats;
+    }
+
+    // with lazy deletion on, remove() only records a tombstone and returns, leaving borrows and
+    // merges to later inserts or compact(). turning it off purges every tombstone
+    void set_lazy_delete(bool lazy_delete)
+    {
+        this->lazy_delete = lazy_delete;
+
+        if (!lazy_delete)
+        {
+            compact();
+        }
+    }
+
+    int tombstone_count()
+    {
+        return this->tombstones.size();
+    }
+
+    // keep a hot key cache of capacity slots, rounded up to a power of two, in front of search,
+    // at and in_tree. a capacity of 0 turns it off
+    void set_cache(int capacity)
+    {
+        static_assert(Is_Hashable<K>::value, "set_cache() needs keys hashable with std::hash");
+
+        if (capacity < 0)
+        {
+            throw std::invalid_argument("cache capacity must not be negative");
+        }
+
+        int slots = 1;
+        while (slots < capacity)
+        {
+            slots *= 2;
+        }
+
+        this->cache.assign(capacity == 0 ? 0 : slots, Cache_Slot{K(), nullptr, 0, false});
+        this->cache_hit_count = 0;
+        this->cache_miss_count = 0;
+    }
+
+    long long cache_hits()
+    {
+        return this->cache_hit_count;
+    }
+
+    long long cache_misses()
+    {
+        return this->cache_miss_count;
+    }
+
+    // fraction of cached lookups that were answered without a descent
+    double cache_hit_rate()
+    {
+        long long lookups = this->cache_hit_count + this->cache_miss_count;
+        return lookups == 0 ? 0.0 : (double)this->cache_hit_count / lookups;
+    }
+
+    // with buffering on, insert() and remove() only queue a message and whole batches of up to
+    // capacity messages reach the blocks at once. turning it off flushes what is left
+    void set_buffered(bool buffered, int capacity = 1024)
+    {
+        if (buffered && capacity < 1)
+        {
+            throw std::invalid_argument("buffer capacity must be at least 1");
+        }
+
+        this->buffered = buffered;
+        this->buffer_capacity = capacity;
+
+        if (!buffered)
+        {
+            flush_buffer();
+        }
+    }
+
+    int buffered_count()
+    {
+        return this->buffer.size();
+    }
+
+    // flush buffered writes, then purge tombstones until none are left or budget has elapsed, returns
+    // how many were purged. reads never need this, buried pairs are already left out of every count
+    int compact(std::chrono::microseconds budget = std::chrono::microseconds::max())
+    {
+        flush_buffer();
+
+        auto start = std::chrono::steady_clock::now();
+        int purged = 0;
+
+        while (!this->tombstones.empty())
+        {
+            if (budget != std::chrono::microseconds::max() && std::chrono::steady_clock::now() - start >= budget)
+            {
+                break;
+            }
+
+            purge_tombstones(1);
+            purged++;
+        }
+        return purged;
+    }
+
+    // rebuild the tree bottom up from its live pairs, each block holding target_fill of max_kv_pairs
+    // but never fewer than min_kv_pairs. the new blocks are allocated in key order before the old ones
+    // are released, and the freed pages are handed back to the OS. returns the number of blocks
+    // the tree shrank by
+    int compact(double target_fill)
+    {
+        if (!(target_fill > 0 && target_fill <= 1))
+        {
+            throw std::invalid_argument("target fill must be in (0, 1]");
+        }
+
+        flush_buffer();
+
+        int b_count = this->root->get_b_count();
+        int max_kv_pairs = 2 * b_count - 1;
+        int fill = std::max(b_count - 1, std::min(max_kv_pairs, (int)std::lround(target_fill * max_kv_pairs)));
+        int blocks_before = stats().blocks;
+
+        std::vector<std::pair<K, V>> live;
+        live.reserve(this->root->get_subtree_size());
+        collect(this->root, live);
+
+        // collect() leaves tombstoned pairs out instead of removing them one at a time
+        this->tombstones.clear();
+
+        Block *old_root = this->root;
+        this->root = live.empty() ? new_block(b_count) : build_sorted(live, b_count, fill);
+        free_subtree(old_root);
+        invalidate_cache();
+
+        trim_heap();
+        return blocks_before - stats().blocks;
+    }
+
+    // remove every pair, releasing every block, buffered message, tombstone and cache slot
+    void clear()
+    {
+        release_contents();
+        trim_heap();
+    }
+
+    // membership of every key in keys, see multi_get
+    std::vector<bool> multi_contains(std::vector<K> &keys)
+    {
+        std::vector<std::pair<K, V> *> found = multi_find(keys);
+        std::vector<bool> result(keys.size());
+
+        // a buffered message for a key overrides the blocks, a tombstone hides the pair found there
+        for (int i = 0; i < keys.size(); i++)
+        {
+            Message *message = find_message(keys.at(i));
+            result.at(i) = message != nullptr ? message->insert : found.at(i) != nullptr && !is_buried(keys.at(i));
+        }
+        return result;
+    }
+
+    // a pointer to the value of every key in keys, or nullptr when it is absent. lookups are
+    // interleaved in groups with each next Block prefetched before it is read. as in at(), the
+    // buffered message for a key is applied first, so every pointer points into a block
+    std::vector<const V *> multi_get(std::vector<K> &keys)
+    {
+        for (int i = 0; i < keys.size() && !this->buffer.empty(); i++)
+        {
+            flush_message(keys.at(i));
+        }
+
+        std::vector<std::pair<K, V> *> found = multi_find(keys);
+        std::vector<const V *> result(keys.size(), nullptr);
+
+        // a tombstone hides the pair found in the blocks
+        for (int i = 0; i < keys.size(); i++)
+        {
+            if (found.at(i) != nullptr && !is_buried(keys.at(i)))
+            {
+                result.at(i) = &found.at(i)->second;
+            }
+        }
+        return result;
+    }
+
+    // number of keys strictly less than key, buffered messages included
+    int rank(K key)
+    {
+        return rank_in_blocks(key) + buffered_delta(this->buffer.begin(), this->buffer.lower_bound(key));
+    }
+
+    // the pair with the i-th smallest key, counting from 0. the buffered messages are walked in key
+    // order, and shift tracks how many live pairs those walked so far add or take away
+    std::pair<K, V> select(int i)
+    {
+        if (i < 0 || i >= size())
+        {
+            throw std::out_of_range("select index out of range");
+        }
+
+        int shift = 0;
+
+        for (auto message = this->buffer.begin(); message != this->buffer.end(); ++message)
+        {
+            int position = rank_in_blocks(message->first) + shift;
+
+            // the i-th pair lies in the blocks, before this message's key
+            if (i < position)
+            {
+                break;
+            }
+
+            bool live = lookup(message->first) != nullptr && !is_buried(message->first);
+
+            if (message->second.insert)
+            {
+                if (i == position)
+                {
+                    return std::make_pair(message->first, message->second.value);
+                }
+                shift += live ? 0 : 1;
+            }
+            else
+            {
+                shift -= live ? 1 : 0;
+            }
+        }
+        return select_in_blocks(i - shift);
+    }
+
+    // number of keys in [low, high)
+    int count_range(K low, K high)
+    {
+        if (!(low < high))
+        {
+            return 0;
+        }
+        return rank(high) - rank(low);
+    }
+
+    // every pair with a key in [low, high) in key order
+    std::vector<std::pair<K, V>> scan(K low, K high)
+    {
+        std::vector<std::pair<K, V>> pairs;
+
+        if (low < high)
+        {
+            collect_range(this->root, low, high, pairs);
+            overlay_buffer(pairs, this->buffer.lower_bound(low), this->buffer.lower_bound(high));
+        }
+        return pairs;
+    }
+
+    // a read only snapshot of every pair, laid out for lookups. this tree is left unchanged
+    Frozen_Tree<K, V> freeze()
+    {
+        std::vector<std::pair<K, V>> sorted;
+        sorted.reserve(this->root->get_subtree_size() + this->buffer.size());
+        collect(this->root, sorted);
+        overlay_buffer(sorted, this->buffer.begin(), this->buffer.end());
+
+        return Frozen_Tree<K, V>(sorted);
+    }
+
+    // pairs whose key >= key move into the returned tree, the rest stay in this tree
+    B_Tree<K, V, Aggregate> split(K key)
+    {
+        flush_buffer();
+
+        int b_count = this->root->get_b_count();
+        B_Tree<K, V, Aggregate> right_tree(b_count, this->resource);
+
+        if (is_empty(this->root))
+        {
+            return right_tree;
+        }
+
+        Block *left;
+        Block *right;
+        int left_height;
+        int right_height;
+        split_helper(this->root, height(this->root), key, left, left_height, right, right_height);
+
+        right_tree.release_block(right_tree.root);
+        right_tree.root = right;
+        this->root = left;
+
+        // buried pairs travel with their blocks, and so do their tombstones
+        auto first_moved = this->tombstones.lower_bound(key);
+        right_tree.tombstones.insert(first_moved, this->tombstones.end());
+        this->tombstones.erase(first_moved, this->tombstones.end());
+
+        // blocks now belonging to right_tree may still sit in this tree's cache
+        invalidate_cache();
+        return right_tree;
+    }
+
+    // absorb every pair of other, whose keys must all be smaller or all be larger than this tree's.
+    // other is left empty
+    void join(B_Tree<K, V, Aggregate> &other)
+    {
+        flush_buffer();
+        other.flush_buffer();
+
+        int b_count = this->root->get_b_count();
+
+        if (other.root->get_b_count() != b_count)
+        {
+            throw std::invalid_argument("joined trees must share b_count");
+        }
+
+        // grafted blocks are freed through this tree's resource from now on
+        if (!this->resource->is_equal(*other.resource))
+        {
+            throw std::invalid_argument("joined trees must share a memory resource");
+        }
+
+        if (is_empty(other.root))
+        {
+            return;
+        }
+
+        // blocks change hands between the two trees
+        invalidate_cache();
+        other.invalidate_cache();
+
+        if (is_empty(this->root))
+        {
+            std::swap(this->root, other.root);
+            std::swap(this->tombstones, other.tombstones);
+            return;
+        }
+
+        B_Tree<K, V, Aggregate> *lower = this;
+        B_Tree<K, V, Aggregate> *upper = &other;
+
+        // the ranges are compared on the pairs stored, buried ones included, as those are what gets grafted
+        if (edge_pair(other.root, true).first < edge_pair(this->root, false).first)
+        {
+            std::swap(lower, upper);
+        }
+        else if (!(edge_pair(this->root, true).first < edge_pair(other.root, false).first))
+        {
+            throw std::invalid_argument("joined trees have overlapping key ranges");
+        }
+
+        // the smallest pair of the upper tree becomes the separator between the two roots, buried or not
+        std::pair<K, V> separator = edge_pair(upper->root, false);
+        bool buried = upper->is_buried(separator.first);
+        upper->remove_key(separator.first);
+
+        this->tombstones.insert(other.tombstones.begin(), other.tombstones.end());
+        other.tombstones.clear();
+        if (buried)
+        {
+            this->tombstones.insert(separator.first);
+        }
+
+        Block *left = lower->root;
+        Block *right = upper->root;
+        other.root = new_block(b_count);
+        join_roots(left, height(left), separator, right, height(right));
+
+        // grafting moved separators under any finger set while joining
+        invalidate_cache();
+    }
+
+    // remove every pair with a key in [low, high) and return how many were removed. the range is cut
+    // out with two splits, its blocks are freed wholesale and the outer trees are joined back, so
+    // only the boundary spines are rebalanced
+    int erase_range(K low, K high)
+    {
+        // buffered inserts into the range have to reach the blocks to be cut out with them
+        flush_buffer();
+
+        if (!(low < high) || is_empty(this->root))
+        {
+            return 0;
+        }
+
+        B_Tree<K, V, Aggregate> middle = split(low);
+        B_Tree<K, V, Aggregate> upper = middle.split(high);
+        int erased = middle.size();
+
+        join(upper);
+        return erased;
+    }
+
+    // Aggregate folded over the values of every key in [low, high)
+    typename Aggregate::type aggregate(K low, K high)
+    {
+        static_assert(has_aggregate, "aggregate() needs an Aggregate template argument");
+
+        if (!(low < high))
+        {
+            return Aggregate::identity();
+        }
+
+        // the blocks are folded between the buffered keys, each of which contributes its message instead
+        typename Aggregate::type total = Aggregate::identity();
+        K from = low;
+        bool open = false;
+
+        for (auto message = this->buffer.lower_bound(low); message != this->buffer.end() && message->first < high; ++message)
+        {
+            total = Aggregate::combine(total, aggregate_helper(this->root, from, message->first, true, true, open));
+
+            if (message->second.insert)
+            {
+                total = Aggregate::combine(total, Aggregate::lift(message->second.value));
+            }
+            from = message->first;
+            open = true;
+        }
+        return Aggregate::combine(total, aggregate_helper(this->root, from, high, true, true, open));
+    }
+
+    // write every Block to filename as one fixed size page, for Page_Store to read back. page 0
+    // holds the page size, max_kv_pairs, the page count and the key and value sizes, the root is page 1 and the rest follow
+    // in breadth first order. a page holds the pair count, a leaf flag, max_kv_pairs keys,
+    // max_kv_pairs values and max_kv_pairs + 1 child page numbers at fixed offsets
+    void write_pages(const std::string &filename)
+    {
+        static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value, "write_pages() needs trivially copyable keys and values");
+
+        compact();
+
+        int64_t max_kv_pairs = this->root->get_max_kv_pairs();
+        int64_t page_size = page_bytes(max_kv_pairs);
+
+        // number the blocks breadth first, so a block's children get consecutive pages
+        std::vector<Block *> order;
+        order.push_back(this->root);
+
+        for (int i = 0; i < order.size(); i++)
+        {
+            for (Block *child : order.at(i)->get_children())
+            {
+                order.push_back(child);
+            }
+        }
+
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+
+        if (!file)
+        {
+            throw std::runtime_error("could not open " + filename);
+        }
+
+        std::vector<char> page(page_size, 0);
+        int64_t header[5] = {page_size, max_kv_pairs, (int64_t)order.size() + 1, sizeof(K), sizeof(V)};
+        std::memcpy(page.data(), header, sizeof(header));
+        file.write(page.data(), page_size);
+
+        int64_t next_child = 2;
+
+        for (Block *block : order)
+        {
+            std::fill(page.begin(), page.end(), 0);
+            Pair_Vector &kv_pairs = block->get_kv_pairs();
+            int32_t count = kv_pairs.size();
+            int32_t leaf = is_leaf(block);
+            std::memcpy(page.data(), &count, sizeof(count));
+            std::memcpy(page.data() + sizeof(count), &leaf, sizeof(leaf));
+
+            char *keys = page.data() + 2 * sizeof(int32_t);
+            char *values = keys + max_kv_pairs * sizeof(K);
+            char *children = values + max_kv_pairs * sizeof(V);
+
+            for (int i = 0; i < count; i++)
+            {
+                std::memcpy(keys + i * sizeof(K), &kv_pairs.at(i).first, sizeof(K));
+                std::memcpy(values + i * sizeof(V), &kv_pairs.at(i).second, sizeof(V));
+            }
+
+            for (int i = 0; i < block->get_children().size(); i++)
+            {
+                std::memcpy(children + i * sizeof(int64_t), &next_child, sizeof(int64_t));
+                next_child++;
+            }
+
+            file.write(page.data(), page_size);
+        }
+
+        if (!file)
+        {
+            throw std::runtime_error("could not write " + filename);
+        }
+    }
+
+    // bytes per page for blocks of up to max_kv_pairs pairs, rounded up to whole 4 KiB sectors
+    static int64_t page_bytes(int64_t max_kv_pairs)
+    {
+        int64_t bytes = 2 * sizeof(int32_t) + max_kv_pairs * (sizeof(K) + sizeof(V)) + (max_kv_pairs + 1) * sizeof(int64_t);
+        return (bytes + 4095) / 4096 * 4096;
+    }
+};
+
+// read only snapshot of a tree in Eytzinger order : the keys sit in one array laid out like a
+// binary heap, the root at 1 and the children of k at 2k and 2k + 1, so there are no pointers and
+// the top levels every search shares stay packed in a few cache lines. values sit in a parallel
+// array, so searches never pull them into cache
+
+template <typename K, typename V>
+
+class Frozen_Tree
+{
+private:
+    // slot 0 is unused so the children of k are 2k and 2k + 1
+    std::vector<K> keys;
+    std::vector<V> values;
+    int count;
+
+    // lay sorted out into the slots of k's subtree in order, returning the next unused index
+    int place(std::vector<std::pair<K, V>> &sorted, int next, int k)
+    {
+        if (k <= this->count)
+        {
+            next = place(sorted, next, 2 * k);
+            this->keys.at(k) = sorted.at(next).first;
+            this->values.at(k) = sorted.at(next).second;
+            next++;
+            next = place(sorted, next, 2 * k + 1);
+        }
+        return next;
+    }
+
+    void collect(int k, std::vector<std::pair<K, V>> &out)
+    {
+        if (k <= this->count)
+        {
+            collect(2 * k, out);
+            out.emplace_back(this->keys.at(k), this->values.at(k));
+            collect(2 * k + 1, out);
+        }
+    }
+
+    // the slot of the smallest key >= key, or 0 when every key is smaller. each step moves one
+    // level down without a branch, and the block of descendants four levels below is prefetched
+    int search(K key)
+    {
+        int k = 1;
+
+        while (k <= this->count)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            if (16 * k <= this->count)
+            {
+                __builtin_prefetch(this->keys.data() + 16 * k);
+            }
+#endif
+            k = 2 * k + (this->keys[k] < key);
+        }
+
+        // undo the right turns taken after the last left turn
+        return k >> __builtin_ffs(~k);
+    }
+
+public:
+    // sorted_pairs must be sorted by key with distinct keys
+    Frozen_Tree(std::vector<std::pair<K, V>> &sorted_pairs)
+    {
+        this->count = sorted_pairs.size();
+        this->keys.resize(this->count + 1);
+        this->values.resize(this->count + 1);
+        place(sorted_pairs, 0, 1);
+    }
+
+    bool contains(K key)
+    {
+        int k = search(key);
+        return k != 0 && this->keys.at(k) == key;
+    }
+
+    // copy the value of key into value, returns whether key was found
+    bool find(K key, V &value)
+    {
+        int k = search(key);
+
+        if (k == 0 || !(this->keys.at(k) == key))
+        {
+            return false;
+        }
+
+        value = this->values.at(k);
+        return true;
+    }
+
+    // copy the pair with the smallest key >= key out, returns false when every key is smaller
+    bool lower_bound(K key, K &found_key, V &found_value)
+    {
+        int k = search(key);
+
+        if (k == 0)
+        {
+            return false;
+        }
+
+        found_key = this->keys.at(k);
+        found_value = this->values.at(k);
+        return true;
+    }
+
+    int size()
+    {
+        return this->count;
+    }
+
+    size_t bytes()
+    {
+        return sizeof(*this) + this->keys.capacity() * sizeof(K) + this->values.capacity() * sizeof(V);
+    }
+
+    // a new mutable tree of the given order holding every pair, built bottom up in full leaves
+    template <typename Aggregate = No_Aggregate<V>>
+    B_Tree<K, V, Aggregate> *thaw(int b_count, std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+    {
+        std::vector<std::pair<K, V>> sorted;
+        sorted.reserve(this->count);
+        collect(1, sorted);
+
+        B_Tree<K, V, Aggregate> *tree = new B_Tree<K, V, Aggregate>(b_count, resource);
+
+        if (!sorted.empty())
+        {
+            tree->release_block(tree->root);
+            tree->root = tree->build_sorted(sorted, b_count, 2 * b_count - 1);
+        }
+        return tree;
+    }
+};
+
+// read only map over pairs known at compile time, built by a constexpr constructor into static
+// storage so nothing runs at startup. laid out like the Set's Static_Tree, one cache line of keys
+// per block and the blocks breadth first with no pointers, with each value at its key's slot in
+// a parallel array that searches never touch. K and V must be literal types
+
+template <typename K, typename V, size_t N>
+
+class Static_Tree
+{
+private:
+    static constexpr int count = N;
+    static constexpr int block_width = std::max<int>(1, 64 / (int)sizeof(K));
+    static constexpr int block_count = (count + block_width - 1) / block_width;
+
+    // levels of the complete (block_width + 1)-ary tree needed to number block_count blocks
+    static constexpr int levels()
+    {
+        int height = 0;
+        long long numbered = 0;
+        long long level_blocks = 1;
+
+        while (numbered < block_count)
+        {
+            numbered += level_blocks;
+            level_blocks *= block_width + 1;
+            height++;
+        }
+        return height;
+    }
+
+    static constexpr int height = levels();
+
+    // slots past the last pair repeat it, so every block stays sorted and lookups need no count
+    std::array<K, block_count * block_width> keys{};
+    std::array<V, block_count * block_width> values{};
+
+    // restore the max heap below root within the first end entries of order, by key
+    static constexpr void sift_down(const std::array<std::pair<K, V>, N> &pairs, std::array<int, N> &order, int root, int end)
+    {
+        while (2 * root + 1 < end)
+        {
+            int child = 2 * root + 1;
+
+            if (child + 1 < end && pairs.at(order.at(child)).first < pairs.at(order.at(child + 1)).first)
+            {
+                child++;
+            }
+            if (!(pairs.at(order.at(root)).first < pairs.at(order.at(child)).first))
+            {
+                return;
+            }
+
+            int larger = order.at(child);
+            order.at(child) = order.at(root);
+            order.at(root) = larger;
+            root = child;
+        }
+    }
+
+    // lay the pairs, taken in key order, into the slots of block k's subtree in order, returning
+    // the next unused index
+    constexpr int place(const std::array<std::pair<K, V>, N> &pairs, const std::array<int, N> &order, int next, int k)
+    {
+        if (k < block_count)
+        {
+            for (int i = 0; i <= block_width; i++)
+            {
+                next = place(pairs, order, next, k * (block_width + 1) + i + 1);
+
+                if (i < block_width)
+                {
+                    const std::pair<K, V> &pair = pairs.at(order.at(next < count ? next : count - 1));
+                    this->keys.at(k * block_width + i) = pair.first;
+                    this->values.at(k * block_width + i) = pair.second;
+                    next++;
+                }
+            }
+        }
+        return next;
+    }
+
+    // the slot holding key, or -1
+    constexpr int search(K key) const
+    {
+        int k = 0;
+
+        for (int level = 0; level < height && k < block_count; level++)
+        {
+            // keys of the block smaller than key, counted without branching
+            int index = 0;
+            for (int i = 0; i < block_width; i++)
+            {
+                index += this->keys[k * block_width + i] < key;
+            }
+
+            if (index < block_width && this->keys[k * block_width + index] == key)
+            {
+                return k * block_width + index;
+            }
+            k = k * (block_width + 1) + index + 1;
+        }
+        return -1;
+    }
+
+public:
+    // throws std::invalid_argument for a repeated key, which fails the build when constant evaluated
+    constexpr Static_Tree(const std::array<std::pair<K, V>, N> &pairs)
+    {
+        // heap sort of pair indices by key. std::sort is not constexpr before C++20, and neither
+        // is assigning a std::pair
+        std::array<int, N> order{};
+
+        for (int i = 0; i < count; i++)
+        {
+            order.at(i) = i;
+        }
+        for (int i = count / 2 - 1; i >= 0; i--)
+        {
+            sift_down(pairs, order, i, count);
+        }
+        for (int end = count - 1; end > 0; end--)
+        {
+            int largest = order.at(0);
+            order.at(0) = order.at(end);
+            order.at(end) = largest;
+            sift_down(pairs, order, 0, end);
+        }
+
+        for (int i = 1; i < count; i++)
+        {
+            if (!(pairs.at(order.at(i - 1)).first < pairs.at(order.at(i)).first))
+            {
+                throw std::invalid_argument("static tree keys must be distinct");
+            }
+        }
+
+        place(pairs, order, 0, 0);
+    }
+
+    constexpr bool in_tree(K key) const { return search(key) >= 0; }
+
+    constexpr const V &at(K key) const
+    {
+        int slot = search(key);
+
+        if (slot < 0)
+        {
+            throw std::out_of_range("key not found");
+        }
+        return this->values.at(slot);
+    }
+
+    constexpr int size() const { return count; }
+};
+
+// copy a braced list of pairs into a std::array, std::to_array arrives only in C++20
+template <typename K, typename V, size_t N, size_t... I>
+constexpr std::array<std::pair<K, V>, N> static_pairs(const std::pair<K, V> (&pairs)[N], std::index_sequence<I...>)
+{
+    return {{pairs[I]...}};
+}
+
+// deduces N from a braced list, as in constexpr auto codes = make_static_tree<int, int>({{404, 1}, {200, 0}});
+template <typename K, typename V, size_t N>
+constexpr Static_Tree<K, V, N> make_static_tree(const std::pair<K, V> (&pairs)[N])
+{
+    return Static_Tree<K, V, N>(static_pairs(pairs, std::make_index_sequence<N>()));
+}
+
+// a multiset storing each distinct key once with its number of occurrences, so heavy duplicates
+// cost one pair apiece. the counts are summed in every Block, which keeps size, count_range,
+// equal_range and select O(log n) in the number of distinct keys
+
+template <typename K>
+
+class Multiset_Tree
+{
+private:
+    using Count_Tree = B_Tree<K, long long, Sum_Aggregate<long long>>;
+    using Block = typename Count_Tree::Block;
+
+    Count_Tree counts;
+
+public:
+    Multiset_Tree() : Multiset_Tree(Count_Tree::default_b_count()) {}
+
+    Multiset_Tree(int b_count, std::pmr::memory_resource *resource = std::pmr::get_default_resource()) : counts(b_count, resource) {}
+
+    // like LSM_Tree, duplicate keyed writes do not print
+    void insert(K key, long long copies = 1)
+    {
+        if (copies < 1)
+        {
+            throw std::invalid_argument("copies must be at least 1");
+        }
+        this->counts.upsert(key, [copies](long long &count)
+                            { count += copies; });
+    }
+
+    long long count(K key)
+    {
+        std::pair<K, long long> *pair = this->counts.lookup(key);
+        return pair == nullptr ? 0 : pair->second;
+    }
+
+    // removes one occurrence of key, returns false when there was none
+    bool erase_one(K key)
+    {
+        std::pair<K, long long> *pair = this->counts.lookup(key);
+
+        if (pair == nullptr)
+        {
+            return false;
+        }
+
+        if (pair->second == 1)
+        {
+            this->counts.remove_key(key);
+        }
+        else
+        {
+            this->counts.update_if_present(key, [](long long &count)
+                                           { count--; });
+        }
+        return true;
+    }
+
+    // removes every occurrence of key, returns how many there were
+    long long erase_all(K key)
+    {
+        long long removed = 0;
+        this->counts.remove_key(key, &removed);
+        return removed;
+    }
+
+    // the positions [first, second) the occurrences of key take in sorted order, empty when
+    // key is absent. select(i) for i in that range returns key
+    std::pair<long long, long long> equal_range(K key)
+    {
+        long long first = this->counts.aggregate_helper(this->counts.root, key, key, false, true);
+        return {first, first + count(key)};
+    }
+
+    // the occurrence at position i in sorted order (counting from 0)
+    K select(long long i)
+    {
+        if (i < 0 || i >= size())
+        {
+            throw std::out_of_range("select index out of range");
+        }
+
+        Block *trav = this->counts.root;
+
+        while (true)
+        {
+            typename Count_Tree::Pair_Vector &kv_pairs = trav->get_kv_pairs();
+            typename Count_Tree::Child_Vector &children = trav->get_children();
+            Block *next = nullptr;
+
+            for (int j = 0; j <= kv_pairs.size(); j++)
+            {
+                if (!children.empty())
+                {
+                    long long below = children.at(j)->get_aggregate();
+                    if (i < below)
+                    {
+                        next = children.at(j);
+                        break;
+                    }
+                    i -= below;
+                }
+
+                if (j < kv_pairs.size())
+                {
+                    if (i < kv_pairs.at(j).second)
+                    {
+                        return kv_pairs.at(j).first;
+                    }
+                    i -= kv_pairs.at(j).second;
+                }
+            }
+            trav = next;
+        }
+    }
+
+    // occurrences of keys in [low, high)
+    long long count_range(K low, K high) { return this->counts.aggregate(low, high); }
+
+    // every occurrence, and the distinct keys among them
+    long long size() { return this->counts.root->get_aggregate(); }
+    int key_count() { return this->counts.size(); }
+};
+
+// a multimap storing each distinct key once with a posting list of its values in insertion
+// order. posting lengths are summed in every Block the way Multiset_Tree sums counts
+
+template <typename K, typename V>
+
+class Multimap_Tree
+{
+private:
+    struct Posting_Count
+    {
+        using type = long long;
+        static type identity() { return 0; }
+        static type lift(const std::vector<V> &postings) { return postings.size(); }
+        static type combine(const type &a, const type &b) { return a + b; }
+    };
+
+    B_Tree<K, std::vector<V>, Posting_Count> postings;
+
+public:
+    Multimap_Tree() : Multimap_Tree(B_Tree<K, std::vector<V>, Posting_Count>::default_b_count()) {}
+
+    Multimap_Tree(int b_count, std::pmr::memory_resource *resource = std::pmr::get_default_resource()) : postings(b_count, resource) {}
+
+    void insert(K key, V value)
+    {
+        this->postings.upsert(key, [&value](std::vector<V> &values)
+                              { values.push_back(value); });
+    }
+
+    long long count(K key)
+    {
+        std::pair<K, std::vector<V>> *pair = this->postings.lookup(key);
+        return pair == nullptr ? 0 : pair->second.size();
+    }
+
+    // every value of key in insertion order, or nullptr when key is absent. the list stays valid
+    // until the next write
+    const std::vector<V> *equal_range(K key)
+    {
+        std::pair<K, std::vector<V>> *pair = this->postings.lookup(key);
+        return pair == nullptr ? nullptr : &pair->second;
+    }
+
+    // removes the oldest occurrence of value under key, returns false when there was none
+    bool erase_one(K key, const V &value)
+    {
+        std::pair<K, std::vector<V>> *pair = this->postings.lookup(key);
+
+        if (pair == nullptr)
+        {
+            return false;
+        }
+
+        std::vector<V> &values = pair->second;
+        int offset = std::find(values.begin(), values.end(), value) - values.begin();
+
+        if (offset == values.size())
+        {
+            return false;
+        }
+
+        if (values.size() == 1)
+        {
+            this->postings.remove_key(key);
+        }
+        else
+        {
+            this->postings.update_if_present(key, [offset](std::vector<V> &values)
+                                             { values.erase(values.begin() + offset); });
+        }
+        return true;
+    }
+
+    // removes key with every value, returns how many values there were
+    long long erase_all(K key)
+    {
+        long long removed = count(key);
+        this->postings.remove_key(key);
+        return removed;
+    }
+
+    // values under keys in [low, high)
+    long long count_range(K low, K high) { return this->postings.aggregate(low, high); }
+
+    // every value, and the distinct keys they are filed under
+    long long size() { return this->postings.root->get_aggregate(); }
+    int key_count() { return this->postings.size(); }
+};
+
+// log structured front end for write heavy use. writes land in a mutable B_Tree memtable, and
+// once it holds memtable_limit entries it is frozen into an immutable sorted run. runs are merged
+// so each one is more than twice the size of the next newer one, keeping O(log n) runs.
+// K must also be hashable with std::hash for the Bloom filters.
+
+template <typename K, typename V>
+
+class LSM_Tree
+{
+private:
+    // a write as stored in the memtable and the runs. removes are kept as deleted entries
+    // so they shadow the key in every older run until a merge reaches the oldest run
+    struct Entry
+    {
+        bool deleted;
+        V value;
+    };
+
+    class Run
+    {
+    private:
+        std::vector<K> keys;
+        std::vector<Entry> entries;
+
+        // Bloom filter over keys, bits_per_key bits per key and hash_count probes per lookup
+        std::vector<uint64_t> bloom;
+        static constexpr int bits_per_key = 10;
+        static constexpr int hash_count = 7;
+
+        // spread std::hash, which is the identity for integers, over every bit
+        static uint64_t mix(uint64_t h)
+        {
+            h ^= h >> 30;
+            h *= 0xbf58476d1ce4e5b9ULL;
+            h ^= h >> 27;
+            h *= 0x94d049bb133111ebULL;
+            h ^= h >> 31;
+            return h;
+        }
+
+        // the i-th probe is h1 + i * h2, two hashes are enough for all of them
+        void probes(K key, uint64_t &h1, uint64_t &h2)
+        {
+            h1 = mix(std::hash<K>()(key));
+            h2 = mix(h1) | 1;
+        }
+
+    public:
+        Run(std::vector<K> &keys, std::vector<Entry> &entries)
+        {
+            this->keys.swap(keys);
+            this->entries.swap(entries);
+
+            uint64_t bit_count = this->keys.size() * bits_per_key;
+            this->bloom.assign(bit_count / 64 + 1, 0);
+            bit_count = this->bloom.size() * 64;
+
+            for (K &key : this->keys)
+            {
+                uint64_t h1, h2;
+                probes(key, h1, h2);
+
+                for (int i = 0; i < hash_count; i++)
+                {
+                    uint64_t bit = (h1 + i * h2) % bit_count;
+                    this->bloom.at(bit / 64) |= uint64_t(1) << (bit % 64);
+                }
+            }
+        }
+
+        std::vector<K> &get_keys() { return this->keys; }
+        std::vector<Entry> &get_entries() { return this->entries; }
+
+        int size() { return this->keys.size(); }
+
+        // false means key is certainly not in this run
+        bool may_contain(K key)
+        {
+            uint64_t bit_count = this->bloom.size() * 64;
+            uint64_t h1, h2;
+            probes(key, h1, h2);
+
+            for (int i = 0; i < hash_count; i++)
+            {
+                uint64_t bit = (h1 + i * h2) % bit_count;
+                if ((this->bloom.at(bit / 64) >> (bit % 64) & 1) == 0)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // index of the first key not less than key
+        int lower_index(K key)
+        {
+            return std::lower_bound(this->keys.begin(), this->keys.end(), key) - this->keys.begin();
+        }
+
+        // the entry stored for key, or nullptr
+        Entry *find(K key)
+        {
+            if (!may_contain(key))
+            {
+                return nullptr;
+            }
+
+            int index = lower_index(key);
+            if (index < this->keys.size() && this->keys.at(index) == key)
+            {
+                return &this->entries.at(index);
+            }
+            return nullptr;
+        }
+    };
+
+    // one layer's position during a k-way merge. source 0 is the memtable and source i > 0 is
+    // the i-th newest run, so on equal keys the smaller source holds the newer write
+    struct Head
+    {
+        K key;
+        int source;
+        int index;
+
+        bool operator>(const Head &other) const
+        {
+            if (other.key < key)
+                return true;
+            if (key < other.key)
+                return false;
+            return source > other.source;
+        }
+    };
+
+    int b_count;
+    int memtable_limit;
+    B_Tree<K, Entry> *memtable;
+
+    // oldest first, runs.back() is the newest
+    std::vector<Run *> runs;
+
+    // turn the memtable into the newest run and start an empty one
+    void freeze()
+    {
+        if (this->memtable->is_empty(this->memtable->root))
+        {
+            return;
+        }
+
+        std::vector<std::pair<K, Entry>> pairs;
+        this->memtable->collect(this->memtable->root, pairs);
+
+        std::vector<K> keys;
+        std::vector<Entry> entries;
+        keys.reserve(pairs.size());
+        entries.reserve(pairs.size());
+
+        // with no older run there is nothing for a deleted entry to shadow
+        for (std::pair<K, Entry> &pair : pairs)
+        {
+            if (!this->runs.empty() || !pair.second.deleted)
+            {
+                keys.push_back(pair.first);
+                entries.push_back(pair.second);
+            }
+        }
+
+        delete this->memtable;
+        this->memtable = new B_Tree<K, Entry>(this->b_count);
+
+        if (!keys.empty())
+        {
+            this->runs.push_back(new Run(keys, entries));
+        }
+
+        while (this->runs.size() >= 2 && this->runs.at(this->runs.size() - 2)->size() <= 2 * this->runs.back()->size())
+        {
+            merge_newest();
+        }
+    }
+
+    // merge the two newest runs into one, the newer entry winning on equal keys. deleted entries
+    // are dropped once the result is the oldest run
+    void merge_newest()
+    {
+        Run *newer = this->runs.back();
+        this->runs.pop_back();
+        Run *older = this->runs.back();
+        this->runs.pop_back();
+        bool oldest = this->runs.empty();
+
+        std::vector<K> keys;
+        std::vector<Entry> entries;
+        keys.reserve(newer->size() + older->size());
+        entries.reserve(newer->size() + older->size());
+
+        int i = 0;
+        int j = 0;
+
+        while (i < newer->size() || j < older->size())
+        {
+            Run *from;
+            int index;
+
+            if (j == older->size() || (i < newer->size() && !(older->get_keys().at(j) < newer->get_keys().at(i))))
+            {
+                // the older entry for the same key is shadowed
+                if (j < older->size() && older->get_keys().at(j) == newer->get_keys().at(i))
+                {
+                    j++;
+                }
+                from = newer;
+                index = i++;
+            }
+            else
+            {
+                from = older;
+                index = j++;
+            }
+
+            if (!oldest || !from->get_entries().at(index).deleted)
+            {
+                keys.push_back(from->get_keys().at(index));
+                entries.push_back(from->get_entries().at(index));
+            }
+        }
+
+        delete newer;
+        delete older;
+
+        if (!keys.empty())
+        {
+            this->runs.push_back(new Run(keys, entries));
+        }
+    }
+
+    // the newest entry for key in any layer, or nullptr
+    Entry *lookup(K key)
+    {
+        std::pair<K, Entry> *pair = this->memtable->find_in_blocks(key);
+
+        if (pair != nullptr)
+        {
+            return &pair->second;
+        }
+
+        for (int i = this->runs.size() - 1; i >= 0; i--)
+        {
+            Entry *entry = this->runs.at(i)->find(key);
+
+            if (entry != nullptr)
+            {
+                return entry;
+            }
+        }
+        return nullptr;
+    }
+
+    void check_limit()
+    {
+        if (this->memtable->root->get_subtree_size() >= this->memtable_limit)
+        {
+            freeze();
+        }
+    }
+
+public:
+    LSM_Tree() : LSM_Tree(B_Tree<K, Entry>::default_b_count(), 4096) {}
+
+    LSM_Tree(int b_count, int memtable_limit)
+    {
+        if (memtable_limit < 1)
+        {
+            throw std::invalid_argument("memtable limit must be at least 1");
+        }
+
+        this->b_count = b_count;
+        this->memtable_limit = memtable_limit;
+        this->memtable = new B_Tree<K, Entry>(b_count);
+    }
+
+    ~LSM_Tree()
+    {
+        delete this->memtable;
+        for (Run *run : this->runs)
+        {
+            delete run;
+        }
+    }
+
+    LSM_Tree(const LSM_Tree &) = delete;
+    LSM_Tree &operator=(const LSM_Tree &) = delete;
+
+    // writes are blind, they never look at older layers, so unlike B_Tree they do not print
+    void put(K key, V value)
+    {
+        this->memtable->put_key(key, Entry{false, value});
+        check_limit();
+    }
+
+    void remove(K key)
+    {
+        this->memtable->put_key(key, Entry{true, V()});
+        check_limit();
+    }
+
+    // checks the memtable, then the runs newest first, skipping runs whose Bloom filter rules key out
+    bool in_tree(K key)
+    {
+        Entry *entry = lookup(key);
+        return entry != nullptr && !entry->deleted;
+    }
+
+    V at(K key)
+    {
+        Entry *entry = lookup(key);
+
+        if (entry == nullptr || entry->deleted)
+        {
+            throw std::out_of_range("key not found");
+        }
+        return entry->value;
+    }
+
+    // every live pair with a key in [low, high), k-way merged across the memtable and all runs
+    std::vector<std::pair<K, V>> scan(K low, K high)
+    {
+        std::vector<std::pair<K, V>> result;
+
+        if (!(low < high))
+        {
+            return result;
+        }
+
+        std::vector<std::pair<K, Entry>> mem_pairs;
+        this->memtable->collect_range(this->memtable->root, low, high, mem_pairs);
+
+        // end index of each source, sources past 0 are runs newest first
+        std::vector<int> ends(this->runs.size() + 1);
+        std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+
+        ends.at(0) = mem_pairs.size();
+        if (!mem_pairs.empty())
+        {
+            heads.push(Head{mem_pairs.front().first, 0, 0});
+        }
+
+        for (int source = 1; source < ends.size(); source++)
+        {
+            Run *run = this->runs.at(this->runs.size() - source);
+            int begin = run->lower_index(low);
+            ends.at(source) = run->lower_index(high);
+
+            if (begin < ends.at(source))
+            {
+                heads.push(Head{run->get_keys().at(begin), source, begin});
+            }
+        }
+
+        bool emitted_any = false;
+        K last_key;
+
+        while (!heads.empty())
+        {
+            Head head = heads.top();
+            heads.pop();
+
+            // the first head popped for a key is its newest write, the rest are shadowed
+            if (!emitted_any || last_key < head.key)
+            {
+                emitted_any = true;
+                last_key = head.key;
+
+                Entry &entry = head.source == 0 ? mem_pairs.at(head.index).second : this->runs.at(this->runs.size() - head.source)->get_entries().at(head.index);
+                if (!entry.deleted)
+                {
+                    result.push_back(std::make_pair(head.key, entry.value));
+                }
+            }
+
+            if (++head.index < ends.at(head.source))
+            {
+                head.key = head.source == 0 ? mem_pairs.at(head.index).first : this->runs.at(this->runs.size() - head.source)->get_keys().at(head.index);
+                heads.push(head);
+            }
+        }
+        return result;
+    }
+
+    // freeze the memtable now, whatever its size
+    void flush()
+    {
+        freeze();
+    }
+
+    // freeze the memtable and merge every run into one, dropping all deleted entries
+    void compact()
+    {
+        freeze();
+
+        while (this->runs.size() >= 2)
+        {
+            merge_newest();
+        }
+    }
+
+    int run_count()
+    {
+        return this->runs.size();
+    }
+};
+
+// read only view of a tree written by B_Tree::write_pages, for trees that live in a file rather
+// than in RAM. a pool of reader threads fetches pages, so a batch of lookups keeps one page read
+// in flight per lookup instead of blocking on each read in turn
+
+template <typename K, typename V>
+
+class Page_Store
+{
+private:
+    // a decoded page
+    struct Page
+    {
+        bool leaf;
+        std::vector<K> keys;
+        std::vector<V> values;
+        std::vector<int64_t> children;
+    };
+
+    // one page read handed to the pool
+    struct Read
+    {
+        int64_t page_number;
+        std::vector<char> bytes;
+    };
+
+    std::string filename;
+    int64_t page_size;
+    int64_t max_kv_pairs;
+    int64_t page_count;
+
+    // used by the synchronous find
+    std::ifstream file;
+
+    std::vector<std::thread> readers;
+    std::mutex lock;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    std::deque<Read *> pending;
+    int unfinished;
+    bool stopping;
+
+    void read_page(std::ifstream &from, int64_t page_number, std::vector<char> &bytes)
+    {
+        if (page_number < 1 || page_number >= this->page_count)
+        {
+            throw std::out_of_range("page number out of range");
+        }
+
+        bytes.resize(this->page_size);
+        from.seekg(page_number * this->page_size);
+        from.read(bytes.data(), this->page_size);
+
+        if (!from)
+        {
+            // a failed stream refuses every later seek, so the next read through it starts clean
+            from.clear();
+            throw std::runtime_error("could not read " + this->filename);
+        }
+    }
+
+    Page decode(std::vector<char> &bytes)
+    {
+        Page page;
+        int32_t count, leaf;
+        std::memcpy(&count, bytes.data(), sizeof(count));
+        std::memcpy(&leaf, bytes.data() + sizeof(count), sizeof(leaf));
+        page.leaf = leaf != 0;
+
+        // a count from a damaged page would size the copies below past the page
+        if (count < 0 || count > this->max_kv_pairs)
+        {
+            throw std::runtime_error("a page of " + this->filename + " holds " + std::to_string(count) + " pairs, outside [0, " +
+                                     std::to_string(this->max_kv_pairs) + "]");
+        }
+
+        char *keys = bytes.data() + 2 * sizeof(int32_t);
+        char *values = keys + this->max_kv_pairs * sizeof(K);
+        char *children = values + this->max_kv_pairs * sizeof(V);
+
+        page.keys.resize(count);
+        page.values.resize(count);
+
+        if (count > 0)
+        {
+            std::memcpy(page.keys.data(), keys, count * sizeof(K));
+            std::memcpy(page.values.data(), values, count * sizeof(V));
+        }
+
+        if (!page.leaf)
+        {
+            page.children.resize(count + 1);
+            std::memcpy(page.children.data(), children, (count + 1) * sizeof(int64_t));
+        }
+        return page;
+    }
+
+    // each reader owns a stream, so reads from different threads never share a file position
+    void reader_loop()
+    {
+        std::ifstream from(this->filename, std::ios::binary);
+
+        while (true)
+        {
+            Read *read;
+            {
+                std::unique_lock<std::mutex> guard(this->lock);
+                this->work_ready.wait(guard, [this] { return this->stopping || !this->pending.empty(); });
+
+                if (this->pending.empty())
+                {
+                    return;
+                }
+
+                read = this->pending.front();
+                this->pending.pop_front();
+            }
+
+            // a failed read comes back empty and is reported by the thread that asked for it
+            try
+            {
+                read_page(from, read->page_number, read->bytes);
+            }
+            catch (std::exception &)
+            {
+                read->bytes.clear();
+            }
+
+            std::lock_guard<std::mutex> guard(this->lock);
+            if (--this->unfinished == 0)
+            {
+                this->work_done.notify_all();
+            }
+        }
+    }
+
+    // hand every read to the pool and wait until all of them have landed
+    void read_all(std::vector<Read *> &reads)
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->unfinished += reads.size();
+            this->pending.insert(this->pending.end(), reads.begin(), reads.end());
+        }
+        this->work_ready.notify_all();
+
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->work_done.wait(guard, [this] { return this->unfinished == 0; });
+    }
+
+    // index of the first key greater than key, as B_Tree::get_index
+    static int get_index(Page &page, K key)
+    {
+        return std::upper_bound(page.keys.begin(), page.keys.end(), key) - page.keys.begin();
+    }
+
+public:
+    Page_Store(const std::string &filename, int reader_count = 8)
+    {
+        static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value, "Page_Store needs trivially copyable keys and values");
+
+        if (reader_count < 1)
+        {
+            throw std::invalid_argument("reader count must be at least 1");
+        }
+
+        this->filename = filename;
+        this->file.open(filename, std::ios::binary);
+
+        int64_t header[5];
+        this->file.read((char *)header, sizeof(header));
+
+        if (!this->file)
+        {
+            throw std::runtime_error("could not read " + filename);
+        }
+
+        this->page_size = header[0];
+        this->max_kv_pairs = header[1];
+        this->page_count = header[2];
+
+        if (header[3] != sizeof(K) || header[4] != sizeof(V) || this->page_size != B_Tree<K, V>::page_bytes(this->max_kv_pairs))
+        {
+            throw std::runtime_error(filename + " was not written for these key and value types");
+        }
+
+        this->unfinished = 0;
+        this->stopping = false;
+
+        for (int i = 0; i < reader_count; i++)
+        {
+            this->readers.emplace_back(&Page_Store::reader_loop, this);
+        }
+    }
+
+    ~Page_Store()
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->stopping = true;
+        }
+        this->work_ready.notify_all();
+
+        for (std::thread &reader : this->readers)
+        {
+            reader.join();
+        }
+    }
+
+    Page_Store(const Page_Store &) = delete;
+    Page_Store &operator=(const Page_Store &) = delete;
+
+    // one synchronous descent, blocking on every page read
+    bool find(K key, V &value)
+    {
+        std::vector<char> bytes;
+        int64_t page_number = 1;
+
+        while (true)
+        {
+            read_page(this->file, page_number, bytes);
+            Page page = decode(bytes);
+            int index = get_index(page, key);
+
+            if (index > 0 && page.keys.at(index - 1) == key)
+            {
+                value = page.values.at(index - 1);
+                return true;
+            }
+
+            if (page.leaf)
+            {
+                return false;
+            }
+            page_number = page.children.at(index);
+        }
+    }
+
+    // look up every key in keys, storing each value found in values. the lookups advance a level
+    // at a time in groups of in_flight, and the page reads of a whole level are issued together
+    std::vector<bool> multi_find(std::vector<K> &keys, std::vector<V> &values, int in_flight = 256)
+    {
+        if (in_flight < 1)
+        {
+            throw std::invalid_argument("in_flight must be at least 1");
+        }
+
+        std::vector<bool> found(keys.size(), false);
+        values.resize(keys.size());
+
+        std::vector<Read> reads(std::min<int>(in_flight, keys.size()));
+        std::vector<Read *> batch;
+
+        for (int start = 0; start < keys.size(); start += in_flight)
+        {
+            int count = std::min<int>(in_flight, keys.size() - start);
+
+            for (int i = 0; i < count; i++)
+            {
+                reads.at(i).page_number = 1;
+            }
+
+            // a lookup drops out by setting its page number to 0
+            while (true)
+            {
+                batch.clear();
+                for (int i = 0; i < count; i++)
+                {
+                    if (reads.at(i).page_number != 0)
+                    {
+                        batch.push_back(&reads.at(i));
+                    }
+                }
+
+                if (batch.empty())
+                {
+                    break;
+                }
+
+                read_all(batch);
+
+                for (int i = 0; i < count; i++)
+                {
+                    Read &read = reads.at(i);
+
+                    if (read.page_number == 0)
+                    {
+                        continue;
+                    }
+
+                    if (read.bytes.size() != this->page_size)
+                    {
+                        throw std::runtime_error("could not read page " + std::to_string(read.page_number) + " of " + this->filename);
+                    }
+
+                    Page page = decode(read.bytes);
+                    K key = keys.at(start + i);
+                    int index = get_index(page, key);
+
+                    if (index > 0 && page.keys.at(index - 1) == key)
+                    {
+                        found.at(start + i) = true;
+                        values.at(start + i) = page.values.at(index - 1);
+                        read.page_number = 0;
+                    }
+                    else if (page.leaf)
+                    {
+                        read.page_number = 0;
+                    }
+                    else
+                    {
+                        read.page_number = page.children.at(index);
+                    }
+                }
+            }
+        }
+        return found;
+    }
+};
+
+std::vector<int> data_gen(int count)
+{
+    std::vector<int> result(count);
+
+    // 1. Fill with 1, 2, 3, ... count
+    // std::iota is a clean way to fill a range with increasing values
+    std::iota(result.begin(), result.end(), 1);
+
+    // 2. Shuffle using a stable random engine
+    static std::random_device rd;
+    static std::mt19937 engine(rd());
+    std::shuffle(result.begin(), result.end(), engine);
+
+    return result;
+}
+
+// insert and remove print as they go, so tests driving thousands of them mute the console
+struct Mute_Output
+{
+    std::streambuf *saved;
+
+    Mute_Output()
+    {
+        this->saved = std::cout.rdbuf(nullptr);
+    }
+
+    ~Mute_Output()
+    {
+        std::cout.rdbuf(this->saved);
+        std::cout.clear();
+    }
+};
+
+void run_comprehensive_test(int b_count)
+{
+    std::cout << "\n=== STARTING COMPREHENSIVE B-TREE MAP TEST (b=" << b_count << ") ===\n";
+    B_Tree<int, int> tree(b_count);
+    int total_items = 1000;
+
+    // TEST 1: Insertion & Correct Value Mapping
+    std::cout << "[TEST 1] Inserting " << total_items << " items... ";
+    for (int i = 1; i <= total_items; i++)
+    {
+        tree.insert(i, i * 10); // Value is 10x the key
+    }
+
+    bool insert_ok = true;
+    for (int i = 1; i <= total_items; i++)
+    {
+        if (!tree.in_tree(i))
+        {
+            std::cout << "\nFAILED: Key " << i << " missing after insertion.";
+            insert_ok = false;
+            break;
+        }
+    }
+    if (insert_ok)
+        std::cout << "PASSED\n";
+
+    // TEST 2: Map Update Logic (Upsert)
+    std::cout << "[TEST 2] Testing Value Updates... ";
+    tree.insert(500, 9999); // Overwrite old value (5000) with 9999
+    // Note: You might need to add a 'get' or 'at' method to your B_Tree
+    // to verify the value 9999 is actually there.
+    if (tree.in_tree(500))
+        std::cout << "PASSED (Key exists)\n";
+    else
+        std::cout << "FAILED (Key lost during update)\n";
+
+    // TEST 3: Non-Leaf Deletion (Internal Node)
+    // In a tree with 1000 items, low numbers like 10 or 20 are likely in internal nodes
+    std::cout << "[TEST 3] Deleting Internal Node Keys... ";
+    int internal_key = 10;
+    tree.remove(internal_key);
+    if (tree.in_tree(internal_key))
+    {
+        std::cout << "FAILED: Key " << internal_key << " still exists after remove.\n";
+    }
+    else
+    {
+        std::cout << "PASSED\n";
+    }
+
+    // TEST 4: Massive Random Deletion (Triggers Borrow & Merge)
+    std::cout << "[TEST 4] Random Deletion (Borrow/Merge Stress)... ";
+    std::vector<int> random_keys = data_gen(total_items);
+    bool delete_ok = true;
+    for (int key : random_keys)
+    {
+        if (key == internal_key)
+            continue; // already deleted
+        tree.remove(key);
+        if (tree.in_tree(key))
+        {
+            std::cout << "\nFAILED: Key " << key << " still found after removal.";
+            delete_ok = false;
+            break;
+        }
+    }
+    if (delete_ok)
+        std::cout << "PASSED\n";
+
+    // TEST 5: Empty Tree Integrity
+    std::cout << "[TEST 5] Empty Tree State... ";
+    if (tree.in_tree(1))
+        std::cout << "FAILED (Tree should be empty)\n";
+    else
+        std::cout << "PASSED\n";
+
+    // TEST 6: Order Statistics against a sorted std::map
+    std::cout << "[TEST 6] Rank, Select and Count Range... ";
+    std::mt19937 engine(b_count);
+    B_Tree<int, int> ordered(b_count);
+    std::map<int, int> oracle;
+    {
+        Mute_Output mute;
+        for (int i = 0; i < 10 * total_items; i++)
+        {
+            int key = engine() % (40 * total_items);
+            ordered.insert(key, i);
+            oracle[key] = i;
+        }
+    }
+    std::vector<std::pair<int, int>> sorted(oracle.begin(), oracle.end());
+    bool order_ok = true;
+    for (int i = 0; i < 1000 && order_ok; i++)
+    {
+        int low = (int)(engine() % (40 * total_items + 2)) - 1;
+        int high = low + engine() % 1000;
+        int index = engine() % sorted.size();
+        int low_rank = std::lower_bound(sorted.begin(), sorted.end(), std::make_pair(low, std::numeric_limits<int>::min())) - sorted.begin();
+        int high_rank = std::lower_bound(sorted.begin(), sorted.end(), std::make_pair(high, std::numeric_limits<int>::min())) - sorted.begin();
+
+        order_ok = ordered.rank(low) == low_rank && ordered.select(index) == sorted.at(index) &&
+                   ordered.count_range(low, high) == high_rank - low_rank && ordered.size() == (int)sorted.size();
+    }
+    if (order_ok)
+        std::cout << "PASSED\n";
+    else
+        std::cout << "FAILED\n";
+
+    // TEST 7: Range Aggregates kept in step with updates and removals
+    std::cout << "[TEST 7] Range Aggregates... ";
+    static_assert(std::is_const<std::remove_reference_t<decltype(std::declval<B_Tree<int, int, Sum_Aggregate<int>> &>().at(0))>>::value,
+                  "at() must not hand out a writable value when an aggregate is kept");
+    B_Tree<int, int, Sum_Aggregate<int>> sums(b_count);
+    B_Tree<int, int, Min_Aggregate<int>> mins(b_count);
+    B_Tree<int, int, Max_Aggregate<int>> maxes(b_count);
+    bool aggregate_ok = true;
+    {
+        Mute_Output mute;
+        for (int i = 0; i < 100; i++)
+        {
+            sums.insert(i, 1);
+        }
+        sums.update_if_present(50, [](int &value)
+                               { value = 1000; });
+        aggregate_ok = sums.aggregate(0, 100) == 1099 && sums.at(50) == 1000;
+
+        sums.clear();
+        oracle.clear();
+        for (int i = 0; i < 10 * total_items; i++)
+        {
+            int key = engine() % (4 * total_items);
+            int value = (int)(engine() % 100000);
+            if (engine() % 4 == 0)
+            {
+                sums.remove(key);
+                mins.remove(key);
+                maxes.remove(key);
+                oracle.erase(key);
+            }
+            else
+            {
+                sums.insert(key, value);
+                mins.insert(key, value);
+                maxes.insert(key, value);
+                oracle[key] = value;
+            }
+        }
+    }
+    for (int i = 0; i < 1000 && aggregate_ok; i++)
+    {
+        int low = (int)(engine() % (4 * total_items + 2)) - 1;
+        int high = low + engine() % (total_items + 1);
+        int sum = 0;
+        int min = std::numeric_limits<int>::max();
+        int max = std::numeric_limits<int>::lowest();
+        for (auto it = oracle.lower_bound(low); it != oracle.end() && it->first < high; ++it)
+        {
+            sum += it->second;
+            min = std::min(min, it->second);
+            max = std::max(max, it->second);
+        }
+        aggregate_ok = sums.aggregate(low, high) == sum && mins.aggregate(low, high) == min && maxes.aggregate(low, high) == max;
+    }
+    if (aggregate_ok)
+        std::cout << "PASSED\n";
+    else
+        std::cout << "FAILED\n";
+
+    // TEST 8: Split and Join, carrying values and aggregates
+    std::cout << "[TEST 8] Split and Join... ";
+    bool split_ok = true;
+    for (int round = 0; round < 20 && split_ok; round++)
+    {
+        int key = (int)(engine() % (4 * total_items + 2)) - 1;
+        std::map<int, int> low_pairs(oracle.begin(), oracle.lower_bound(key));
+        std::map<int, int> high_pairs(oracle.lower_bound(key), oracle.end());
+        int low_sum = 0;
+        for (auto &pair : low_pairs)
+        {
+            low_sum += pair.second;
+        }
+
+        B_Tree<int, int, Sum_Aggregate<int>> right = sums.split(key);
+        split_ok = sums.scan(-1, 4 * total_items) == std::vector<std::pair<int, int>>(low_pairs.begin(), low_pairs.end()) &&
+                   right.scan(-1, 4 * total_items) == std::vector<std::pair<int, int>>(high_pairs.begin(), high_pairs.end()) &&
+                   sums.aggregate(-1, 4 * total_items) == low_sum;
+
+        if (round % 2 == 0)
+        {
+            sums.join(right);
+        }
+        else
+        {
+            right.join(sums);
+            sums = std::move(right);
+        }
+        split_ok = split_ok && sums.scan(-1, 4 * total_items) == std::vector<std::pair<int, int>>(oracle.begin(), oracle.end()) &&
+                   sums.size() == (int)oracle.size() && right.size() == 0;
+    }
+    if (split_ok)
+        std::cout << "PASSED\n";
+    else
+        std::cout << "FAILED\n";
+
+    // TEST 9: Range Erase
+    std::cout << "[TEST 9] Range Erase... ";
+    bool range_ok = true;
+    for (int round = 0; round < 20 && range_ok; round++)
+    {
+        int low = (int)(engine() % (4 * total_items + 2)) - 1;
+        int high = low + engine() % (total_items / 2 + 1);
+        int expected = std::distance(oracle.lower_bound(low), oracle.lower_bound(high));
+        int sum = 0;
+
+        oracle.erase(oracle.lower_bound(low), oracle.lower_bound(high));
+        for (auto &pair : oracle)
+        {
+            sum += pair.second;
+        }
+        range_ok = sums.erase_range(low, high) == expected && sums.aggregate(-1, 4 * total_items) == sum &&
+                   sums.scan(-1, 4 * total_items) == std::vector<std::pair<int, int>>(oracle.begin(), oracle.end());
+    }
+    range_ok = range_ok && sums.erase_range(-1, 4 * total_items) == (int)oracle.size() && sums.size() == 0;
+    oracle.clear();
+    if (range_ok)
+        std::cout << "PASSED\n";
+    else
+        std::cout << "FAILED\n";
+
+    // TEST 10: Churn over a small key space, removing separators from internal blocks
+    std::cout << "[TEST 10] Insert/Remove Churn... ";
+    B_Tree<int, int, Sum_Aggregate<int>> churned(b_count);
+    bool churn_ok = true;
+    for (int i = 0; i < 10 * total_items && churn_ok; i++)
+    {
+        int key = engine() % total_items;
+        {
+            Mute_Output mute;
+            if (engine() % 2 == 0)
+            {
+                churned.insert(key, i);
+                oracle[key] = i;
+            }
+            else
+            {
+                churned.remove(key);
+                oracle.erase(key);
+            }
+        }
+        if (i % 1000 == 999)
+        {
+            int sum = 0;
+            for (auto &pair : oracle)
+            {
+                sum += pair.second;
+            }
+            churn_ok = churned.scan(-1, total_items) == std::vector<std::pair<int, int>>(oracle.begin(), oracle.end()) &&
+                       churned.stats().underfull_blocks == 0 && churned.aggregate(-1, total_items) == sum &&
+                       churned.count_range(-1, total_items) == (int)oracle.size();
+        }
+    }
+    {
+        std::vector<int> remaining;
+        for (auto &pair : oracle)
+        {
+            remaining.push_back(pair.first);
+        }
+        std::shuffle(remaining.begin(), remaining.end(), engine);
+        Mute_Output mute;
+        for (int key : remaining)
+        {
+            churned.remove(key);
+        }
+    }
+    churn_ok = churn_ok && churned.size() == 0 && churned.stats().blocks == 1;
+    oracle.clear();
+    if (churn_ok)
+        std::cout << "PASSED\n";
+    else
+        std::cout << "FAILED\n";
+
+    // TEST 11: Ordered queries around buried keys, which must leave the tombstones in place
+    std::cout << "[TEST 11] Lazy Deletion Queries... ";
+    B_Tree<int, int, Sum_Aggregate<int>> lazy(b_count);
+    lazy.set_lazy_delete(true);
+    {
+        Mute_Output mute;
+        for (int i = 0; i < 2 * total_items; i++)
+        {
+            int key = engine() % (4 * total_items);
+            lazy.insert(key, i);
+            oracle[key] = i;
+        }
+        // inserts purge a few tombstones each, so the removals come last
+        for (int i = 0; i < total_items; i++)
+        {
+            int key = engine() % (4 * total_items);
+            lazy.remove(key);
+            oracle.erase(key);
+        }
+    }
+    std::vector<std::pair<int, int>> lazy_pairs(oracle.begin(), oracle.end());
+    int buried = lazy.tombstone_count();
+    bool lazy_ok = buried > 0 && lazy.size() == (int)oracle.size();
+    for (int i = 0; i < 1000 && lazy_ok; i++)
+    {
+        int low = (int)(engine() % (4 * total_items + 2)) - 1;
+        int high = low + engine() % (total_items + 1);
+        int index = engine() % lazy_pairs.size();
+        int sum = 0;
+        for (auto it = oracle.lower_bound(low); it != oracle.end() && it->first < high; ++it)
+        {
+            sum += it->second;
+        }
+        std::vector<int> probes = {low, high, lazy_pairs.at(index).first};
+        std::vector<bool> present = lazy.multi_contains(probes);
+
+        lazy_ok = lazy.rank(low) == (int)std::distance(oracle.begin(), oracle.lower_bound(low)) &&
+                  lazy.select(index) == lazy_pairs.at(index) &&
+                  lazy.count_range(low, high) == (int)std::distance(oracle.lower_bound(low), oracle.lower_bound(high)) &&
+                  lazy.aggregate(low, high) == sum && present.at(0) == (oracle.count(low) > 0) &&
+                  present.at(1) == (oracle.count(high) > 0) && present.at(2);
+    }
+    lazy_ok = lazy_ok && lazy.scan(-1, 4 * total_items) == lazy_pairs && lazy.tombstone_count() == buried;
+    for (int round = 0; round < 10 && lazy_ok; round++)
+    {
+        int key = (int)(engine() % (4 * total_items + 2)) - 1;
+        std::vector<std::pair<int, int>> high_pairs(oracle.lower_bound(key), oracle.end());
+
+        B_Tree<int, int, Sum_Aggregate<int>> right = lazy.split(key);
+        lazy_ok = right.scan(-1, 4 * total_items) == high_pairs && lazy.size() + right.size() == (int)oracle.size();
+        lazy.join(right);
+        lazy_ok = lazy_ok && lazy.scan(-1, 4 * total_items) == lazy_pairs && lazy.tombstone_count() == buried;
+    }
+    lazy.set_lazy_delete(false);
+    lazy_ok = lazy_ok && lazy.tombstone_count() == 0 && lazy.scan(-1, 4 * total_items) == lazy_pairs;
+    oracle.clear();
+    if (lazy_ok)
+        std::cout << "PASSED\n";
+    else
+        std::cout << "FAILED\n";
+
+    // TEST 12: Ordered queries read through buffered messages, and at() applies only its own key
+    std::cout << "[TEST 12] Buffered Queries... ";
+    B_Tree<int, int, Sum_Aggregate<int>> buffered(b_count);
+    int buffered_key = -1;
+    {
+        Mute_Output mute;
+        for (int i = 0; i < total_items; i++)
+        {
+            int key = engine() % (4 * total_items);
+            buffered.insert(key, i);
+            oracle[key] = i;
+        }
+        // fewer writes than the default capacity, so none of them is flushed yet
+        buffered.set_buffered(true);
+        for (int i = 0; i < total_items; i++)
+        {
+            int key = engine() % (4 * total_items);
+            if (engine() % 2 == 0)
+            {
+                buffered.insert(key, -i);
+                oracle[key] = -i;
+                buffered_key = key;
+            }
+            else
+            {
+                buffered.remove(key);
+                oracle.erase(key);
+                buffered_key = key == buffered_key ? -1 : buffered_key;
+            }
+        }
+    }
+    std::vector<std::pair<int, int>> buffered_pairs(oracle.begin(), oracle.end());
+    int pending = buffered.buffered_count();
+    bool buffered_ok = pending > 0 && buffered.size() == (int)oracle.size();
+    for (int i = 0; i < 1000 && buffered_ok; i++)
+    {
+        int low = (int)(engine() % (4 * total_items + 2)) - 1;
+        int high = low + engine() % (total_items + 1);
+        int index = engine() % buffered_pairs.size();
+        int sum = 0;
+        for (auto it = oracle.lower_bound(low); it != oracle.end() && it->first < high; ++it)
+        {
+            sum += it->second;
+        }
+
+        buffered_ok = buffered.rank(low) == (int)std::distance(oracle.begin(), oracle.lower_bound(low)) &&
+                      buffered.select(index) == buffered_pairs.at(index) &&
+                      buffered.count_range(low, high) == (int)std::distance(oracle.lower_bound(low), oracle.lower_bound(high)) &&
+                      buffered.aggregate(low, high) == sum &&
+                      buffered.scan(low, high) == std::vector<std::pair<int, int>>(oracle.lower_bound(low), oracle.lower_bound(high));
+    }
+    buffered_ok = buffered_ok && (int)buffered.freeze().size() == (int)oracle.size() && buffered.buffered_count() == pending;
+
+    // at() applies just the message for its key, so the reference it hands out points into a block
+    if (buffered_key >= 0)
+    {
+        buffered_ok = buffered_ok && buffered.at(buffered_key) == oracle[buffered_key] && buffered.buffered_count() == pending - 1;
+    }
+    buffered.set_buffered(false);
+    buffered_ok = buffered_ok && buffered.buffered_count() == 0 && buffered.scan(-1, 4 * total_items) == buffered_pairs;
+    oracle.clear();
+    if (buffered_ok)
+        std::cout << "PASSED\n";
+    else
+        std::cout << "FAILED\n";
+
+    // TEST 13: Batched lookups resolve buffered messages, tombstones and cached blocks per key
+    std::cout << "[TEST 13] Batched Lookups... ";
+    B_Tree<int, int> batched(b_count);
+    batched.set_cache(256);
+    batched.set_lazy_delete(true);
+    batched.set_buffered(true, 64);
+    static_assert(std::is_same<decltype(batched.multi_get(std::declval<std::vector<int> &>())), std::vector<const int *>>::value,
+                  "multi_get hands out read only values");
+    bool batched_ok = true;
+    for (int round = 0; round < 20 && batched_ok; round++)
+    {
+        {
+            Mute_Output mute;
+            for (int i = 0; i < total_items / 4; i++)
+            {
+                int key = engine() % total_items;
+                if (engine() % 3 == 0)
+                {
+                    batched.remove(key);
+                    oracle.erase(key);
+                }
+                else
+                {
+                    batched.insert(key, round * total_items + i);
+                    oracle[key] = round * total_items + i;
+                }
+            }
+        }
+
+        std::vector<int> probes;
+        for (int i = 0; i < 100; i++)
+        {
+            probes.push_back(engine() % (total_items + 10));
+        }
+        std::vector<bool> present = batched.multi_contains(probes);
+        std::vector<const int *> values = batched.multi_get(probes);
+        for (int i = 0; i < probes.size() && batched_ok; i++)
+        {
+            auto it = oracle.find(probes.at(i));
+            batched_ok = present.at(i) == (it != oracle.end()) && (values.at(i) != nullptr) == (it != oracle.end()) &&
+                         (values.at(i) == nullptr || *values.at(i) == it->second);
+        }
+    }
+    batched_ok = batched_ok && batched.cache_hits() > 0 && batched.size() == (int)oracle.size();
+    oracle.clear();
+    if (batched_ok)
+        std::cout << "PASSED\n";
+    else
+        std::cout << "FAILED\n";
+
+    // TEST 14: Page Store reads back what write_pages wrote, and refuses damaged pages
+    std::cout << "[TEST 14] Page Store... ";
+    B_Tree<int, int> paged(b_count);
+    {
+        Mute_Output mute;
+        for (int i = 0; i < total_items; i++)
+        {
+            paged.insert(i, 7 * i);
+        }
+    }
+    const std::string page_file = "b_tree_map_test.pages";
+    paged.write_pages(page_file);
+    bool pages_ok = true;
+    {
+        Page_Store<int, int> store(page_file, 2);
+        std::vector<int> keys;
+        std::vector<int> values;
+        for (int i = -5; i < total_items + 5; i++)
+        {
+            keys.push_back(i);
+        }
+        std::vector<bool> found = store.multi_find(keys, values, 64);
+        for (int i = 0; i < keys.size() && pages_ok; i++)
+        {
+            int value = -1;
+            bool in_range = keys.at(i) >= 0 && keys.at(i) < total_items;
+            pages_ok = found.at(i) == in_range && store.find(keys.at(i), value) == in_range && (!in_range || (values.at(i) == 7 * keys.at(i) && value == 7 * keys.at(i)));
+        }
+    }
+
+    // the last page is the rightmost leaf. cut it off, then put it back with an impossible count
+    std::vector<char> contents;
+    {
+        std::ifstream in(page_file, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    int64_t page_size = 0;
+    std::memcpy(&page_size, contents.data(), sizeof(page_size));
+    {
+        std::ofstream out(page_file, std::ios::binary | std::ios::trunc);
+        out.write(contents.data(), contents.size() - page_size);
+    }
+    if (pages_ok && contents.size() / page_size > 3)
+    {
+        Page_Store<int, int> store(page_file, 2);
+        int value;
+        bool threw = false;
+        bool recovered = false;
+        try
+        {
+            store.find(total_items - 1, value);
+        }
+        catch (std::runtime_error &)
+        {
+            threw = true;
+        }
+
+        // the stream recovers from the failed read, so lookups elsewhere still work
+        try
+        {
+            recovered = store.find(0, value) && value == 0;
+        }
+        catch (std::runtime_error &)
+        {
+        }
+        pages_ok = threw && recovered;
+    }
+    if (pages_ok && contents.size() / page_size > 3)
+    {
+        int32_t bad_count = 1 << 30;
+        std::memcpy(contents.data() + contents.size() - page_size, &bad_count, sizeof(bad_count));
+        {
+            std::ofstream out(page_file, std::ios::binary | std::ios::trunc);
+            out.write(contents.data(), contents.size());
+        }
+        Page_Store<int, int> store(page_file, 2);
+        std::vector<int> keys(1, total_items);
+        std::vector<int> values;
+        int damaged = 0;
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            try
+            {
+                int value;
+                store.find(total_items - 1, value);
+            }
+            catch (std::runtime_error &)
+            {
+                damaged++;
+            }
+            try
+            {
+                store.multi_find(keys, values);
+            }
+            catch (std::runtime_error &)
+            {
+                damaged++;
+            }
+        }
+        pages_ok = damaged == 4;
+    }
+    std::remove(page_file.c_str());
+    if (pages_ok)
+        std::cout << "PASSED\n";
+    else
+        std::cout << "FAILED\n";
+
+    // TEST 15: The hot key cache answers values correctly while blocks split, merge and move
+    std::cout << "[TEST 15] Hot Key Cache... ";
+    B_Tree<int, int> cached(b_count);
+    cached.set_cache(256);
+    bool cache_ok = true;
+    for (int round = 0; round < 20 && cache_ok; round++)
+    {
+        {
+            Mute_Output mute;
+            for (int i = 0; i < total_items / 4; i++)
+            {
+                int key = engine() % total_items;
+                if (engine() % 3 == 0)
+                {
+                    cached.remove(key);
+                    oracle.erase(key);
+                }
+                else
+                {
+                    cached.insert(key, round);
+                    oracle[key] = round;
+                }
+            }
+        }
+
+        // a few hot keys take most of the lookups, and some of them are updated through the cache
+        for (int i = 0; i < 1000 && cache_ok; i++)
+        {
+            int key = engine() % 4 == 0 ? engine() % total_items : engine() % 32;
+            auto it = oracle.find(key);
+            int value = -1;
+
+            if (i % 10 == 0 && it != oracle.end())
+            {
+                cached.update_if_present(key, [](int &v) { v++; });
+                it->second++;
+            }
+            cache_ok = cached.find(key, value) == (it != oracle.end()) && (it == oracle.end() || value == it->second) &&
+                       cached.in_tree(key) == (it != oracle.end());
+        }
+
+        if (round % 5 == 4)
+        {
+            B_Tree<int, int> right = cached.split(engine() % total_items);
+            cached.join(right);
+        }
+    }
+    cache_ok = cache_ok && cached.cache_hits() > 0 && cached.cache_hit_rate() > 0 && cached.cache_hit_rate() <= 1 &&
+               cached.scan(-1, total_items) == std::vector<std::pair<int, int>>(oracle.begin(), oracle.end());
+    cached.clear();
+    cache_ok = cache_ok && !cached.in_tree(oracle.begin()->first) && cached.size() == 0;
+    oracle.clear();
+    if (cache_ok)
+        std::cout << "PASSED\n";
+    else
+        std::cout << "FAILED\n";
+
+    std::cout << "=== ALL TESTS COMPLETE ===\n\n";
+}
 
 // main
-int main()
+// benchmark : ./b_tree_map --bench [json_path] [max_items] [repetitions]
+// calibration : ./b_tree_map --calibrate [items] [insert_percent] [find_percent] [erase_percent]
+
+// a 32 byte key ordered by its first word, for measuring wider keys
+struct Wide_Key
+{
+    uint64_t words[4];
+
+    bool operator<(const Wide_Key &other) const { return this->words[0] < other.words[0]; }
+    bool operator>(const Wide_Key &other) const { return this->words[0] > other.words[0]; }
+    bool operator<=(const Wide_Key &other) const { return this->words[0] <= other.words[0]; }
+    bool operator>=(const Wide_Key &other) const { return this->words[0] >= other.words[0]; }
+    bool operator==(const Wide_Key &other) const { return this->words[0] == other.words[0]; }
+    bool operator!=(const Wide_Key &other) const { return this->words[0] != other.words[0]; }
+};
+
+std::ostream &operator<<(std::ostream &out, const Wide_Key &key)
+{
+    return out << key.words[0];
+}
+
+// a 64 byte value, for measuring wider pairs
+struct Wide_Value
+{
+    uint64_t words[8];
+};
+
+std::ostream &operator<<(std::ostream &out, const Wide_Value &value)
+{
+    return out << value.words[0];
+}
+
+struct Benchmark
+{
+    struct Result
+    {
+        std::string container;
+        std::string distribution;
+        std::string operation;
+        int b_count;
+        int key_bytes;
+        int value_bytes;
+        int items;
+        double ns_per_op;
+        double stddev_ns;
+    };
+
+    int max_items;
+    int repetitions;
+    std::vector<Result> results;
+
+    // checksum of every lookup, so the compiler cannot drop them
+    uint64_t found;
+
+    Benchmark(int max_items, int repetitions)
+    {
+        this->max_items = max_items;
+        this->repetitions = std::max(2, repetitions);
+        this->found = 0;
+    }
+
+    // bijective 64 bit mix, so distinct inputs stay distinct
+    static uint64_t mix(uint64_t x)
+    {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    template <typename K>
+    static K make_key(uint64_t x)
+    {
+        if constexpr (std::is_same<K, Wide_Key>::value)
+        {
+            return Wide_Key{{x, ~x, x * 31, 0}};
+        }
+        else
+        {
+            return (K)x;
+        }
+    }
+
+    template <typename V>
+    static V make_value(uint64_t x)
+    {
+        if constexpr (std::is_same<V, Wide_Value>::value)
+        {
+            return Wide_Value{{x, x + 1, x + 2, x + 3, x + 4, x + 5, x + 6, x + 7}};
+        }
+        else
+        {
+            return (V)x;
+        }
+    }
+
+    // keys in insertion order. sequential ascends, uniform and zipf are distinct random words,
+    // clustered inserts runs of 64 consecutive keys starting at random bases
+    static std::vector<uint64_t> insert_stream(const std::string &distribution, int count)
+    {
+        std::vector<uint64_t> keys(count);
+
+        for (int i = 0; i < count; i++)
+        {
+            if (distribution == "sequential")
+            {
+                keys.at(i) = i;
+            }
+            else if (distribution == "clustered")
+            {
+                keys.at(i) = (mix(i / 64) >> 7 << 6) + i % 64;
+            }
+            else
+            {
+                // the top bit is left clear so keys also fit signed types
+                keys.at(i) = mix(i) >> 1;
+            }
+        }
+        return keys;
+    }
+
+    // zipf ranks with skew theta over [0, count), rank 0 the hottest
+    class Zipf
+    {
+    private:
+        uint64_t count;
+        double theta;
+        double zeta_n;
+        double alpha;
+        double eta;
+
+    public:
+        Zipf(uint64_t count, double theta)
+        {
+            this->count = count;
+            this->theta = theta;
+
+            double zeta_2 = 1.0 + std::pow(0.5, theta);
+            this->zeta_n = 0;
+            for (uint64_t i = 1; i <= count; i++)
+            {
+                this->zeta_n += 1.0 / std::pow((double)i, theta);
+            }
+
+            this->alpha = 1.0 / (1.0 - theta);
+            this->eta = (1.0 - std::pow(2.0 / count, 1.0 - theta)) / (1.0 - zeta_2 / this->zeta_n);
+        }
+
+        uint64_t next(std::mt19937_64 &rng)
+        {
+            double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+            double uz = u * this->zeta_n;
+
+            if (uz < 1.0)
+            {
+                return 0;
+            }
+
+            if (uz < 1.0 + std::pow(0.5, this->theta))
+            {
+                return 1;
+            }
+            return std::min<uint64_t>(this->count - 1, this->count * std::pow(this->eta * u - this->eta + 1.0, this->alpha));
+        }
+    };
+
+    // the keys looked up, one per stored key. sequential walks them in order, zipf favours a few
+    // hot keys scattered over the key space, the rest pick stored keys uniformly
+    static std::vector<uint64_t> lookup_stream(const std::string &distribution, std::vector<uint64_t> &keys)
+    {
+        std::vector<uint64_t> lookups(keys.size());
+        std::mt19937_64 rng(42);
+
+        if (distribution == "sequential")
+        {
+            lookups = keys;
+        }
+        else if (distribution == "zipf")
+        {
+            Zipf zipf(keys.size(), 0.99);
+            for (uint64_t &key : lookups)
+            {
+                key = keys.at(zipf.next(rng));
+            }
+        }
+        else
+        {
+            for (uint64_t &key : lookups)
+            {
+                key = keys.at(rng() % keys.size());
+            }
+        }
+        return lookups;
+    }
+
+    // time repetitions runs of ops operations each and record the mean and standard deviation
+    // per operation. run() returns the nanoseconds spent on its timed part
+    template <typename Run>
+    void measure(Result result, int ops, Run run)
+    {
+        std::vector<double> samples;
+
+        for (int r = 0; r < this->repetitions; r++)
+        {
+            samples.push_back(run() / ops);
+        }
+
+        double mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+        double variance = 0;
+        for (double sample : samples)
+        {
+            variance += (sample - mean) * (sample - mean);
+        }
+
+        result.items = ops;
+        result.ns_per_op = mean;
+        result.stddev_ns = std::sqrt(variance / (samples.size() - 1));
+        this->results.push_back(result);
+
+        std::cout << std::left << std::setw(14) << result.container << std::setw(12) << result.distribution
+                  << std::setw(8) << result.operation << "b=" << std::setw(4) << result.b_count
+                  << "key=" << std::setw(4) << result.key_bytes << "value=" << std::setw(4) << result.value_bytes
+                  << "n=" << std::setw(10) << result.items
+                  << std::right << std::fixed << std::setprecision(1) << std::setw(9) << result.ns_per_op
+                  << " ns/op +- " << result.stddev_ns << std::endl;
+    }
+
+    template <typename Fn>
+    static double time_ns(Fn fn)
+    {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count();
+    }
+
+    // adapters give every container the same insert, find and erase
+    template <typename K, typename V>
+    struct Tree_Adapter
+    {
+        B_Tree<K, V> tree;
+
+        Tree_Adapter(int b_count, std::pmr::memory_resource *resource = std::pmr::get_default_resource()) : tree(b_count, resource) {}
+        void insert(std::vector<std::pair<K, V>> &pairs)
+        {
+            for (std::pair<K, V> &pair : pairs)
+            {
+                this->tree.put_key(pair.first, pair.second);
+            }
+        }
+        bool find(K key) { return this->tree.lookup(key) != nullptr; }
+        void erase(K key) { this->tree.remove_key(key); }
+    };
+
+    // a monotonic arena, held in a base so it is built before the tree and released after it
+    struct Arena
+    {
+        std::pmr::monotonic_buffer_resource arena;
+    };
+
+    // the same tree with every block carved from an arena that is dropped all at once
+    template <typename K, typename V>
+    struct Arena_Tree_Adapter : Arena, Tree_Adapter<K, V>
+    {
+        Arena_Tree_Adapter(int b_count) : Tree_Adapter<K, V>(b_count, &this->arena) {}
+    };
+
+    template <typename K, typename V>
+    struct Std_Map_Adapter
+    {
+        std::map<K, V> map;
+
+        Std_Map_Adapter(int) {}
+        void insert(std::vector<std::pair<K, V>> &pairs)
+        {
+            for (std::pair<K, V> &pair : pairs)
+            {
+                this->map[pair.first] = pair.second;
+            }
+        }
+        bool find(K key) { return this->map.find(key) != this->map.end(); }
+        void erase(K key) { this->map.erase(key); }
+    };
+
+    // a sorted vector is built in bulk and has no cheap erase, so it only measures build and find
+    template <typename K, typename V>
+    struct Sorted_Vector_Adapter
+    {
+        std::vector<std::pair<K, V>> pairs;
+
+        static bool key_less(const std::pair<K, V> &a, const std::pair<K, V> &b) { return a.first < b.first; }
+
+        Sorted_Vector_Adapter(int) {}
+        void insert(std::vector<std::pair<K, V>> &pairs)
+        {
+            this->pairs = pairs;
+            std::sort(this->pairs.begin(), this->pairs.end(), key_less);
+        }
+        bool find(K key)
+        {
+            auto it = std::lower_bound(this->pairs.begin(), this->pairs.end(), key,
+                                       [](const std::pair<K, V> &pair, const K &target) { return pair.first < target; });
+            return it != this->pairs.end() && it->first == key;
+        }
+    };
+
+    template <typename Adapter, typename K, typename V>
+    void run_container(const std::string &container, int b_count, const std::string &distribution, int items)
+    {
+        std::vector<uint64_t> raw_keys = insert_stream(distribution, items);
+        std::vector<uint64_t> raw_lookups = lookup_stream(distribution, raw_keys);
+        std::vector<std::pair<K, V>> pairs;
+        std::vector<K> lookups;
+
+        for (int i = 0; i < items; i++)
+        {
+            pairs.emplace_back(make_key<K>(raw_keys.at(i)), make_value<V>(raw_keys.at(i)));
+            lookups.push_back(make_key<K>(raw_lookups.at(i)));
+        }
+
+        Result result{container, distribution, "", b_count, (int)sizeof(K), (int)sizeof(V), items, 0, 0};
+
+        result.operation = "insert";
+        measure(result, items, [&]()
+                {
+                    Adapter adapter(b_count);
+                    return time_ns([&]() { adapter.insert(pairs); }); });
+
+        Adapter adapter(b_count);
+        adapter.insert(pairs);
+
+        result.operation = "find";
+        measure(result, items, [&]()
+                { return time_ns([&]()
+                                 {
+                                     for (K &key : lookups)
+                                     {
+                                         this->found += adapter.find(key);
+                                     } }); });
+
+        if constexpr (!std::is_same<Adapter, Sorted_Vector_Adapter<K, V>>::value)
+        {
+            result.operation = "erase";
+            measure(result, items, [&]()
+                    {
+                        Adapter fresh(b_count);
+                        fresh.insert(pairs);
+                        return time_ns([&]()
+                                       {
+                                           for (std::pair<K, V> &pair : pairs)
+                                           {
+                                               fresh.erase(pair.first);
+                                           } }); });
+        }
+    }
+
+    template <typename K, typename V>
+    void run_pair_type()
+    {
+        std::vector<std::string> distributions = {"sequential", "uniform", "zipf", "clustered"};
+        std::vector<int> b_counts = {4, 16, 64};
+
+        // sizes grow by 16x from cache resident up to max_items, past the last level cache by default
+        for (long long items = 1 << 10; items <= this->max_items; items *= 16)
+        {
+            for (std::string &distribution : distributions)
+            {
+                for (int b_count : b_counts)
+                {
+                    run_container<Tree_Adapter<K, V>, K, V>("B_Tree", b_count, distribution, items);
+                }
+                run_container<Arena_Tree_Adapter<K, V>, K, V>("B_Tree_arena", 16, distribution, items);
+                run_container<Std_Map_Adapter<K, V>, K, V>("std::map", 0, distribution, items);
+                run_container<Sorted_Vector_Adapter<K, V>, K, V>("sorted_vector", 0, distribution, items);
+            }
+        }
+    }
+
+    void write_json(const std::string &path)
+    {
+        std::ofstream out(path);
+
+        if (!out)
+        {
+            throw std::runtime_error("cannot write " + path);
+        }
+
+        out << "{\n  \"benchmark\": \"b_tree_map\",\n  \"repetitions\": " << this->repetitions << ",\n  \"results\": [\n";
+        for (size_t i = 0; i < this->results.size(); i++)
+        {
+            Result &result = this->results.at(i);
+            out << "    {\"container\": \"" << result.container << "\", \"distribution\": \"" << result.distribution
+                << "\", \"operation\": \"" << result.operation << "\", \"b_count\": " << result.b_count
+                << ", \"key_bytes\": " << result.key_bytes << ", \"value_bytes\": " << result.value_bytes << ", \"items\": " << result.items
+                << ", \"ns_per_op\": " << std::fixed << std::setprecision(2) << result.ns_per_op
+                << ", \"stddev_ns\": " << result.stddev_ns << "}" << (i + 1 < this->results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+};
+
+// mixed workload driver : ./b_tree_map --ycsb [name=value ...]
+//   records, operations, threads, shards, b, read, insert, update, delete, scan (percent),
+//   scan_length, theta (0 for uniform keys), buffered (capacity), lazy, cache (capacity)
+
+// log-linear latency histogram in the style of HdrHistogram. every power of two is cut into
+// 2^sub_bucket_bits buckets, so a recorded value is off by under 1 / 2^sub_bucket_bits
+class Latency_Histogram
+{
+private:
+    static constexpr int sub_bucket_bits = 5;
+    static constexpr int sub_buckets = 1 << sub_bucket_bits;
+
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t max;
+
+    static int bucket(uint64_t value)
+    {
+        if (value < sub_buckets)
+        {
+            return value;
+        }
+
+        int exponent = 63 - __builtin_clzll(value) - sub_bucket_bits;
+        return (exponent + 1) * sub_buckets + (int)(value >> exponent) - sub_buckets;
+    }
+
+    // the largest value falling into index
+    static uint64_t bucket_high(int index)
+    {
+        if (index < sub_buckets)
+        {
+            return index;
+        }
+
+        int exponent = index / sub_buckets - 1;
+        uint64_t mantissa = index % sub_buckets + sub_buckets;
+        return ((mantissa + 1) << exponent) - 1;
+    }
+
+public:
+    Latency_Histogram()
+    {
+        this->counts.assign((64 - sub_bucket_bits + 1) * sub_buckets, 0);
+        this->total = 0;
+        this->max = 0;
+    }
+
+    void record(uint64_t value)
+    {
+        this->counts.at(bucket(value))++;
+        this->total++;
+        this->max = std::max(this->max, value);
+    }
+
+    void merge(Latency_Histogram &other)
+    {
+        for (int i = 0; i < this->counts.size(); i++)
+        {
+            this->counts.at(i) += other.counts.at(i);
+        }
+        this->total += other.total;
+        this->max = std::max(this->max, other.max);
+    }
+
+    uint64_t count()
+    {
+        return this->total;
+    }
+
+    uint64_t maximum()
+    {
+        return this->max;
+    }
+
+    // the smallest recorded value at or above percent of all records
+    uint64_t percentile(double percent)
+    {
+        uint64_t target = std::max<uint64_t>(1, std::ceil(percent / 100.0 * this->total));
+        uint64_t seen = 0;
+
+        for (int i = 0; i < this->counts.size(); i++)
+        {
+            seen += this->counts.at(i);
+            if (seen >= target)
+            {
+                return std::min(bucket_high(i), this->max);
+            }
+        }
+        return this->max;
+    }
+};
+
+struct Workload
+{
+    enum Operation
+    {
+        READ,
+        INSERT,
+        UPDATE,
+        DELETE,
+        SCAN,
+        OPERATION_COUNT
+    };
+
+    static constexpr const char *operation_names[OPERATION_COUNT] = {"read", "insert", "update", "delete", "scan"};
+
+    int records = 1000000;
+    long long operations = 1000000;
+    int threads = 1;
+    int shards = 1;
+    int b_count = 16;
+    int percent[OPERATION_COUNT] = {50, 0, 50, 0, 0};
+    int scan_length = 100;
+    double theta = 0.99;
+    int buffered = 0;
+    bool lazy = false;
+    int cache = 0;
+
+    // the tree is not thread safe, so every shard is a tree behind its own lock. a key lives in
+    // shard key % shards, and a scan visits every shard
+    std::vector<B_Tree<uint64_t, uint64_t> *> trees;
+    std::vector<std::mutex> locks;
+    std::atomic<uint64_t> next_record;
+
+    void configure(const std::string &name, const std::string &value)
+    {
+        for (int op = 0; op < OPERATION_COUNT; op++)
+        {
+            if (name == operation_names[op])
+            {
+                this->percent[op] = std::stoi(value);
+                return;
+            }
+        }
+
+        if (name == "records")
+            this->records = std::stoi(value);
+        else if (name == "operations")
+            this->operations = std::stoll(value);
+        else if (name == "threads")
+            this->threads = std::max(1, std::stoi(value));
+        else if (name == "shards")
+            this->shards = std::max(1, std::stoi(value));
+        else if (name == "b")
+            this->b_count = std::max(2, std::stoi(value));
+        else if (name == "scan_length")
+            this->scan_length = std::max(1, std::stoi(value));
+        else if (name == "theta")
+            this->theta = std::stod(value);
+        else if (name == "buffered")
+            this->buffered = std::stoi(value);
+        else if (name == "lazy")
+            this->lazy = std::stoi(value) != 0;
+        else if (name == "cache")
+            this->cache = std::stoi(value);
+        else
+            throw std::invalid_argument("unknown workload setting " + name);
+    }
+
+    B_Tree<uint64_t, uint64_t> &shard(uint64_t key)
+    {
+        return *this->trees.at(key % this->shards);
+    }
+
+    std::mutex &lock(uint64_t key)
+    {
+        return this->locks.at(key % this->shards);
+    }
+
+    // record ids are keys in order, so scans read neighbouring records. requests pick ids by
+    // scrambled zipf rank, which spreads the hot records over the whole key space
+    uint64_t pick_record(Benchmark::Zipf *zipf, std::mt19937_64 &rng)
+    {
+        uint64_t rank = zipf != nullptr ? zipf->next(rng) : rng() % this->records;
+        return Benchmark::mix(rank) % this->records;
+    }
+
+    void run_operation(Operation op, uint64_t key, uint64_t &checksum)
+    {
+        if (op == SCAN)
+        {
+            for (int s = 0; s < this->shards; s++)
+            {
+                std::lock_guard<std::mutex> guard(this->locks.at(s));
+                checksum += this->trees.at(s)->scan(key, key + this->scan_length).size();
+            }
+            return;
+        }
+
+        B_Tree<uint64_t, uint64_t> &tree = shard(key);
+        std::lock_guard<std::mutex> guard(lock(key));
+
+        if (op == READ)
+        {
+            uint64_t value = 0;
+            tree.find(key, value);
+            checksum += value;
+        }
+        else if (op == INSERT)
+        {
+            tree.upsert(key, [key](uint64_t &value)
+                        { value = key; });
+        }
+        else if (op == UPDATE)
+        {
+            tree.update_if_present(key, [](uint64_t &value)
+                                   { value++; });
+        }
+        else if (tree.buffered)
+        {
+            tree.buffer_message(key, false, 0);
+        }
+        else if (tree.lazy_delete)
+        {
+            tree.bury_key(key);
+        }
+        else
+        {
+            tree.remove_key(key);
+        }
+    }
+
+    void worker(int thread, long long count, Benchmark::Zipf *zipf, std::vector<Latency_Histogram> &histograms, uint64_t &checksum)
+    {
+        std::mt19937_64 rng(1000 + thread);
+        int mix_total = 0;
+        for (int op = 0; op < OPERATION_COUNT; op++)
+        {
+            mix_total += this->percent[op];
+        }
+
+        for (long long i = 0; i < count; i++)
+        {
+            int roll = rng() % mix_total;
+            int op = 0;
+            while (roll >= this->percent[op])
+            {
+                roll -= this->percent[op];
+                op++;
+            }
+
+            // inserts append new records past the loaded ones
+            uint64_t key = op == INSERT ? this->next_record++ : pick_record(zipf, rng);
+
+            auto start = std::chrono::steady_clock::now();
+            run_operation((Operation)op, key, checksum);
+            auto end = std::chrono::steady_clock::now();
+
+            histograms.at(op).record(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+    }
+
+    void run()
+    {
+        int mix_total = 0;
+        for (int op = 0; op < OPERATION_COUNT; op++)
+        {
+            mix_total += this->percent[op];
+        }
+
+        if (mix_total <= 0 || this->records <= 0)
+        {
+            throw std::invalid_argument("the workload needs records and a positive operation mix");
+        }
+
+        std::vector<std::mutex>(this->shards).swap(this->locks);
+        for (int s = 0; s < this->shards; s++)
+        {
+            B_Tree<uint64_t, uint64_t> *tree = new B_Tree<uint64_t, uint64_t>(this->b_count);
+
+            if (this->cache > 0)
+            {
+                tree->set_cache(this->cache);
+            }
+            this->trees.push_back(tree);
+        }
+
+        // load every record in shuffled order before the modes are switched on
+        std::vector<uint64_t> load_order(this->records);
+        std::iota(load_order.begin(), load_order.end(), 0);
+        std::shuffle(load_order.begin(), load_order.end(), std::mt19937_64(7));
+
+        auto load_start = std::chrono::steady_clock::now();
+        for (uint64_t key : load_order)
+        {
+            shard(key).put_key(key, key);
+        }
+        auto load_end = std::chrono::steady_clock::now();
+
+        for (B_Tree<uint64_t, uint64_t> *tree : this->trees)
+        {
+            if (this->buffered > 0)
+            {
+                tree->set_buffered(true, this->buffered);
+            }
+            tree->set_lazy_delete(this->lazy);
+        }
+
+        Benchmark::Zipf *zipf = this->theta > 0 ? new Benchmark::Zipf(this->records, this->theta) : nullptr;
+        this->next_record = this->records;
+
+        std::vector<std::vector<Latency_Histogram>> histograms(this->threads, std::vector<Latency_Histogram>(OPERATION_COUNT));
+        std::vector<uint64_t> checksums(this->threads, 0);
+        std::vector<std::thread> workers;
+
+        auto run_start = std::chrono::steady_clock::now();
+        for (int t = 0; t < this->threads; t++)
+        {
+            long long count = this->operations / this->threads + (t < this->operations % this->threads ? 1 : 0);
+            workers.emplace_back(&Workload::worker, this, t, count, zipf, std::ref(histograms.at(t)), std::ref(checksums.at(t)));
+        }
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+        auto run_end = std::chrono::steady_clock::now();
+
+        double load_seconds = std::chrono::duration<double>(load_end - load_start).count();
+        double run_seconds = std::chrono::duration<double>(run_end - run_start).count();
+
+        std::cout << "loaded " << this->records << " records in " << std::fixed << std::setprecision(3) << load_seconds << " s" << std::endl;
+        std::cout << "ran " << this->operations << " operations on " << this->threads << " threads over " << this->shards
+                  << " shards (b=" << this->b_count << ") in " << run_seconds << " s, "
+                  << std::setprecision(0) << this->operations / run_seconds << " ops/s" << std::endl;
+        std::cout << std::left << std::setw(8) << "op" << std::right << std::setw(12) << "count" << std::setw(12) << "ops/s"
+                  << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << std::setw(10) << "p99.9 us" << std::setw(10) << "max us" << std::endl;
+
+        Latency_Histogram overall;
+        for (int op = 0; op <= OPERATION_COUNT; op++)
+        {
+            Latency_Histogram merged;
+
+            if (op < OPERATION_COUNT)
+            {
+                for (int t = 0; t < this->threads; t++)
+                {
+                    merged.merge(histograms.at(t).at(op));
+                }
+                overall.merge(merged);
+            }
+            else
+            {
+                merged = overall;
+            }
+
+            if (merged.count() == 0)
+            {
+                continue;
+            }
+
+            std::cout << std::left << std::setw(8) << (op < OPERATION_COUNT ? operation_names[op] : "all") << std::right
+                      << std::setw(12) << merged.count() << std::setw(12) << std::setprecision(0) << merged.count() / run_seconds
+                      << std::setprecision(2) << std::setw(10) << merged.percentile(50) / 1000.0
+                      << std::setw(10) << merged.percentile(99) / 1000.0 << std::setw(10) << merged.percentile(99.9) / 1000.0
+                      << std::setw(10) << merged.maximum() / 1000.0 << std::endl;
+        }
+
+        uint64_t checksum = std::accumulate(checksums.begin(), checksums.end(), (uint64_t)0);
+        std::cout << "checksum " << checksum << std::endl;
+
+        delete zipf;
+        for (B_Tree<uint64_t, uint64_t> *tree : this->trees)
+        {
+            delete tree;
+        }
+        this->trees.clear();
+    }
+};
+
+int main(int argc, char **argv)
 {
+    if (argc > 1 && std::strcmp(argv[1], "--ycsb") == 0)
+    {
+        Workload workload;
+
+        for (int i = 2; i < argc; i++)
+        {
+            std::string setting = argv[i];
+            size_t equals = setting.find('=');
+
+            if (equals == std::string::npos)
+            {
+                throw std::invalid_argument("workload settings are name=value, got " + setting);
+            }
+            workload.configure(setting.substr(0, equals), setting.substr(equals + 1));
+        }
+
+        workload.run();
+        return 0;
+    }
+
+    if (argc > 1 && std::strcmp(argv[1], "--bench") == 0)
+    {
+        std::string json_path = argc > 2 ? argv[2] : "bench_map.json";
+        int max_items = argc > 3 ? std::atoi(argv[3]) : 1 << 22;
+        int repetitions = argc > 4 ? std::atoi(argv[4]) : 5;
+
+        Benchmark benchmark(max_items, repetitions);
+        benchmark.run_pair_type<uint64_t, uint64_t>();
+        benchmark.run_pair_type<uint64_t, Wide_Value>();
+        benchmark.run_pair_type<Wide_Key, uint64_t>();
+        benchmark.write_json(json_path);
+
+        std::cout << "results written to " << json_path << " (checksum " << benchmark.found << ")" << std::endl;
+        return 0;
+    }
+
+    if (argc > 1 && std::strcmp(argv[1], "--calibrate") == 0)
+    {
+        int items = argc > 2 ? std::atoi(argv[2]) : 1 << 18;
+        Operation_Mix mix;
+        mix.insert_percent = argc > 3 ? std::atoi(argv[3]) : 50;
+        mix.find_percent = argc > 4 ? std::atoi(argv[4]) : 50;
+        mix.erase_percent = argc > 5 ? std::atoi(argv[5]) : 0;
+
+        std::mt19937_64 engine(1);
+        std::vector<std::pair<uint64_t, uint64_t>> sample_pairs(items);
+        for (std::pair<uint64_t, uint64_t> &pair : sample_pairs)
+        {
+            pair.first = engine();
+            pair.second = pair.first;
+        }
+
+        std::vector<std::pair<int, double>> scores;
+        int best = B_Tree<uint64_t, uint64_t>::calibrate(sample_pairs, mix, &scores);
+
+        for (std::pair<int, double> &score : scores)
+        {
+            std::cout << "b = " << std::setw(3) << score.first << " : " << std::fixed << std::setprecision(1) << score.second << " ns/op\n";
+        }
+        std::cout << "calibrated b = " << best << ", default b = " << B_Tree<uint64_t, uint64_t>::default_b_count() << std::endl;
+        return 0;
+    }
+
+    run_comprehensive_test(3);
+    run_comprehensive_test(B_Tree<int, int>::default_b_count());
     return 0;
 }
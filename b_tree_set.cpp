@@ -1,19 +1,137 @@
 #include <vector>
 #include <iostream>
-#include <iomanip> // for print formatting
-#include <limits>  // access to INT_MIN and INT_MAX
+#include <utility>     // for std::pair
+#include <iomanip>     // for print formatting
+#include <cstdint>     // fixed width words for bitmap leaves
+#include <type_traits> // detect integral keys
+#include <stdexcept>   // std::out_of_range, std::invalid_argument
+#include <set>         // tombstones for lazy deletion
+#include <map>         // buffered write messages, keyed for lookups
+#include <algorithm>   // binary search within blocks
+#include <chrono>      // compaction time budget
+#include <functional>  // std::hash for the hot key cache
+#include <memory_resource> // blocks and their vectors come from a std::pmr::memory_resource
+#include <random>      // calibration lookup order
+#include <array>       // static storage for compile time trees
+
+#if defined(__GLIBC__)
+#include <malloc.h>    // malloc_trim hands freed pages back to the OS
+#endif
 
 // for the testing data
-#include <random>
-#include <algorithm>
 #include <numeric>
-#include <chrono>
+#include <cmath>       // zipf sampling and standard deviation
+#include <string>
+#include <cstring>     // benchmark argument parsing
+#include <fstream>     // benchmark results
+#include <iterator>    // std::inserter for the set algebra oracle
+
+// the shape and memory footprint of a tree, see stats()
+struct Tree_Stats
+{
+    int height = 0; // levels, a lone root counts as one
+    long long blocks = 0;
+    long long keys = 0; // keys stored in blocks, tombstoned ones included
+    long long tombstones = 0;
+    long long buffered = 0;
+    std::vector<long long> blocks_per_level; // root level first
+    std::vector<long long> fill_histogram;   // the number of blocks holding i keys at index i
+    long long underfull_blocks = 0;          // non root blocks below min_keys
+    long long packed_leaves = 0;
+    double average_fill = 0;                 // keys stored over the max_keys all blocks could hold
+    long long block_bytes = 0;               // blocks and the full capacity reserved for their vectors
+    long long slack_bytes = 0;               // the part of block_bytes reserved but unused
+    long long overhead_bytes = 0;            // the tree object, buffer, cache, tombstones and finger
+    long long total_bytes = 0;
+    double bytes_per_key = 0;
+};
+
+// the share of each operation in a workload, for weighing degrees in calibrate()
+struct Operation_Mix
+{
+    int insert_percent = 50;
+    int find_percent = 50;
+    int erase_percent = 0;
+};
+
+// hot path counters, compiled in by building with -DB_TREE_STATS. every thread counts into its
+// own copy, so nothing is shared or locked, and without the flag each count compiles away
+struct Tree_Counters
+{
+    uint64_t blocks_visited = 0; // blocks searched for a key
+    uint64_t comparisons = 0;    // key comparisons made by those searches
+    uint64_t splits = 0;
+    uint64_t borrows_from_left = 0;
+    uint64_t borrows_from_right = 0;
+    uint64_t merges = 0;
+    uint64_t root_grows = 0;   // a new root raised the height
+    uint64_t root_shrinks = 0; // an emptied root was dropped, lowering the height
+
+    // fold in another thread's counters, for exporting a process wide total
+    void add(const Tree_Counters &other)
+    {
+        this->blocks_visited += other.blocks_visited;
+        this->comparisons += other.comparisons;
+        this->splits += other.splits;
+        this->borrows_from_left += other.borrows_from_left;
+        this->borrows_from_right += other.borrows_from_right;
+        this->merges += other.merges;
+        this->root_grows += other.root_grows;
+        this->root_shrinks += other.root_shrinks;
+    }
+};
+
+inline thread_local Tree_Counters thread_tree_counters;
+
+#ifdef B_TREE_STATS
+#define B_TREE_COUNT(counter) (thread_tree_counters.counter++)
+#else
+#define B_TREE_COUNT(counter) ((void)0)
+#endif
+
+// the calling thread's counters since its last reset, all zero unless built with B_TREE_STATS
+inline Tree_Counters snapshot_counters()
+{
+    return thread_tree_counters;
+}
+
+inline void reset_counters()
+{
+    thread_tree_counters = Tree_Counters();
+}
+
+// whether std::hash can hash T, the hot key cache needs it
+template <typename T, typename = void>
+struct Is_Hashable : std::false_type
+{
+};
+
+template <typename T>
+struct Is_Hashable<T, decltype(void(std::hash<T>()(std::declval<const T &>())))> : std::true_type
+{
+};
+
+template <typename K>
+class Frozen_Tree;
 
 template <typename K>
 
 class B_Tree
 {
 private:
+    // a frozen snapshot thaws into a tree through the bottom up build
+    template <typename F_K>
+    friend class Frozen_Tree;
+
+    // the benchmark driver times the quiet primitives, free of printing
+    friend struct Benchmark;
+
+    class Block;
+
+    // a block's vectors allocate from the same memory resource as the block itself
+    using Key_Vector = std::pmr::vector<K>;
+    using Child_Vector = std::pmr::vector<Block *>;
+
     class Block
     {
     private:
@@ -23,629 +141,4055 @@ private:
         int min_children;
         int max_children;
 
-        std::vector<K> keys;
-        std::vector<Block *> children;
-
-    public:
-        Block(int b_count)
-        {
-            this->b_count = b_count;
-            this->min_keys = b_count - 1;
-            this->min_children = b_count;
-            this->max_keys = 2 * b_count - 1;
-            this->max_children = 2 * b_count;
-
-            this->keys.reserve(this->max_keys + 1);
-            this->children.reserve(this->max_children + 1);
-        }
-
-        std::vector<K> &get_keys() { return this->keys; }
-        std::vector<Block *> &get_children() { return this->children; }
-
-        int get_b_count() { return this->b_count; }
-        int get_min_keys() { return this->min_keys; }
-        int get_max_keys() { return this->max_keys; }
-        int get_min_children() { return this->min_children; }
-        int get_max_children() { return this->max_children; }
-    };
-
-    Block *root;
+        Key_Vector keys;
+        Child_Vector children;
 
-    bool is_leaf(Block *block)
-    {
-        return block->get_children().empty();
-    }
+        // number of live keys stored in this block and all of its descendants, buried ones left out
+        int subtree_size;
 
-    bool is_root(Block *block)
-    {
-        return block == this->root;
-    }
+        // dense integral leaves may trade keys for a bitmap over [base, base + 64 * bitmap.size())
+        bool packed;
+        K base;
+        int packed_count;
+        std::pmr::vector<uint64_t> bitmap;
 
-    int get_index(Block *block, K key)
-    {
-        std::vector<K> &keys = block->get_keys();
-        int left = 0;
-        int right = keys.size();
+        static constexpr bool packable = std::is_integral<K>::value && !std::is_same<K, bool>::value;
 
-        while (left < right)
+        // keys as unsigned words for bitmap arithmetic. other key types never pack, but the
+        // bitmap code still has to compile for them
+        static unsigned long long to_word(K key)
         {
-            int mid = (left + right) / 2;
-            if (keys.at(mid) > key)
+            if constexpr (packable)
             {
-                right = mid;
+                return (unsigned long long)key;
             }
             else
             {
-                left = mid + 1;
+                return 0;
             }
         }
-        return left;
-    }
-
-    int get_child_index(Block *parent, Block *child)
-    {
-        std::vector<Block *> &children = parent->get_children();
 
-        for (int i = 0; i < children.size(); i++)
+        static K from_word(unsigned long long word)
         {
-            if (children.at(i) == child)
+            if constexpr (packable)
+            {
+                return (K)word;
+            }
+            else
             {
-                return i;
+                return K();
             }
         }
 
-        // should never happen
-        return INT_MIN;
-    }
-
-    void insert_helper(Block *trav, K key, std::vector<Block *> &path)
-    {
-        // recursively go to leaf
-        if (!is_leaf(trav))
+        // number of 64 bit words needed to cover [low, high]
+        static size_t words_for_range(K low, K high)
         {
-            path.push_back(trav);
-            int child_index = get_index(trav, key);
-            Block *travs_child = trav->get_children().at(child_index);
-            insert_helper(travs_child, key, path);
-            return;
+            unsigned long long span = to_word(high) - to_word(low);
+            return span / 64 + 1;
         }
 
-        // at leaf
+        void unpack()
+        {
+            Key_Vector unpacked(this->keys.get_allocator());
+            unpacked.reserve(this->max_keys + 1);
+            decode(unpacked);
 
-        std::vector<K> &keys = trav->get_keys();
-        int insert_index = get_index(trav, key);
-        keys.insert(keys.begin() + insert_index, key);
+            this->keys.swap(unpacked);
+            std::pmr::vector<uint64_t>(this->bitmap.get_allocator()).swap(this->bitmap);
+            this->packed = false;
+            this->packed_count = 0;
+        }
 
-        // overflow : needs restructure
-        if (keys.size() > trav->get_max_keys())
+    public:
+        // append the keys of a packed leaf to out in sorted order, leaving the bitmap untouched
+        template <typename Vector>
+        void decode(Vector &out)
         {
-            insert_restructure(trav, path);
+            for (size_t w = 0; w < this->bitmap.size(); w++)
+            {
+                uint64_t word = this->bitmap.at(w);
+                while (word != 0)
+                {
+                    int bit = __builtin_ctzll(word);
+                    out.push_back(from_word(to_word(this->base) + w * 64 + bit));
+                    word &= word - 1;
+                }
+            }
         }
-    }
 
-    void insert_restructure(Block *block, std::vector<Block *> &path)
-    {
-        int b_count = block->get_b_count();
+        Block(int b_count, std::pmr::memory_resource *resource) : keys(resource), children(resource), bitmap(resource)
+        {
+            this->b_count = b_count;
+            this->min_keys = b_count - 1;
+            this->min_children = b_count;
+            this->max_keys = 2 * b_count - 1;
+            this->max_children = 2 * b_count;
 
-        Block *parent = nullptr;
+            this->keys.reserve(this->max_keys + 1);
+            this->children.reserve(this->max_children + 1);
 
-        // root block has no parent
-        if (path.empty())
-        {
-            Block *new_root = new Block(b_count);
-            this->root = new_root;
-            parent = new_root;
-            parent->get_children().push_back(block);
+            this->subtree_size = 0;
+
+            this->packed = false;
+            this->base = K();
+            this->packed_count = 0;
         }
-        else
+
+        // any direct access to the keys converts a packed leaf back into a sorted array
+        Key_Vector &get_keys()
         {
-            parent = path.back();
-            path.pop_back();
+            if (this->packed)
+            {
+                unpack();
+            }
+            return this->keys;
         }
+        Child_Vector &get_children() { return this->children; }
 
-        // treat the block needing restructure as the "left_half"
-        std::vector<K> &keys_to_restructure = block->get_keys();
-        std::vector<Block *> &children_to_restructure = block->get_children();
+        int get_b_count() { return this->b_count; }
+        int get_min_keys() { return this->min_keys; }
+        int get_max_keys() { return this->max_keys; }
+        int get_min_children() { return this->min_children; }
+        int get_max_children() { return this->max_children; }
 
-        K key_to_move_up = keys_to_restructure.at(b_count);
+        int get_subtree_size() { return this->subtree_size; }
+        void set_subtree_size(int subtree_size) { this->subtree_size = subtree_size; }
 
-        Block *right_half = new Block(b_count);
-        std::vector<K> &right_half_keys = right_half->get_keys();
-        std::vector<Block *> &right_half_children = right_half->get_children();
+        bool is_packed() { return this->packed; }
 
-        // first b stay in left half [index 0 to b_count - 1]
-        // the next key goes into the parent [index b_count]
-        // the last b-1 go into right half [index b_count + 1 to size - 1]
+        // no key of a packed leaf is below its base
+        K get_base() { return this->base; }
 
-        // move keys to right half
-        for (int i = b_count + 1; i < keys_to_restructure.size(); i++)
+        // where this block's keys live, without unpacking a bitmap leaf
+        const void *key_data() { return this->packed ? (const void *)this->bitmap.data() : (const void *)this->keys.data(); }
+        int get_key_count() { return this->packed ? this->packed_count : this->keys.size(); }
+
+        // bytes this block holds, counting the full capacity reserved for its vectors
+        size_t footprint()
         {
-            right_half_keys.push_back(keys_to_restructure.at(i));
+            return sizeof(Block) + this->keys.capacity() * sizeof(K) + this->children.capacity() * sizeof(Block *) +
+                   this->bitmap.capacity() * sizeof(uint64_t);
         }
 
-        // remove middle key and everything to the right from left block
-        keys_to_restructure.erase(keys_to_restructure.begin() + b_count, keys_to_restructure.end());
+        // the part of footprint() reserved but not yet used
+        size_t slack()
+        {
+            return (this->keys.capacity() - this->keys.size()) * sizeof(K) +
+                   (this->children.capacity() - this->children.size()) * sizeof(Block *) +
+                   (this->bitmap.capacity() - this->bitmap.size()) * sizeof(uint64_t);
+        }
 
-        // move children if not a leaf
-        if (!is_leaf(block))
+        // a bitmap is used only when it is smaller than the sorted array it replaces
+        bool should_pack()
         {
-            for (int i = b_count + 1; i < children_to_restructure.size(); i++)
+            if constexpr (packable)
             {
-                right_half_children.push_back(children_to_restructure.at(i));
-            }
+                if (this->keys.empty())
+                {
+                    return false;
+                }
 
-            children_to_restructure.erase(children_to_restructure.begin() + b_count + 1, children_to_restructure.end());
+                size_t words = words_for_range(this->keys.front(), this->keys.back());
+                return words * sizeof(uint64_t) < this->keys.size() * sizeof(K);
+            }
+            return false;
         }
 
-        std::vector<K> &parent_keys = parent->get_keys();
-        std::vector<Block *> &parent_children = parent->get_children();
-
-        int parent_index = get_index(parent, key_to_move_up);
+        void pack()
+        {
+            if constexpr (packable)
+            {
+                this->base = this->keys.front();
+                this->bitmap.assign(words_for_range(this->keys.front(), this->keys.back()), 0);
 
-        parent_keys.insert(parent_keys.begin() + parent_index, key_to_move_up);
-        parent_children.insert(parent_children.begin() + parent_index + 1, right_half);
+                for (K key : this->keys)
+                {
+                    unsigned long long offset = to_word(key) - to_word(this->base);
+                    this->bitmap.at(offset / 64) |= (uint64_t)1 << (offset % 64);
+                }
 
-        if (parent_keys.size() > parent->get_max_keys())
-        {
-            insert_restructure(parent, path);
+                this->packed_count = this->keys.size();
+                this->packed = true;
+                Key_Vector(this->keys.get_allocator()).swap(this->keys);
+            }
         }
-    }
-
-    void search_helper(Block *trav, K target_key, std::vector<Block *> &path)
-    {
-        path.push_back(trav);
-        std::vector<K> &keys = trav->get_keys();
-        int index = get_index(trav, target_key);
 
-        // base case : target key exists in current blocks keys
-        if (index > 0 && keys.at(index - 1) == target_key)
+        // returns -1 when key falls outside the bitmap, otherwise the word offset of its bit
+        long long packed_offset(K key)
         {
-            return;
+            if (key < this->base)
+            {
+                return -1;
+            }
+
+            unsigned long long offset = to_word(key) - to_word(this->base);
+            if (offset >= this->bitmap.size() * 64)
+            {
+                return -1;
+            }
+            return offset;
         }
 
-        // else, recursively find the block where the key may exist
-        std::vector<Block *> &travs_children = trav->get_children();
-        if (!travs_children.empty() && travs_children.at(index) != nullptr)
+        bool packed_contains(K key)
         {
-            return search_helper(travs_children.at(index), target_key, path);
+            B_TREE_COUNT(blocks_visited);
+            long long offset = packed_offset(key);
+            return offset >= 0 && (this->bitmap.at(offset / 64) >> (offset % 64)) & 1;
         }
 
-        // key is not found
-        return;
-    }
+        // set or clear a bit in place, only valid when key is inside the bitmap
+        void packed_set(K key, bool present)
+        {
+            long long offset = packed_offset(key);
+            uint64_t mask = (uint64_t)1 << (offset % 64);
 
-    void remove_helper(Block *target_block, K key, std::vector<Block *> &path)
-    {
-        std::vector<K> &target_keys = target_block->get_keys();
-        int index = get_index(target_block, key);
+            if (present)
+            {
+                this->bitmap.at(offset / 64) |= mask;
+                this->packed_count++;
+            }
+            else
+            {
+                this->bitmap.at(offset / 64) &= ~mask;
+                this->packed_count--;
+            }
+        }
 
-        if (is_leaf(target_block))
+        // number of keys in a packed leaf that are strictly less than key
+        int packed_rank(K key)
         {
-            if (index > 0 && target_keys.at(index - 1) == key)
+            long long offset = packed_offset(key);
+            if (offset < 0)
             {
-                target_keys.erase(target_keys.begin() + index - 1);
+                return key < this->base ? 0 : this->packed_count;
             }
 
-            // underflow can only occur when removing a key from a leaf
-            if (target_keys.size() < target_block->get_min_keys())
+            int rank = 0;
+            for (long long w = 0; w < offset / 64; w++)
             {
-                remove_restructure(target_block, path);
+                rank += __builtin_popcountll(this->bitmap.at(w));
             }
+
+            uint64_t below = ((uint64_t)1 << (offset % 64)) - 1;
+            return rank + __builtin_popcountll(this->bitmap.at(offset / 64) & below);
         }
-        else
-        {
-            std::vector<Block *> &children = target_block->get_children();
-            Block *replacement_block = nullptr;
-            K replacement_key;
-            path.push_back(target_block);
 
-            if (index > 0 && children.at(index - 1) != nullptr)
+        // the i-th smallest key of a packed leaf
+        K packed_select(int i)
+        {
+            for (size_t w = 0; w < this->bitmap.size(); w++)
             {
-                Block *left_child = children.at(index - 1);
-                // find max key of left subtree
-                replacement_block = get_replacement(left_child, false, true, path);
+                uint64_t word = this->bitmap.at(w);
+                int count = __builtin_popcountll(word);
 
-                if (replacement_block != nullptr)
+                if (i >= count)
                 {
-                    replacement_key = replacement_block->get_keys().back();
+                    i -= count;
+                    continue;
                 }
-            }
-
-            else if (index < children.size() && children.at(index) != nullptr)
-            {
-                Block *right_child = children.at(index);
-                // find min key of right subtree
-                replacement_block = get_replacement(right_child, true, false, path);
 
-                if (replacement_block != nullptr)
+                while (i-- > 0)
                 {
-                    replacement_key = replacement_block->get_keys().front();
+                    word &= word - 1;
                 }
+                return from_word(to_word(this->base) + w * 64 + __builtin_ctzll(word));
             }
 
-            target_keys.at(index - 1) = replacement_key;
-            path.pop_back();
-            remove_helper(replacement_block, replacement_key, path);
+            // should never happen
+            return this->base;
         }
-    }
-
-    void remove_restructure(Block *block, std::vector<Block *> &path)
-    {
-        // an edge cases arise from merging the only two children of a root
-        // edge case 1: root has a child and is now empty.
 
-        if (is_root(block))
+        // still worth keeping as a bitmap after a removal shrank the key count
+        bool packed_is_dense()
         {
-            if (!is_leaf(block) && block->get_keys().empty())
-            {
-                Block *old_root = block;
-                this->root = block->get_children().front();
-                old_root->get_children().clear();
-                delete old_root;
-            }
-            return;
+            return this->bitmap.size() * sizeof(uint64_t) < this->packed_count * sizeof(K);
         }
+    };
 
-        // this method is active when block underflowed
-        Block *parent = path.back();
-        path.pop_back();
-        std::vector<K> &parent_keys = parent->get_keys();
+    Block *root;
 
-        Block *left_sibling = get_sibling(parent, block, true, false);
-        Block *right_sibling = get_sibling(parent, block, false, true);
+    // every block, and every vector a block holds, is allocated from here
+    std::pmr::memory_resource *resource;
 
-        std::vector<K> &block_keys = block->get_keys();
+    // lazy deletion : removed keys are only recorded here and purged from the blocks later
+    bool lazy_delete;
+    std::set<K> tombstones;
 
-        // two additional edge cases, however you should always try stealing from a sibling
-        // edge case 1: stealing a key from the sibling causes underflow, requiring a merge of the 2 siblings
-        // edge case 2: merging requires bridging the gap by pulling down a key from the parent block. if this
-        //              causes the parent block to underflow, must recursively restructure the parent block.
+    // each insert purges this many tombstones while lazy deletion is on
+    static constexpr int purge_per_write = 2;
 
-        // edge case 2 will be handled within merge
+    // lookups interleaved by multi_contains, enough to keep many cache misses in flight
+    static constexpr int group_size = 16;
 
-        // always steal from a sibling
-        if (right_sibling != nullptr) // slightly more efficient on average, prioritze
-        {
-            int index_of_parent_key = get_child_index(parent, block);
+    // hot key cache : open addressed slots remembering the block a recently found key lives in.
+    // a hit is checked against the block itself, so keys moved by splits, borrows and merges or
+    // removed keys simply miss. a slot is only trusted while no block has been freed since it was
+    // written, cache_epoch counts the frees
+    struct Cache_Slot
+    {
+        K key;
+        Block *block;
+        uint64_t epoch;
+        bool used;
+    };
 
-            std::vector<K> &right_sibling_keys = right_sibling->get_keys();
+    std::vector<Cache_Slot> cache;
+    uint64_t cache_epoch;
+    long long cache_hit_count;
+    long long cache_miss_count;
 
-            // edge case 1 (size - 1 because this checks if after stealing, right will be under min keys)
-            if (right_sibling_keys.size() - 1 < right_sibling->get_min_keys())
-            {
-                merge(parent, right_sibling, block, true, false, path);
-                return;
-            }
+    // slots tried from a key's home slot before giving up
+    static constexpr int cache_probes = 4;
 
-            // push the parent key to the back of block_keys, move up and erase the first key of right_sibling
-            block_keys.push_back(parent_keys.at(index_of_parent_key));
-            parent_keys.at(index_of_parent_key) = right_sibling_keys.front();
-            right_sibling_keys.erase(right_sibling_keys.begin());
+    // finger : the leaf the last insert landed in, its ancestors and the separators around it.
+    // an insert strictly between those separators goes straight to that leaf. it is only trusted
+    // while shape_epoch, which counts every split, borrow, merge, removal and handoff, is unchanged
+    Block *finger;
+    std::vector<Block *> finger_path;
+    bool finger_has_low;
+    bool finger_has_high;
+    K finger_low;
+    K finger_high;
+    uint64_t finger_epoch;
+    uint64_t shape_epoch;
 
-            if (!is_leaf(right_sibling))
-            {
-                block->get_children().push_back(right_sibling->get_children().front());
-                right_sibling->get_children().erase(right_sibling->get_children().begin());
-            }
-        }
-        else if (left_sibling != nullptr)
-        {
-            int index_of_parent_key = get_child_index(parent, block) - 1;
-            std::vector<K> &left_sibling_keys = left_sibling->get_keys();
+    // share of the keys moved right when an append at the end of the right spine splits a block
+    static constexpr int append_right_percent = 10;
 
-            // edge case 1 (size - 1 because this checks if after stealing, left will be under min keys)
-            if (left_sibling_keys.size() - 1 < left_sibling->get_min_keys())
-            {
-                merge(parent, left_sibling, block, false, true, path);
-                return;
-            }
+    // the default degree is fitted to these
+    static constexpr int cache_line_bytes = 64;
+    static constexpr int memory_page_bytes = 4096;
+    static constexpr int block_target_lines = 16;
 
-            // push the parent key to the front of block_keys, move up and erase the last element of left_sibling
-            block_keys.insert(block_keys.begin(), parent_keys.at(index_of_parent_key));
-            parent_keys.at(index_of_parent_key) = left_sibling_keys.back();
-            left_sibling_keys.pop_back();
+    // degrees tried by calibrate(), and how many times each is timed
+    static constexpr int calibration_degrees[] = {2, 4, 8, 16, 32, 64, 128};
+    static constexpr int calibration_rounds = 3;
 
-            if (!is_leaf(left_sibling))
-            {
-                block->get_children().insert(block->get_children().begin(), left_sibling->get_children().back());
-                left_sibling->get_children().pop_back();
-            }
-        }
-    }
+    // buffered writes : inserts and removes wait here as one message per key, true for an
+    // insert and false for a remove. a newer message for a key replaces the older one
+    using Buffer = std::map<K, bool>;
+    bool buffered;
+    int buffer_capacity;
+    Buffer buffer;
 
-    Block *get_replacement(Block *trav, bool search_min, bool search_max, std::vector<Block *> &path)
-    {
-        path.push_back(trav);
+    // what the buffered messages add to size(), worked out again on the first size() after the
+    // buffer changes. the blocks only change under a buffered key when its message is applied
+    int buffer_delta;
+    bool buffer_delta_known;
 
-        if (is_leaf(trav))
-        {
-            return trav;
-        }
+    // in-order position in a tree, kept as the (block, index) path from the root. an internal
+    // frame's index names the child being visited or, on top of the stack, the key itself.
+    // leaves are copied into leaf_keys so packed leaves can be walked without unpacking them.
+    // keys in buried, the tree's tombstones when given, are stepped over
+    class Cursor
+    {
+    private:
+        Block *root;
+        std::set<K> *buried;
+        std::vector<Block *> blocks;
+        std::vector<int> indices;
+        std::vector<K> leaf_keys;
 
-        // else, recursively find the next block
-        std::vector<Block *> &travs_children = trav->get_children();
+        bool at_leaf() { return blocks.back()->get_children().empty(); }
 
-        if (search_min)
+        void load_leaf()
         {
-            return get_replacement(travs_children.front(), true, false, path);
+            Block *leaf = blocks.back();
+            leaf_keys.clear();
+
+            if (leaf->is_packed())
+            {
+                leaf->decode(leaf_keys);
+            }
+            else
+            {
+                leaf_keys.assign(leaf->get_keys().begin(), leaf->get_keys().end());
+            }
         }
 
-        if (search_max)
+        void descend_left(Block *block)
         {
-            return get_replacement(travs_children.back(), false, true, path);
+            while (true)
+            {
+                blocks.push_back(block);
+                indices.push_back(0);
+
+                if (block->get_children().empty())
+                {
+                    load_leaf();
+                    return;
+                }
+                block = block->get_children().front();
+            }
         }
 
-        // replacement key is not found (should always be found)
-        return nullptr;
-    }
+        // drop exhausted frames, the first ancestor left on top is positioned on its next key
+        void settle()
+        {
+            while (!blocks.empty())
+            {
+                int count = at_leaf() ? leaf_keys.size() : blocks.back()->get_keys().size();
+                if (indices.back() < count)
+                {
+                    return;
+                }
 
-    Block *get_sibling(Block *parent, Block *target_child, bool left, bool right)
-    {
-        std::vector<Block *> &children = parent->get_children();
-        int index = -1;
+                blocks.pop_back();
+                indices.pop_back();
+            }
+        }
 
-        for (int i = 0; i < children.size(); i++)
+        void step()
         {
-            if (children.at(i) == target_child)
+            if (at_leaf())
             {
-                index = i;
-                break;
+                indices.back()++;
+                settle();
+                return;
             }
+
+            // the key after an internal key is the leftmost key of the child to its right
+            int index = ++indices.back();
+            descend_left(blocks.back()->get_children().at(index));
+            settle();
         }
 
-        if (left && index > 0)
+        void skip_buried()
         {
-            // sibling with keys < target_child's keys
-            return children.at(index - 1);
+            while (valid() && this->buried != nullptr && !this->buried->empty() && this->buried->count(key()) > 0)
+            {
+                step();
+            }
         }
-        else if (right && index + 1 < children.size())
+
+    public:
+        Cursor(Block *root, std::set<K> *buried = nullptr)
         {
-            // sibling with keys > target_child's keys
-            return children.at(index + 1);
+            this->root = root;
+            this->buried = buried;
+            descend_left(root);
+            settle();
+            skip_buried();
         }
 
-        // no valid siblings
-        return nullptr;
-    }
+        bool valid() { return !blocks.empty(); }
 
-    void merge(Block *parent, Block *from, Block *to, bool right_to_left, bool left_to_right, std::vector<Block *> &path)
-    {
-        int to_index = get_child_index(parent, to);
-        int parent_key_index;
+        K key() { return at_leaf() ? leaf_keys.at(indices.back()) : blocks.back()->get_keys().at(indices.back()); }
 
-        if (right_to_left)
+        void next()
         {
-            parent_key_index = to_index;
+            step();
+            skip_buried();
         }
-        else if (left_to_right)
+
+        // position on the first key >= key with a fresh descent from the root, skipping every
+        // subtree in between
+        void seek(K key)
+        {
+            blocks.clear();
+            indices.clear();
+            Block *trav = this->root;
+
+            while (true)
+            {
+                blocks.push_back(trav);
+
+                if (trav->get_children().empty())
+                {
+                    load_leaf();
+                    indices.push_back(std::lower_bound(leaf_keys.begin(), leaf_keys.end(), key) - leaf_keys.begin());
+                    break;
+                }
+
+                Key_Vector &keys = trav->get_keys();
+                int index = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+                indices.push_back(index);
+
+                if (index < keys.size() && keys.at(index) == key)
+                {
+                    skip_buried();
+                    return;
+                }
+                trav = trav->get_children().at(index);
+            }
+            settle();
+            skip_buried();
+        }
+
+        // move forward to the first key >= key. stays inside the current leaf when the key is
+        // there, otherwise gallops past whole subtrees with a seek
+        void advance_to(K key)
+        {
+            if (valid() && at_leaf() && !(leaf_keys.back() < key))
+            {
+                indices.back() = std::lower_bound(leaf_keys.begin() + indices.back(), leaf_keys.end(), key) - leaf_keys.begin();
+                skip_buried();
+                return;
+            }
+            seek(key);
+        }
+    };
+
+    bool is_leaf(Block *block)
+    {
+        return block->get_children().empty();
+    }
+
+    bool is_root(Block *block)
+    {
+        return block == this->root;
+    }
+
+    // packs a leaf into a bitmap when that is the smaller representation
+    void try_pack(Block *block)
+    {
+        if (!block->is_packed() && is_leaf(block) && block->should_pack())
+        {
+            block->pack();
+        }
+    }
+
+    bool is_buried(K key)
+    {
+        return !this->tombstones.empty() && this->tombstones.count(key) > 0;
+    }
+
+    // how many keys of leaf below key are buried. every key between a leaf's first and last key
+    // lives in that leaf, so the walk over the tombstones stops at the first one it does not hold
+    int buried_below(Block *leaf, K key)
+    {
+        if (this->tombstones.empty() || leaf->get_key_count() == 0)
+        {
+            return 0;
+        }
+
+        K low = leaf->is_packed() ? leaf->get_base() : leaf->get_keys().front();
+        int buried = 0;
+
+        for (auto it = this->tombstones.lower_bound(low); it != this->tombstones.end() && *it < key && contains_in(leaf, *it); ++it)
+        {
+            buried++;
+        }
+        return buried;
+    }
+
+    // how many of block's own keys are buried
+    int buried_in(Block *block)
+    {
+        if (this->tombstones.empty() || block->get_key_count() == 0)
+        {
+            return 0;
+        }
+
+        if (is_leaf(block))
+        {
+            K high = block->is_packed() ? block->packed_select(block->get_key_count() - 1) : block->get_keys().back();
+            return buried_below(block, high) + (is_buried(high) ? 1 : 0);
+        }
+
+        int buried = 0;
+        for (K key : block->get_keys())
+        {
+            buried += is_buried(key) ? 1 : 0;
+        }
+        return buried;
+    }
+
+    // recompute a block's subtree size from its own live keys and its children's sizes
+    void refresh_block(Block *block)
+    {
+        int size = block->get_key_count() - buried_in(block);
+        for (Block *child : block->get_children())
+        {
+            size += child->get_subtree_size();
+        }
+        block->set_subtree_size(size);
+    }
+
+    // a live key was added to or removed from block, every ancestor on path changes by the same amount
+    void refresh_path(Block *block, std::vector<Block *> &path, int delta)
+    {
+        block->set_subtree_size(block->get_subtree_size() + delta);
+        for (Block *ancestor : path)
+        {
+            ancestor->set_subtree_size(ancestor->get_subtree_size() + delta);
+        }
+    }
+
+    // membership within a single block without unpacking bitmap leaves
+    // ask the cache for address ahead of use, a hint only
+    static void prefetch(const void *address)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(address);
+#endif
+    }
+
+    bool contains_in(Block *block, K key)
+    {
+        if (block->is_packed())
+        {
+            return block->packed_contains(key);
+        }
+
+        int index = get_index(block, key);
+        return index > 0 && block->get_keys().at(index - 1) == key;
+    }
+
+    int get_index(Block *block, K key)
+    {
+        Key_Vector &keys = block->get_keys();
+        int left = 0;
+        int right = keys.size();
+
+        B_TREE_COUNT(blocks_visited);
+
+        while (left < right)
+        {
+            int mid = (left + right) / 2;
+            B_TREE_COUNT(comparisons);
+            if (keys.at(mid) > key)
+            {
+                right = mid;
+            }
+            else
+            {
+                left = mid + 1;
+            }
+        }
+        return left;
+    }
+
+    void insert_helper(Block *trav, K key, std::vector<Block *> &path)
+    {
+        // recursively go to leaf
+        if (!is_leaf(trav))
+        {
+            path.push_back(trav);
+            int child_index = get_index(trav, key);
+            Block *travs_child = trav->get_children().at(child_index);
+            insert_helper(travs_child, key, path);
+            return;
+        }
+
+        // at leaf
+
+        // bitmap leaf : set the bit in place when the key lands inside the covered range
+        // a separator put back by join_roots keeps the tombstone it carried
+        int delta = is_buried(key) ? 0 : 1;
+
+        if (trav->is_packed() && trav->packed_offset(key) >= 0 && trav->get_key_count() < trav->get_max_keys())
+        {
+            trav->packed_set(key, true);
+            refresh_path(trav, path, delta);
+            set_finger(trav, path, key);
+            return;
+        }
+
+        Key_Vector &keys = trav->get_keys();
+        int insert_index = get_index(trav, key);
+        keys.insert(keys.begin() + insert_index, key);
+        refresh_path(trav, path, delta);
+
+        // overflow : needs restructure
+        if (keys.size() > trav->get_max_keys())
+        {
+            bool append = insert_index == keys.size() - 1 && on_right_spine(trav, path);
+            insert_restructure(trav, path, append);
+        }
+        else
+        {
+            try_pack(trav);
+            set_finger(trav, path, key);
+        }
+    }
+
+    // whether block is the last block of its level, path holding its ancestors
+    bool on_right_spine(Block *block, std::vector<Block *> &path)
+    {
+        for (int i = 0; i < path.size(); i++)
+        {
+            Block *child = i + 1 < path.size() ? path.at(i + 1) : block;
+
+            if (path.at(i)->get_children().back() != child)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // remember leaf and its ancestors on path as the finger around key
+    void set_finger(Block *leaf, std::vector<Block *> &path, K key)
+    {
+        if (&path != &this->finger_path)
+        {
+            this->finger_path = path;
+        }
+
+        this->finger = leaf;
+        this->finger_has_low = false;
+        this->finger_has_high = false;
+
+        // deeper ancestors hold the tighter separators
+        for (Block *ancestor : path)
+        {
+            Key_Vector &keys = ancestor->get_keys();
+            int index = get_index(ancestor, key);
+
+            if (index > 0)
+            {
+                this->finger_low = keys.at(index - 1);
+                this->finger_has_low = true;
+            }
+
+            if (index < keys.size())
+            {
+                this->finger_high = keys.at(index);
+                this->finger_has_high = true;
+            }
+        }
+        this->finger_epoch = this->shape_epoch;
+    }
+
+    // the finger leaf when key falls strictly between its separators, or nullptr
+    Block *finger_leaf(K key)
+    {
+        if (this->finger == nullptr || this->finger_epoch != this->shape_epoch)
+        {
+            return nullptr;
+        }
+
+        if ((this->finger_has_low && !(this->finger_low < key)) || (this->finger_has_high && !(key < this->finger_high)))
+        {
+            return nullptr;
+        }
+        return this->finger;
+    }
+
+    // split an overflowing block around its middle key, or near its end when append is set: an
+    // append at the end of the right spine moves only append_right_percent of the keys right, so
+    // the blocks it leaves behind stay nearly full. the new right block may hold fewer than
+    // min_keys until later appends fill it
+    void insert_restructure(Block *block, std::vector<Block *> &path, bool append = false)
+    {
+        int b_count = block->get_b_count();
+        this->shape_epoch++;
+        B_TREE_COUNT(splits);
+
+        Block *parent = nullptr;
+
+        // root block has no parent
+        if (path.empty())
+        {
+            Block *new_root = new_block(b_count);
+            this->root = new_root;
+            B_TREE_COUNT(root_grows);
+            parent = new_root;
+            parent->get_children().push_back(block);
+        }
+        else
+        {
+            parent = path.back();
+            path.pop_back();
+        }
+
+        // treat the block needing restructure as the "left_half"
+        Key_Vector &keys_to_restructure = block->get_keys();
+        Child_Vector &children_to_restructure = block->get_children();
+
+        int split_index = b_count;
+
+        if (append)
+        {
+            int right_count = std::max(1, (int)keys_to_restructure.size() * append_right_percent / 100);
+            split_index = keys_to_restructure.size() - 1 - right_count;
+        }
+
+        K key_to_move_up = keys_to_restructure.at(split_index);
+
+        Block *right_half = new_block(b_count);
+        Key_Vector &right_half_keys = right_half->get_keys();
+        Child_Vector &right_half_children = right_half->get_children();
+
+        // first split_index stay in left half [index 0 to split_index - 1]
+        // the next key goes into the parent [index split_index]
+        // the rest go into right half [index split_index + 1 to size - 1]
+
+        // move keys to right half
+        for (int i = split_index + 1; i < keys_to_restructure.size(); i++)
+        {
+            right_half_keys.push_back(keys_to_restructure.at(i));
+        }
+
+        // remove middle key and everything to the right from left block
+        keys_to_restructure.erase(keys_to_restructure.begin() + split_index, keys_to_restructure.end());
+
+        // move children if not a leaf
+        if (!is_leaf(block))
+        {
+            for (int i = split_index + 1; i < children_to_restructure.size(); i++)
+            {
+                right_half_children.push_back(children_to_restructure.at(i));
+            }
+
+            children_to_restructure.erase(children_to_restructure.begin() + split_index + 1, children_to_restructure.end());
+        }
+        else
+        {
+            try_pack(block);
+            try_pack(right_half);
+        }
+
+        refresh_block(block);
+        refresh_block(right_half);
+
+        Key_Vector &parent_keys = parent->get_keys();
+        Child_Vector &parent_children = parent->get_children();
+
+        int parent_index = get_index(parent, key_to_move_up);
+
+        parent_keys.insert(parent_keys.begin() + parent_index, key_to_move_up);
+        parent_children.insert(parent_children.begin() + parent_index + 1, right_half);
+        refresh_block(parent);
+
+        if (parent_keys.size() > parent->get_max_keys())
+        {
+            // the parent keeps appending when the new key landed at its end
+            insert_restructure(parent, path, append && parent_index == parent_keys.size() - 1);
+        }
+    }
+
+    void search_helper(Block *trav, K target_key, std::vector<Block *> &path)
+    {
+        path.push_back(trav);
+
+        // bitmap leaves are always leaves, nothing left to descend into
+        if (trav->is_packed())
+        {
+            return;
+        }
+
+        Key_Vector &keys = trav->get_keys();
+        int index = get_index(trav, target_key);
+
+        // base case : target key exists in current blocks keys
+        if (index > 0 && keys.at(index - 1) == target_key)
+        {
+            return;
+        }
+
+        // else, recursively find the block where the key may exist
+        Child_Vector &travs_children = trav->get_children();
+        if (!travs_children.empty() && travs_children.at(index) != nullptr)
+        {
+            return search_helper(travs_children.at(index), target_key, path);
+        }
+
+        // key is not found
+        return;
+    }
+
+    // take the separator at slot down into block and move the right sibling's first key up
+    void borrow_from_right(Block *parent, int slot)
+    {
+        this->shape_epoch++;
+        B_TREE_COUNT(borrows_from_right);
+        Block *block = parent->get_children().at(slot);
+        Block *right_sibling = parent->get_children().at(slot + 1);
+
+        Key_Vector &parent_keys = parent->get_keys();
+        Key_Vector &block_keys = block->get_keys();
+        Key_Vector &right_sibling_keys = right_sibling->get_keys();
+
+        block_keys.push_back(parent_keys.at(slot));
+        parent_keys.at(slot) = right_sibling_keys.front();
+        right_sibling_keys.erase(right_sibling_keys.begin());
+
+        if (!is_leaf(right_sibling))
+        {
+            block->get_children().push_back(right_sibling->get_children().front());
+            right_sibling->get_children().erase(right_sibling->get_children().begin());
+        }
+        else
+        {
+            try_pack(block);
+            try_pack(right_sibling);
+        }
+
+        refresh_block(block);
+        refresh_block(right_sibling);
+    }
+
+    // take the separator left of slot down into block and move the left sibling's last key up
+    void borrow_from_left(Block *parent, int slot)
+    {
+        this->shape_epoch++;
+        B_TREE_COUNT(borrows_from_left);
+        Block *block = parent->get_children().at(slot);
+        Block *left_sibling = parent->get_children().at(slot - 1);
+
+        Key_Vector &parent_keys = parent->get_keys();
+        Key_Vector &block_keys = block->get_keys();
+        Key_Vector &left_sibling_keys = left_sibling->get_keys();
+
+        block_keys.insert(block_keys.begin(), parent_keys.at(slot - 1));
+        parent_keys.at(slot - 1) = left_sibling_keys.back();
+        left_sibling_keys.pop_back();
+
+        if (!is_leaf(left_sibling))
+        {
+            block->get_children().insert(block->get_children().begin(), left_sibling->get_children().back());
+            left_sibling->get_children().pop_back();
+        }
+        else
+        {
+            try_pack(block);
+            try_pack(left_sibling);
+        }
+
+        refresh_block(block);
+        refresh_block(left_sibling);
+    }
+
+    // fold the child right of slot and the separator between them into the child at slot
+    void merge(Block *parent, int slot)
+    {
+        B_TREE_COUNT(merges);
+        Key_Vector &parent_keys = parent->get_keys();
+        Child_Vector &parent_children = parent->get_children();
+
+        Block *to = parent_children.at(slot);
+        Block *from = parent_children.at(slot + 1);
+
+        Key_Vector &to_keys = to->get_keys();
+        Key_Vector &from_keys = from->get_keys();
+
+        bool leaf = is_leaf(to);
+
+        // transfer all keys, erase parent key, erase child pointer and delete block
+        // if not a leaf node, must also handle the transfer of children
+        to_keys.push_back(parent_keys.at(slot));
+        to_keys.insert(to_keys.end(), from_keys.begin(), from_keys.end());
+
+        if (!leaf)
+        {
+            Child_Vector &to_children = to->get_children();
+            Child_Vector &from_children = from->get_children();
+
+            to_children.insert(to_children.end(), from_children.begin(), from_children.end());
+            from_children.clear();
+        }
+
+        parent_keys.erase(parent_keys.begin() + slot);
+        parent_children.erase(parent_children.begin() + slot + 1);
+        release_block(from);
+
+        if (leaf)
+        {
+            try_pack(to);
+        }
+        refresh_block(to);
+    }
+
+    // block lost a key. path holds its ancestors and slots[i] is the position of path[i + 1]
+    // (or block itself, for the last entry) among path[i]'s children, so siblings are found
+    // without scanning the parent. borrowing from a sibling ends the repair, merging moves it
+    // one level up
+    void remove_restructure(Block *block, std::vector<Block *> &path, std::vector<int> &slots)
+    {
+        while (!is_root(block) && block->get_key_count() < block->get_min_keys())
+        {
+            Block *parent = path.back();
+            int slot = slots.back();
+            Child_Vector &siblings = parent->get_children();
+
+            // always try stealing from a sibling first, merge when that would underflow it
+            // the right sibling is slightly more efficient on average, prioritze
+            if (slot + 1 < siblings.size())
+            {
+                Block *right_sibling = siblings.at(slot + 1);
+
+                if (right_sibling->get_key_count() - 1 < right_sibling->get_min_keys())
+                {
+                    merge(parent, slot);
+                }
+                else
+                {
+                    borrow_from_right(parent, slot);
+                    continue;
+                }
+            }
+            else
+            {
+                Block *left_sibling = siblings.at(slot - 1);
+
+                if (left_sibling->get_key_count() - 1 < left_sibling->get_min_keys())
+                {
+                    merge(parent, slot - 1);
+                }
+                else
+                {
+                    borrow_from_left(parent, slot);
+                    continue;
+                }
+            }
+
+            // the merge pulled a key out of parent, which may underflow in turn
+            block = parent;
+            path.pop_back();
+            slots.pop_back();
+        }
+
+        // merging the only two children of the root leaves it empty, its child becomes the root
+        if (is_root(block) && !is_leaf(block) && block->get_keys().empty())
+        {
+            Block *old_root = block;
+            this->root = block->get_children().front();
+            B_TREE_COUNT(root_shrinks);
+            old_root->get_children().clear();
+            release_block(old_root);
+        }
+    }
+
+    // physically remove up to count tombstoned keys, smallest first. remove_key drops the tombstone
+    void purge_tombstones(int count)
+    {
+        while (count-- > 0 && !this->tombstones.empty())
+        {
+            remove_key(*this->tombstones.begin());
+        }
+    }
+
+    // record key as deleted without touching the blocks, returns false when key was not present
+    bool bury_key(K key)
+    {
+        std::vector<Block *> path;
+        search_helper(this->root, key, path);
+
+        Block *block = path.back();
+
+        if (is_buried(key) || !contains_in(block, key))
+        {
+            return false;
+        }
+
+        // the key stays in its block but no longer counts towards the subtree sizes
+        this->tombstones.insert(key);
+        path.pop_back();
+        refresh_path(block, path, -1);
+        return true;
+    }
+
+    // queue a message, flushing the whole batch once the buffer holds capacity keys
+    void buffer_message(K key, bool insert)
+    {
+        this->buffer[key] = insert;
+        this->buffer_delta_known = false;
+
+        if (this->buffer.size() >= this->buffer_capacity)
+        {
+            flush_buffer();
+        }
+    }
+
+    // apply one message through the regular single key paths
+    void apply_message(K key, bool insert)
+    {
+        if (insert)
+        {
+            insert_key(key);
+            purge_tombstones(purge_per_write);
+        }
+        else if (this->lazy_delete)
+        {
+            bury_key(key);
+        }
+        else
+        {
+            remove_key(key);
+        }
+    }
+
+    // apply every buffered message in key order. one descent serves every message that lands
+    // strictly between the separators around a leaf, for as long as the leaf can take them
+    // without a split or a borrow. the message that would need one goes the regular way
+    void flush_buffer()
+    {
+        // the buffer is already in key order with one message per key
+        Buffer batch;
+        batch.swap(this->buffer);
+        this->buffer_delta_known = false;
+
+        auto message = batch.begin();
+
+        while (message != batch.end())
+        {
+            std::vector<Block *> path;
+            Block *trav = this->root;
+            bool has_high = false;
+            bool in_internal = false;
+            K high;
+
+            while (!is_leaf(trav))
+            {
+                Key_Vector &keys = trav->get_keys();
+                int index = get_index(trav, message->first);
+
+                if (index > 0 && keys.at(index - 1) == message->first)
+                {
+                    in_internal = true;
+                    break;
+                }
+
+                if (index < keys.size())
+                {
+                    high = keys.at(index);
+                    has_high = true;
+                }
+
+                path.push_back(trav);
+                trav = trav->get_children().at(index);
+            }
+
+            if (in_internal)
+            {
+                apply_message(message->first, message->second);
+                message++;
+                continue;
+            }
+
+            Block *leaf = trav;
+            int delta = 0;
+            int inserted = 0;
+            bool blocked = false;
+
+            // messages are sorted, so the batch stays above the leaf's lower separator
+            while (message != batch.end() && (!has_high || message->first < high))
+            {
+                K key = message->first;
+                bool present = contains_in(leaf, key);
+
+                if (message->second)
+                {
+                    inserted++;
+
+                    if (present)
+                    {
+                        delta += this->tombstones.erase(key);
+                    }
+                    else if (leaf->get_key_count() >= leaf->get_max_keys())
+                    {
+                        blocked = true;
+                        break;
+                    }
+                    else if (leaf->is_packed() && leaf->packed_offset(key) >= 0)
+                    {
+                        leaf->packed_set(key, true);
+                        delta++;
+                    }
+                    else
+                    {
+                        Key_Vector &keys = leaf->get_keys();
+                        keys.insert(keys.begin() + get_index(leaf, key), key);
+                        delta++;
+                    }
+                }
+                else if (present && this->lazy_delete)
+                {
+                    delta -= this->tombstones.insert(key).second ? 1 : 0;
+                }
+                else if (present)
+                {
+                    if (!is_root(leaf) && leaf->get_key_count() <= leaf->get_min_keys())
+                    {
+                        blocked = true;
+                        break;
+                    }
+
+                    if (leaf->is_packed())
+                    {
+                        leaf->packed_set(key, false);
+                    }
+                    else
+                    {
+                        Key_Vector &keys = leaf->get_keys();
+                        keys.erase(keys.begin() + get_index(leaf, key) - 1);
+                    }
+
+                    // a buried key was already left out of the counts
+                    delta -= this->tombstones.erase(key) > 0 ? 0 : 1;
+                }
+                message++;
+            }
+
+            refresh_path(leaf, path, delta);
+
+            // too sparse now, convert back to a sorted array
+            if (leaf->is_packed() && !leaf->packed_is_dense())
+            {
+                leaf->get_keys();
+            }
+            try_pack(leaf);
+
+            if (blocked)
+            {
+                inserted--;
+                apply_message(message->first, message->second);
+                message++;
+            }
+            purge_tombstones(purge_per_write * inserted);
+        }
+    }
+
+    // the buffered message for key, true for an insert and false for a remove, or nullptr
+    bool *find_message(K key)
+    {
+        if (this->buffer.empty())
+        {
+            return nullptr;
+        }
+
+        auto message = this->buffer.find(key);
+        return message == this->buffer.end() ? nullptr : &message->second;
+    }
+
+    bool in_blocks(K key)
+    {
+        std::vector<Block *> path;
+        search_helper(this->root, key, path);
+
+        if (path.empty())
+            return false;
+
+        Block *last_block_seen = path.back();
+        path.pop_back();
+
+        // a bitmap leaf answers with a single bit test
+        if (contains_in(last_block_seen, key))
+        {
+            // remember where the key was found for the next lookup of the same key
+            cache_store(key, last_block_seen);
+            return true;
+        }
+        return false;
+    }
+
+    bool live_in_blocks(K key)
+    {
+        return !is_buried(key) && (cache_find(key) || in_blocks(key));
+    }
+
+    // the net change the messages in [first, last) make to the number of live keys
+    int buffered_delta(typename Buffer::iterator first, typename Buffer::iterator last)
+    {
+        int delta = 0;
+
+        for (auto message = first; message != last; ++message)
+        {
+            bool live = live_in_blocks(message->first);
+
+            if (message->second && !live)
+            {
+                delta++;
+            }
+            else if (!message->second && live)
+            {
+                delta--;
+            }
+        }
+        return delta;
+    }
+
+    // merge the messages in [first, last) into keys, which holds the live keys of the same key
+    // range in key order
+    void overlay_buffer(std::vector<K> &keys, typename Buffer::iterator first, typename Buffer::iterator last)
+    {
+        if (first == last)
+        {
+            return;
+        }
+
+        std::vector<K> merged;
+        merged.reserve(keys.size() + std::distance(first, last));
+        auto key = keys.begin();
+
+        for (auto message = first; message != last; ++message)
+        {
+            while (key != keys.end() && *key < message->first)
+            {
+                merged.push_back(*key++);
+            }
+            if (key != keys.end() && *key == message->first)
+            {
+                key++;
+            }
+            if (message->second)
+            {
+                merged.push_back(message->first);
+            }
+        }
+        merged.insert(merged.end(), key, keys.end());
+        keys.swap(merged);
+    }
+
+    // number of live keys in the blocks strictly less than key. buried keys are left out of the
+    // subtree sizes and skipped on the way down, so no tombstone has to be purged first
+    int rank_in_blocks(K key)
+    {
+        int rank = 0;
+        Block *trav = this->root;
+
+        while (true)
+        {
+            if (trav->is_packed())
+            {
+                return rank + trav->packed_rank(key) - buried_below(trav, key);
+            }
+
+            Key_Vector &keys = trav->get_keys();
+            Child_Vector &children = trav->get_children();
+            int index = get_index(trav, key);
+            bool found = index > 0 && keys.at(index - 1) == key;
+
+            // keys of this block below key, plus every subtree left of the one key falls into
+            int below = found ? index - 1 : index;
+            rank += below;
+
+            if (children.empty())
+            {
+                return rank - buried_below(trav, key);
+            }
+
+            for (int i = 0; i < below; i++)
+            {
+                rank -= is_buried(keys.at(i)) ? 1 : 0;
+            }
+
+            for (int i = 0; i < below; i++)
+            {
+                rank += children.at(i)->get_subtree_size();
+            }
+
+            if (found)
+            {
+                return rank + children.at(below)->get_subtree_size();
+            }
+
+            trav = children.at(below);
+        }
+    }
+
+    // the i-th smallest live key in the blocks, counting from 0
+    K select_in_blocks(int i)
+    {
+        Block *trav = this->root;
+
+        while (true)
+        {
+            if (is_leaf(trav))
+            {
+                return leaf_select(trav, i);
+            }
+
+            Key_Vector &keys = trav->get_keys();
+            Child_Vector &children = trav->get_children();
+
+            for (int j = 0; j < children.size(); j++)
+            {
+                int child_size = children.at(j)->get_subtree_size();
+
+                if (i < child_size)
+                {
+                    trav = children.at(j);
+                    break;
+                }
+
+                i -= child_size;
+
+                // i lands on the separator right after child j, unless it is buried
+                if (is_buried(keys.at(j)))
+                {
+                    continue;
+                }
+                if (i == 0)
+                {
+                    return keys.at(j);
+                }
+                i--;
+            }
+        }
+    }
+
+    // the i-th live key of leaf. each buried key at or before the position reached so far pushes it one further
+    K leaf_select(Block *leaf, int i)
+    {
+        int index = i;
+
+        if (!this->tombstones.empty())
+        {
+            K low = leaf->is_packed() ? leaf->get_base() : leaf->get_keys().front();
+
+            for (auto it = this->tombstones.lower_bound(low); it != this->tombstones.end() && contains_in(leaf, *it); ++it)
+            {
+                int position = leaf->is_packed() ? leaf->packed_rank(*it) : get_lower_index(leaf, *it);
+
+                if (position > index)
+                {
+                    break;
+                }
+                index++;
+            }
+        }
+        return leaf->is_packed() ? leaf->packed_select(index) : leaf->get_keys().at(index);
+    }
+
+    // every block of this tree is allocated here
+    Block *new_block(int b_count)
+    {
+        void *memory = this->resource->allocate(sizeof(Block), alignof(Block));
+        return new (memory) Block(b_count, this->resource);
+    }
+
+    // every block of this tree is deleted here, so the cache learns that its block pointers may dangle
+    void release_block(Block *block)
+    {
+        this->cache_epoch++;
+        this->shape_epoch++;
+        block->~Block();
+        this->resource->deallocate(block, sizeof(Block), alignof(Block));
+    }
+
+    // blocks were handed to another tree, no slot or finger written so far may be trusted
+    void invalidate_cache()
+    {
+        this->cache_epoch++;
+        this->shape_epoch++;
+    }
+
+    int cache_home(K key)
+    {
+        uint64_t h = std::hash<K>()(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h & (this->cache.size() - 1);
+    }
+
+    // whether the cache knows a block holding key, false on a miss
+    bool cache_find(K key)
+    {
+        if constexpr (Is_Hashable<K>::value)
+        {
+            if (this->cache.empty())
+            {
+                return false;
+            }
+
+            int home = cache_home(key);
+
+            for (int i = 0; i < cache_probes; i++)
+            {
+                Cache_Slot &slot = this->cache.at((home + i) & (this->cache.size() - 1));
+
+                if (!slot.used)
+                {
+                    break;
+                }
+
+                if (slot.epoch == this->cache_epoch && slot.key == key)
+                {
+                    if (contains_in(slot.block, key))
+                    {
+                        this->cache_hit_count++;
+                        return true;
+                    }
+                    break;
+                }
+            }
+            this->cache_miss_count++;
+        }
+        return false;
+    }
+
+    // remember that key lives in block, taking the key's own slot, a free or stale one, or the home slot
+    void cache_store(K key, Block *block)
+    {
+        if constexpr (Is_Hashable<K>::value)
+        {
+            if (this->cache.empty())
+            {
+                return;
+            }
+
+            int home = cache_home(key);
+            int target = home;
+
+            for (int i = 0; i < cache_probes; i++)
+            {
+                int index = (home + i) & (this->cache.size() - 1);
+                Cache_Slot &slot = this->cache.at(index);
+
+                if (!slot.used || slot.epoch != this->cache_epoch || slot.key == key)
+                {
+                    target = index;
+                    break;
+                }
+            }
+
+            this->cache.at(target) = Cache_Slot{key, block, this->cache_epoch, true};
+        }
+    }
+
+    // insert without printing, returns false when key was already present
+    bool insert_key(K key)
+    {
+        // inserts next to the last one, appends above all, skip the descent
+        Block *leaf = finger_leaf(key);
+
+        if (leaf != nullptr)
+        {
+            if (contains_in(leaf, key))
+            {
+                return revive(leaf, this->finger_path, key);
+            }
+
+            insert_helper(leaf, key, this->finger_path);
+            return true;
+        }
+
+        std::vector<Block *> path;
+        search_helper(this->root, key, path);
+
+        if (path.empty())
+            return false;
+
+        Block *last_block_seen = path.back();
+        path.pop_back();
+
+        if (contains_in(last_block_seen, key))
+        {
+            return revive(last_block_seen, path, key);
+        }
+
+        insert_helper(last_block_seen, key, path);
+        return true;
+    }
+
+    // a buried key is still in block, inserting it again only drops its tombstone and counts it back
+    // in. returns false when key was live already
+    bool revive(Block *block, std::vector<Block *> &path, K key)
+    {
+        if (this->tombstones.empty() || this->tombstones.erase(key) == 0)
+        {
+            return false;
+        }
+
+        refresh_path(block, path, 1);
+        return true;
+    }
+
+    // remove without printing, returns false when key was not present. one descent records the
+    // path and each child slot taken. a key found in an internal block is swapped with its
+    // predecessor, the largest key of its left subtree, so the key always leaves a leaf
+    bool remove_key(K key)
+    {
+        // the key may be a separator, and blocks may borrow or merge
+        this->shape_epoch++;
+
+        std::vector<Block *> path;
+        std::vector<int> slots;
+        Block *trav = this->root;
+        int index;
+
+        while (true)
+        {
+            if (trav->is_packed())
+            {
+                if (!trav->packed_contains(key))
+                {
+                    return false;
+                }
+
+                // bitmap leaf : clear the bit in place when no rebalancing will follow. a buried key
+                // was already left out of the counts
+                if (trav->get_key_count() - 1 >= trav->get_min_keys() || is_root(trav))
+                {
+                    trav->packed_set(key, false);
+                    refresh_path(trav, path, this->tombstones.erase(key) > 0 ? 0 : -1);
+
+                    // too sparse now, convert back to a sorted array
+                    if (!trav->packed_is_dense())
+                    {
+                        trav->get_keys();
+                    }
+                    return true;
+                }
+            }
+
+            index = get_index(trav, key);
+
+            if (index > 0 && trav->get_keys().at(index - 1) == key)
+            {
+                break;
+            }
+
+            if (is_leaf(trav))
+            {
+                return false;
+            }
+
+            path.push_back(trav);
+            slots.push_back(index);
+            trav = trav->get_children().at(index);
+        }
+
+        // a buried key already left the counts, count it back in so it can leave them the regular way
+        if (this->tombstones.erase(key) > 0)
+        {
+            refresh_path(trav, path, 1);
+        }
+
+        // ancestors above target_depth lose key, those below only see the predecessor move up
+        int target_depth = path.size();
+        bool moved_buried = false;
+
+        if (!is_leaf(trav))
+        {
+            // continue to the rightmost leaf of the left subtree
+            Block *target_block = trav;
+            int target_index = index - 1;
+
+            path.push_back(trav);
+            slots.push_back(target_index);
+            trav = trav->get_children().at(target_index);
+
+            while (!is_leaf(trav))
+            {
+                path.push_back(trav);
+                slots.push_back(trav->get_children().size() - 1);
+                trav = trav->get_children().back();
+            }
+
+            Key_Vector &leaf_keys = trav->get_keys();
+            target_block->get_keys().at(target_index) = leaf_keys.back();
+            index = leaf_keys.size();
+            moved_buried = is_buried(leaf_keys.back());
+        }
+
+        Key_Vector &leaf_keys = trav->get_keys();
+        leaf_keys.erase(leaf_keys.begin() + index - 1);
+
+        if (!moved_buried)
+        {
+            refresh_path(trav, path, -1);
+        }
+        else
+        {
+            // a buried predecessor never counted below the block it moved up into
+            for (int i = 0; i <= target_depth; i++)
+            {
+                path.at(i)->set_subtree_size(path.at(i)->get_subtree_size() - 1);
+            }
+        }
+
+        // underflow can only occur when removing a key from a leaf
+        if (leaf_keys.size() < trav->get_min_keys())
+        {
+            remove_restructure(trav, path, slots);
+        }
+        else
+        {
+            try_pack(trav);
+        }
+        return true;
+    }
+
+    // the key stored first, or last when largest is set, under block, buried or not
+    K edge_key(Block *block, bool largest)
+    {
+        while (!is_leaf(block))
+        {
+            block = largest ? block->get_children().back() : block->get_children().front();
+        }
+
+        if (block->is_packed())
+        {
+            return block->packed_select(largest ? block->get_key_count() - 1 : 0);
+        }
+        return largest ? block->get_keys().back() : block->get_keys().front();
+    }
+
+    // number of levels below block, a leaf has height 0
+    int height(Block *block)
+    {
+        int height = 0;
+        while (!is_leaf(block))
+        {
+            block = block->get_children().front();
+            height++;
+        }
+        return height;
+    }
+
+    bool is_empty(Block *block)
+    {
+        return is_leaf(block) && block->get_key_count() == 0;
+    }
+
+    // index of the first key >= key
+    int get_lower_index(Block *block, K key)
+    {
+        int index = get_index(block, key);
+        if (index > 0 && block->get_keys().at(index - 1) == key)
+        {
+            index--;
+        }
+        return index;
+    }
+
+    // hand freed heap pages back to the OS where the allocator supports it
+    static void trim_heap()
+    {
+#if defined(__GLIBC__)
+        malloc_trim(0);
+#endif
+    }
+
+    // release every block under block with an explicit stack instead of recursion
+    void free_subtree(Block *block)
+    {
+        std::vector<Block *> pending;
+        pending.push_back(block);
+
+        while (!pending.empty())
+        {
+            Block *trav = pending.back();
+            pending.pop_back();
+
+            Child_Vector &children = trav->get_children();
+            pending.insert(pending.end(), children.begin(), children.end());
+            release_block(trav);
+        }
+    }
+
+    // leave the tree empty with its settings kept
+    void release_contents()
+    {
+        int b_count = this->root->get_b_count();
+
+        free_subtree(this->root);
+        this->root = new_block(b_count);
+
+        Buffer().swap(this->buffer);
+        this->buffer_delta_known = false;
+        this->tombstones.clear();
+        std::vector<Block *>().swap(this->finger_path);
+        this->finger = nullptr;
+        std::fill(this->cache.begin(), this->cache.end(), Cache_Slot());
+        invalidate_cache();
+    }
+
+    // exchange everything but the memory resources, which stay with their trees
+    void swap_contents(B_Tree<K> &other)
+    {
+        std::swap(this->root, other.root);
+        std::swap(this->lazy_delete, other.lazy_delete);
+        std::swap(this->tombstones, other.tombstones);
+        std::swap(this->cache, other.cache);
+        std::swap(this->cache_epoch, other.cache_epoch);
+        std::swap(this->cache_hit_count, other.cache_hit_count);
+        std::swap(this->cache_miss_count, other.cache_miss_count);
+        std::swap(this->finger, other.finger);
+        std::swap(this->finger_path, other.finger_path);
+        std::swap(this->finger_has_low, other.finger_has_low);
+        std::swap(this->finger_has_high, other.finger_has_high);
+        std::swap(this->finger_low, other.finger_low);
+        std::swap(this->finger_high, other.finger_high);
+        std::swap(this->finger_epoch, other.finger_epoch);
+        std::swap(this->shape_epoch, other.shape_epoch);
+        std::swap(this->buffered, other.buffered);
+        std::swap(this->buffer_capacity, other.buffer_capacity);
+        std::swap(this->buffer, other.buffer);
+        std::swap(this->buffer_delta, other.buffer_delta);
+        std::swap(this->buffer_delta_known, other.buffer_delta_known);
+    }
+
+    // build a tree bottom up from sorted, distinct keys. each level is cut into as few blocks as
+    // fill keys apiece allows, spreading keys evenly so no block drops below min_keys, and the key
+    // between two neighbouring blocks moves up a level as their separator
+    Block *build_sorted(std::vector<K> &sorted_keys, int b_count, int fill)
+    {
+        std::vector<K> items = sorted_keys;
+        std::vector<Block *> level;
+        bool leaf_level = true;
+
+        while (true)
+        {
+            int count = items.size();
+            int min_keys = b_count - 1;
+            int blocks = (count + 1 + fill) / (fill + 1);
+
+            while (blocks > 1 && (count - (blocks - 1)) / blocks < min_keys)
+            {
+                blocks--;
+            }
+            blocks = std::max(1, blocks);
+
+            int per_block = (count - (blocks - 1)) / blocks;
+            int extra = (count - (blocks - 1)) % blocks;
+
+            std::vector<K> separators;
+            std::vector<Block *> next_level;
+            int item = 0;
+            int child = 0;
+
+            for (int i = 0; i < blocks; i++)
+            {
+                Block *block = new_block(b_count);
+                int take = per_block + (i < extra ? 1 : 0);
+
+                block->get_keys().assign(items.begin() + item, items.begin() + item + take);
+                item += take;
+
+                if (!leaf_level)
+                {
+                    block->get_children().assign(level.begin() + child, level.begin() + child + take + 1);
+                    child += take + 1;
+                }
+
+                refresh_block(block);
+                try_pack(block);
+                next_level.push_back(block);
+
+                if (i + 1 < blocks)
+                {
+                    separators.push_back(items.at(item));
+                    item++;
+                }
+            }
+
+            if (blocks == 1)
+            {
+                return next_level.front();
+            }
+
+            items.swap(separators);
+            level.swap(next_level);
+            leaf_level = false;
+        }
+    }
+
+    // a former root grafted below the spine may hold fewer than min_keys. walk the left or right
+    // spine down to the given height and borrow or merge until that block is full enough again
+    void repair_spine(int target_height, bool right_spine)
+    {
+        std::vector<Block *> path;
+        std::vector<int> slots;
+        Block *trav = this->root;
+
+        // the repaired block became the root, which has no minimum
+        for (int h = height(trav); h > target_height; h--)
+        {
+            int slot = right_spine ? trav->get_children().size() - 1 : 0;
+            path.push_back(trav);
+            slots.push_back(slot);
+            trav = trav->get_children().at(slot);
+        }
+
+        remove_restructure(trav, path, slots);
+    }
+
+    // concatenate two roots around key, where every key under left < key < every key under right.
+    // the shorter tree is grafted onto the matching level of the taller tree's spine, and only that
+    // spine is split or rebalanced. uses this->root as the working root and returns it
+    Block *join_roots(Block *left, int left_height, K key, Block *right, int right_height)
+    {
+        if (is_empty(left) || is_empty(right))
+        {
+            this->root = is_empty(left) ? right : left;
+            release_block(is_empty(left) ? left : right);
+            insert_key(key);
+            return this->root;
+        }
+
+        if (left_height == right_height)
+        {
+            Block *new_root = new_block(left->get_b_count());
+            new_root->get_keys().push_back(key);
+            new_root->get_children().push_back(left);
+            new_root->get_children().push_back(right);
+            refresh_block(new_root);
+            this->root = new_root;
+            B_TREE_COUNT(root_grows);
+
+            repair_spine(left_height, false);
+            repair_spine(right_height, true);
+            return this->root;
+        }
+
+        bool graft_right = left_height > right_height;
+        Block *taller = graft_right ? left : right;
+        int shorter_height = graft_right ? right_height : left_height;
+        this->root = taller;
+
+        // descend the taller tree's inner spine to the block one level above the shorter root
+        std::vector<Block *> path;
+        Block *trav = taller;
+        for (int h = height(taller); h > shorter_height + 1; h--)
+        {
+            path.push_back(trav);
+            trav = graft_right ? trav->get_children().back() : trav->get_children().front();
+        }
+
+        Key_Vector &trav_keys = trav->get_keys();
+        Child_Vector &trav_children = trav->get_children();
+
+        if (graft_right)
+        {
+            trav_keys.push_back(key);
+            trav_children.push_back(right);
+        }
+        else
+        {
+            trav_keys.insert(trav_keys.begin(), key);
+            trav_children.insert(trav_children.begin(), left);
+        }
+
+        refresh_block(trav);
+        for (int i = path.size() - 1; i >= 0; i--)
+        {
+            refresh_block(path.at(i));
+        }
+
+        if (trav_keys.size() > trav->get_max_keys())
+        {
+            insert_restructure(trav, path);
+        }
+
+        repair_spine(shorter_height, graft_right);
+        return this->root;
+    }
+
+    // split the subtree under block into keys < key (left) and keys >= key (right). every level
+    // contributes at most one piece to each side, which is joined onto the result from below
+    void split_helper(Block *block, int block_height, K key, Block *&left, int &left_height, Block *&right, int &right_height)
+    {
+        int b_count = block->get_b_count();
+        Key_Vector &keys = block->get_keys();
+        int index = get_lower_index(block, key);
+
+        if (is_leaf(block))
+        {
+            Block *right_leaf = new_block(b_count);
+            right_leaf->get_keys().assign(keys.begin() + index, keys.end());
+            keys.erase(keys.begin() + index, keys.end());
+
+            refresh_block(block);
+            refresh_block(right_leaf);
+            try_pack(block);
+            try_pack(right_leaf);
+
+            left = block;
+            right = right_leaf;
+            left_height = right_height = 0;
+            return;
+        }
+
+        Key_Vector block_keys(this->resource);
+        Child_Vector block_children(this->resource);
+        block_keys.swap(keys);
+        block_children.swap(block->get_children());
+        keys.reserve(block->get_max_keys() + 1);
+        block->get_children().reserve(block->get_max_children() + 1);
+
+        Block *sub_left;
+        Block *sub_right;
+        int sub_left_height;
+        int sub_right_height;
+        split_helper(block_children.at(index), block_height - 1, key, sub_left, sub_left_height, sub_right, sub_right_height);
+
+        // left piece : keys [0, index - 1) with children [0, index), joined to sub_left by keys[index - 1]
+        if (index == 0)
+        {
+            left = sub_left;
+            left_height = sub_left_height;
+            release_block(block);
+        }
+        else
+        {
+            Block *piece = block_children.front();
+            int piece_height = block_height - 1;
+
+            if (index > 1)
+            {
+                piece = block;
+                piece_height = block_height;
+                piece->get_keys().assign(block_keys.begin(), block_keys.begin() + index - 1);
+                piece->get_children().assign(block_children.begin(), block_children.begin() + index);
+                refresh_block(piece);
+            }
+            else
+            {
+                release_block(block);
+            }
+
+            left = join_roots(piece, piece_height, block_keys.at(index - 1), sub_left, sub_left_height);
+            left_height = height(left);
+        }
+
+        // right piece : keys (index, size) with children (index, size], joined to sub_right by keys[index]
+        if (index == block_keys.size())
+        {
+            right = sub_right;
+            right_height = sub_right_height;
+        }
+        else
+        {
+            Block *piece = block_children.back();
+            int piece_height = block_height - 1;
+
+            if (index + 1 < block_keys.size())
+            {
+                piece = new_block(b_count);
+                piece_height = block_height;
+                piece->get_keys().assign(block_keys.begin() + index + 1, block_keys.end());
+                piece->get_children().assign(block_children.begin() + index + 1, block_children.end());
+                refresh_block(piece);
+            }
+
+            right = join_roots(sub_right, sub_right_height, block_keys.at(index), piece, piece_height);
+            right_height = height(right);
+        }
+    }
+
+public:
+    // the degree whose full key array spans block_target_lines cache lines. a descent pays more per
+    // block visited than per line its binary search touches, so wide blocks win : calibrate()
+    // picks 64 to 128 for 8 byte keys on a current x86 host, and this gives 64. no key array
+    // outgrows a memory page, and the degree is never below 2
+    static constexpr int default_b_count()
+    {
+        int key_bytes = std::min<int>(block_target_lines * cache_line_bytes, memory_page_bytes);
+        int max_keys = key_bytes / (int)sizeof(K);
+        return std::max(2, (max_keys + 1) / 2);
+    }
+
+    // time each of calibration_degrees on this host : insert sample_keys in the given order, find
+    // them all in a shuffled order, then erase half of them, keeping the fastest of
+    // calibration_rounds. returns the degree with the lowest cost weighted by mix, and every
+    // degree with its weighted ns per operation in scores when given
+    static int calibrate(std::vector<K> &sample_keys, Operation_Mix mix, std::vector<std::pair<int, double>> *scores = nullptr)
+    {
+        if (mix.insert_percent < 0 || mix.find_percent < 0 || mix.erase_percent < 0 ||
+            mix.insert_percent + mix.find_percent + mix.erase_percent != 100)
+        {
+            throw std::invalid_argument("operation mix percentages must be non negative and sum to 100");
+        }
+        if (sample_keys.empty())
+        {
+            throw std::invalid_argument("calibration needs sample keys");
+        }
+
+        std::vector<K> lookups = sample_keys;
+        std::shuffle(lookups.begin(), lookups.end(), std::mt19937(1));
+        int erases = std::max<int>(1, lookups.size() / 2);
+
+        int best_b_count = default_b_count();
+        double best_cost = -1;
+
+        for (int b_count : calibration_degrees)
+        {
+            double cost = -1;
+
+            for (int round = 0; round < calibration_rounds; round++)
+            {
+                B_Tree<K> tree(b_count);
+
+                auto start = std::chrono::steady_clock::now();
+                for (K &key : sample_keys)
+                {
+                    tree.insert_key(key);
+                }
+                auto inserted = std::chrono::steady_clock::now();
+                for (K &key : lookups)
+                {
+                    tree.in_tree(key);
+                }
+                auto found = std::chrono::steady_clock::now();
+                for (int i = 0; i < erases; i++)
+                {
+                    tree.remove_key(lookups.at(i));
+                }
+                auto erased = std::chrono::steady_clock::now();
+
+                double insert_ns = std::chrono::duration<double, std::nano>(inserted - start).count() / sample_keys.size();
+                double find_ns = std::chrono::duration<double, std::nano>(found - inserted).count() / lookups.size();
+                double erase_ns = std::chrono::duration<double, std::nano>(erased - found).count() / erases;
+                double round_cost = (mix.insert_percent * insert_ns + mix.find_percent * find_ns + mix.erase_percent * erase_ns) / 100;
+
+                if (cost < 0 || round_cost < cost)
+                {
+                    cost = round_cost;
+                }
+            }
+
+            if (scores != nullptr)
+            {
+                scores->push_back({b_count, cost});
+            }
+            if (best_cost < 0 || cost < best_cost)
+            {
+                best_cost = cost;
+                best_b_count = b_count;
+            }
+        }
+        return best_b_count;
+    }
+
+    B_Tree()
+    {
+        this->resource = std::pmr::get_default_resource();
+        this->root = new_block(default_b_count());
+        this->lazy_delete = false;
+        this->buffered = false;
+        this->buffer_capacity = 0;
+        this->buffer_delta = 0;
+        this->buffer_delta_known = false;
+        this->cache_epoch = 0;
+        this->cache_hit_count = 0;
+        this->cache_miss_count = 0;
+        this->finger = nullptr;
+        this->finger_has_low = false;
+        this->finger_has_high = false;
+        this->finger_epoch = 0;
+        this->shape_epoch = 0;
+    }
+
+    // blocks and their vectors are allocated from resource, which must outlive the tree
+    B_Tree(int b_count, std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+    {
+        this->resource = resource;
+        this->root = new_block(b_count);
+        this->lazy_delete = false;
+        this->buffered = false;
+        this->buffer_capacity = 0;
+        this->buffer_delta = 0;
+        this->buffer_delta_known = false;
+        this->cache_epoch = 0;
+        this->cache_hit_count = 0;
+        this->cache_miss_count = 0;
+        this->finger = nullptr;
+        this->finger_has_low = false;
+        this->finger_has_high = false;
+        this->finger_epoch = 0;
+        this->shape_epoch = 0;
+    }
+
+    // blocks are released with an explicit stack, so no tree is too deep to tear down
+    ~B_Tree()
+    {
+        free_subtree(this->root);
+    }
+
+    // a tree owns its blocks, so a copy would release them twice
+    B_Tree(const B_Tree &) = delete;
+    B_Tree &operator=(const B_Tree &) = delete;
+
+    // the blocks move along with the memory resource they came from, other is left empty
+    B_Tree(B_Tree &&other) : B_Tree(other.root->get_b_count(), other.resource)
+    {
+        swap_contents(other);
+    }
+
+    // like a std::pmr container, this tree keeps its own memory resource. the blocks change hands
+    // only when both resources can free each other's memory, otherwise the keys are rebuilt in
+    // this tree's resource. other is left empty either way
+    B_Tree &operator=(B_Tree &&other)
+    {
+        if (this == &other)
+        {
+            return *this;
+        }
+
+        if (this->resource->is_equal(*other.resource))
+        {
+            swap_contents(other);
+            other.release_contents();
+            return *this;
+        }
+
+        other.compact();
+
+        int b_count = other.root->get_b_count();
+        std::vector<K> sorted;
+        sorted.reserve(other.size());
+
+        for (Cursor cursor(other.root); cursor.valid(); cursor.next())
+        {
+            sorted.push_back(cursor.key());
+        }
+
+        B_Tree<K> rebuilt(b_count, this->resource);
+        if (!sorted.empty())
+        {
+            rebuilt.release_block(rebuilt.root);
+            rebuilt.root = rebuilt.build_sorted(sorted, b_count, 2 * b_count - 1);
+        }
+        rebuilt.lazy_delete = other.lazy_delete;
+        rebuilt.buffered = other.buffered;
+        rebuilt.buffer_capacity = other.buffer_capacity;
+        rebuilt.cache.assign(other.cache.size(), Cache_Slot());
+
+        swap_contents(rebuilt);
+        other.release_contents();
+        return *this;
+    }
+
+    void insert(K key)
+    {
+        if (this->buffered)
+        {
+            buffer_message(key, true);
+            std::cout << std::left << std::setw(7) << key << " was buffered for insertion.\n";
+            return;
+        }
+
+        bool inserted = insert_key(key);
+        purge_tombstones(purge_per_write);
+
+        if (inserted)
+        {
+            std::cout << std::left << std::setw(7) << key << " was added to the tree.\n";
+        }
+        else
+        {
+            std::cout << std::left << std::setw(7) << "is already in the tree.\n";
+        }
+    }
+
+    void remove(K key)
+    {
+        if (this->buffered)
+        {
+            buffer_message(key, false);
+            std::cout << std::left << std::setw(7) << key << " was buffered for removal.\n";
+            return;
+        }
+
+        bool removed = this->lazy_delete ? bury_key(key) : remove_key(key);
+
+        if (removed)
+        {
+            std::cout << std::left << std::setw(7) << key << " was removed from the tree.\n";
+        }
+        else
+        {
+            std::cout << std::left << std::setw(7) << key << " is NOT in the tree.\n";
+        }
+    }
+
+    void search(K key)
+    {
+        if (in_tree(key))
+        {
+            std::cout << std::left << std::setw(7) << key << " is in the tree.\n";
+        }
+        else
+        {
+            std::cout << std::left << std::setw(7) << key << " is NOT in the tree.\n";
+        }
+    }
+
+    bool in_tree(K key)
+    {
+        // the buffered message for key decides before the blocks are looked at
+        bool *message = find_message(key);
+
+        if (message != nullptr)
+        {
+            return *message;
+        }
+
+        if (is_buried(key))
+        {
+            return false;
+        }
+        return cache_find(key) || in_blocks(key);
+    }
+
+    int size()
+    {
+        // buried keys are already left out of every subtree size, buffered messages are counted
+        // by whether they add or remove a live key
+        if (!this->buffer_delta_known)
+        {
+            this->buffer_delta = buffered_delta(this->buffer.begin(), this->buffer.end());
+            this->buffer_delta_known = true;
+        }
+        return this->root->get_subtree_size() + this->buffer_delta;
+    }
+
+    // height, blocks per level, how full the blocks are and how many bytes the tree holds. the
+    // byte counts include reserved vector capacity but not the allocator's own bookkeeping
+    Tree_Stats stats()
+    {
+        Tree_Stats stats;
+        int max_keys = this->root->get_max_keys();
+        long long capacity = 0;
+
+        stats.fill_histogram.assign(max_keys + 2, 0);
+
+        std::vector<Block *> level;
+        level.push_back(this->root);
+
+        while (!level.empty())
+        {
+            std::vector<Block *> next_level;
+
+            stats.height++;
+            stats.blocks_per_level.push_back(level.size());
+
+            for (Block *block : level)
+            {
+                int count = block->get_key_count();
+
+                stats.blocks++;
+                stats.keys += count;
+                stats.fill_histogram.at(std::min(count, max_keys + 1))++;
+                capacity += max_keys;
+
+                if (block != this->root && count < block->get_min_keys())
+                {
+                    stats.underfull_blocks++;
+                }
+
+                if (block->is_packed())
+                {
+                    stats.packed_leaves++;
+                }
+
+                stats.block_bytes += block->footprint();
+                stats.slack_bytes += block->slack();
+
+                Child_Vector &children = block->get_children();
+                next_level.insert(next_level.end(), children.begin(), children.end());
+            }
+            level.swap(next_level);
+        }
+
+        stats.tombstones = this->tombstones.size();
+        stats.buffered = this->buffer.size();
+        stats.average_fill = (double)stats.keys / capacity;
+
+        // a buffered message and a tombstone are each a red-black tree node of three links and a
+        // colour around their payload
+        stats.overhead_bytes = sizeof(*this) + this->buffer.size() * (sizeof(std::pair<K, bool>) + 4 * sizeof(void *)) +
+                               this->cache.capacity() * sizeof(Cache_Slot) +
+                               this->tombstones.size() * (sizeof(K) + 4 * sizeof(void *)) +
+                               this->finger_path.capacity() * sizeof(Block *);
+        stats.total_bytes = stats.block_bytes + stats.overhead_bytes;
+        stats.bytes_per_key = stats.keys > 0 ? (double)stats.total_bytes / stats.keys : 0;
+
+        return stats;
+    }
+
+    // with lazy deletion on, remove() only records a tombstone and returns, leaving borrows and
+    // merges to later inserts or compact(). turning it off purges every tombstone
+    void set_lazy_delete(bool lazy_delete)
+    {
+        this->lazy_delete = lazy_delete;
+
+        if (!lazy_delete)
+        {
+            compact();
+        }
+    }
+
+    int tombstone_count()
+    {
+        return this->tombstones.size();
+    }
+
+    // keep a hot key cache of capacity slots, rounded up to a power of two, in front of in_tree
+    // and search. a capacity of 0 turns it off
+    void set_cache(int capacity)
+    {
+        static_assert(Is_Hashable<K>::value, "set_cache() needs keys hashable with std::hash");
+
+        if (capacity < 0)
+        {
+            throw std::invalid_argument("cache capacity must not be negative");
+        }
+
+        int slots = 1;
+        while (slots < capacity)
+        {
+            slots *= 2;
+        }
+
+        this->cache.assign(capacity == 0 ? 0 : slots, Cache_Slot{K(), nullptr, 0, false});
+        this->cache_hit_count = 0;
+        this->cache_miss_count = 0;
+    }
+
+    long long cache_hits()
+    {
+        return this->cache_hit_count;
+    }
+
+    long long cache_misses()
+    {
+        return this->cache_miss_count;
+    }
+
+    // fraction of cached lookups that were answered without a descent
+    double cache_hit_rate()
+    {
+        long long lookups = this->cache_hit_count + this->cache_miss_count;
+        return lookups == 0 ? 0.0 : (double)this->cache_hit_count / lookups;
+    }
+
+    // with buffering on, insert() and remove() only queue a message and whole batches of up to
+    // capacity messages reach the blocks at once. turning it off flushes what is left
+    void set_buffered(bool buffered, int capacity = 1024)
+    {
+        if (buffered && capacity < 1)
+        {
+            throw std::invalid_argument("buffer capacity must be at least 1");
+        }
+
+        this->buffered = buffered;
+        this->buffer_capacity = capacity;
+
+        if (!buffered)
+        {
+            flush_buffer();
+        }
+    }
+
+    int buffered_count()
+    {
+        return this->buffer.size();
+    }
+
+    // flush buffered writes, then purge tombstones until none are left or budget has elapsed, returns
+    // how many were purged. reads never need this, buried keys are already left out of every count
+    int compact(std::chrono::microseconds budget = std::chrono::microseconds::max())
+    {
+        flush_buffer();
+
+        auto start = std::chrono::steady_clock::now();
+        int purged = 0;
+
+        while (!this->tombstones.empty())
+        {
+            if (budget != std::chrono::microseconds::max() && std::chrono::steady_clock::now() - start >= budget)
+            {
+                break;
+            }
+
+            purge_tombstones(1);
+            purged++;
+        }
+        return purged;
+    }
+
+    // rebuild the tree bottom up from its live keys, each block holding target_fill of max_keys
+    // but never fewer than min_keys. the new blocks are allocated in key order before the old ones
+    // are released, and the freed pages are handed back to the OS. returns the number of blocks
+    // the tree shrank by
+    int compact(double target_fill)
+    {
+        if (!(target_fill > 0 && target_fill <= 1))
+        {
+            throw std::invalid_argument("target fill must be in (0, 1]");
+        }
+
+        flush_buffer();
+
+        int b_count = this->root->get_b_count();
+        int max_keys = 2 * b_count - 1;
+        int fill = std::max(b_count - 1, std::min(max_keys, (int)std::lround(target_fill * max_keys)));
+        int blocks_before = stats().blocks;
+
+        std::vector<K> live;
+        live.reserve(this->root->get_subtree_size());
+
+        // tombstoned keys are simply left out instead of being removed one at a time
+        for (Cursor cursor(this->root, &this->tombstones); cursor.valid(); cursor.next())
+        {
+            live.push_back(cursor.key());
+        }
+        this->tombstones.clear();
+
+        Block *old_root = this->root;
+        this->root = live.empty() ? new_block(b_count) : build_sorted(live, b_count, fill);
+        free_subtree(old_root);
+        invalidate_cache();
+
+        trim_heap();
+        return blocks_before - stats().blocks;
+    }
+
+    // remove every key, releasing every block, buffered message, tombstone and cache slot
+    void clear()
+    {
+        release_contents();
+        trim_heap();
+    }
+
+    // membership of every key in keys. lookups advance a level at a time in groups of group_size,
+    // so the cache misses of a whole group are in flight together instead of one after another
+    std::vector<bool> multi_contains(std::vector<K> &keys)
+    {
+        std::vector<bool> found(keys.size(), false);
+        std::vector<Block *> current(group_size);
+
+        for (int start = 0; start < keys.size(); start += group_size)
+        {
+            int count = std::min(group_size, (int)keys.size() - start);
+            int active = count;
+
+            for (int i = 0; i < count; i++)
+            {
+                current.at(i) = this->root;
+            }
+
+            while (active > 0)
+            {
+                // each block was prefetched last round, now fetch the key arrays they point to
+                for (int i = 0; i < count; i++)
+                {
+                    if (current.at(i) != nullptr)
+                    {
+                        prefetch(current.at(i)->key_data());
+                    }
+                }
+
+                for (int i = 0; i < count; i++)
+                {
+                    Block *trav = current.at(i);
+
+                    if (trav == nullptr)
+                    {
+                        continue;
+                    }
+
+                    K key = keys.at(start + i);
+
+                    // bitmap blocks are always leaves
+                    if (trav->is_packed())
+                    {
+                        found.at(start + i) = trav->packed_contains(key);
+                        current.at(i) = nullptr;
+                        active--;
+                        continue;
+                    }
+
+                    int index = get_index(trav, key);
+
+                    if ((index > 0 && trav->get_keys().at(index - 1) == key) || is_leaf(trav))
+                    {
+                        found.at(start + i) = index > 0 && trav->get_keys().at(index - 1) == key;
+                        current.at(i) = nullptr;
+                        active--;
+                        continue;
+                    }
+
+                    current.at(i) = trav->get_children().at(index);
+                    prefetch(current.at(i));
+                }
+            }
+        }
+
+        // a buffered message for a key overrides the blocks, a tombstone hides the key found there
+        for (int i = 0; i < keys.size(); i++)
+        {
+            bool *message = find_message(keys.at(i));
+            found.at(i) = message != nullptr ? *message : found.at(i) && !is_buried(keys.at(i));
+        }
+        return found;
+    }
+
+    // number of keys strictly less than key, buffered messages included
+    int rank(K key)
+    {
+        return rank_in_blocks(key) + buffered_delta(this->buffer.begin(), this->buffer.lower_bound(key));
+    }
+
+    // the i-th smallest key, counting from 0. the buffered messages are walked in key order, and
+    // shift tracks how many live keys those walked so far add or take away
+    K select(int i)
+    {
+        if (i < 0 || i >= size())
+        {
+            throw std::out_of_range("select index out of range");
+        }
+
+        int shift = 0;
+
+        for (auto message = this->buffer.begin(); message != this->buffer.end(); ++message)
+        {
+            int position = rank_in_blocks(message->first) + shift;
+
+            // the i-th key lies in the blocks, before this message's key
+            if (i < position)
+            {
+                break;
+            }
+
+            bool live = live_in_blocks(message->first);
+
+            if (message->second)
+            {
+                if (i == position)
+                {
+                    return message->first;
+                }
+                shift += live ? 0 : 1;
+            }
+            else
+            {
+                shift -= live ? 1 : 0;
+            }
+        }
+        return select_in_blocks(i - shift);
+    }
+
+    // number of keys in [low, high)
+    int count_range(K low, K high)
+    {
+        if (!(low < high))
+        {
+            return 0;
+        }
+        return rank(high) - rank(low);
+    }
+
+    // a read only snapshot of every key, laid out for lookups. this tree is left unchanged
+    Frozen_Tree<K> freeze()
+    {
+        std::vector<K> sorted;
+        sorted.reserve(this->root->get_subtree_size() + this->buffer.size());
+
+        for (Cursor cursor(this->root, &this->tombstones); cursor.valid(); cursor.next())
+        {
+            sorted.push_back(cursor.key());
+        }
+        overlay_buffer(sorted, this->buffer.begin(), this->buffer.end());
+        return Frozen_Tree<K>(sorted);
+    }
+
+    // a new tree with this tree's b_count holding sorted, distinct keys in fully packed leaves
+    B_Tree<K> from_sorted(std::vector<K> &sorted_keys)
+    {
+        int b_count = this->root->get_b_count();
+        B_Tree<K> tree(b_count, this->resource);
+
+        if (!sorted_keys.empty())
+        {
+            tree.release_block(tree.root);
+            tree.root = tree.build_sorted(sorted_keys, b_count, 2 * b_count - 1);
+        }
+        return tree;
+    }
+
+    // keys >= key move into the returned tree, keys < key stay in this tree
+    B_Tree<K> split(K key)
+    {
+        flush_buffer();
+
+        int b_count = this->root->get_b_count();
+        B_Tree<K> right_tree(b_count, this->resource);
+
+        if (is_empty(this->root))
+        {
+            return right_tree;
+        }
+
+        Block *left;
+        Block *right;
+        int left_height;
+        int right_height;
+        split_helper(this->root, height(this->root), key, left, left_height, right, right_height);
+
+        right_tree.release_block(right_tree.root);
+        right_tree.root = right;
+        this->root = left;
+
+        // buried keys travel with their blocks, and so do their tombstones
+        auto first_moved = this->tombstones.lower_bound(key);
+        right_tree.tombstones.insert(first_moved, this->tombstones.end());
+        this->tombstones.erase(first_moved, this->tombstones.end());
+
+        // blocks now belonging to right_tree may still sit in this tree's cache
+        invalidate_cache();
+        return right_tree;
+    }
+
+    // absorb every key of other, whose keys must all be smaller or all be larger than this tree's.
+    // other is left empty
+    void join(B_Tree<K> &other)
+    {
+        flush_buffer();
+        other.flush_buffer();
+
+        int b_count = this->root->get_b_count();
+
+        if (other.root->get_b_count() != b_count)
+        {
+            throw std::invalid_argument("joined trees must share b_count");
+        }
+
+        // grafted blocks are freed through this tree's resource from now on
+        if (!this->resource->is_equal(*other.resource))
+        {
+            throw std::invalid_argument("joined trees must share a memory resource");
+        }
+
+        if (is_empty(other.root))
+        {
+            return;
+        }
+
+        // blocks change hands between the two trees
+        invalidate_cache();
+        other.invalidate_cache();
+
+        if (is_empty(this->root))
+        {
+            std::swap(this->root, other.root);
+            std::swap(this->tombstones, other.tombstones);
+            return;
+        }
+
+        B_Tree<K> *lower = this;
+        B_Tree<K> *upper = &other;
+
+        // the ranges are compared on the keys stored, buried ones included, as those are what gets grafted
+        if (edge_key(other.root, true) < edge_key(this->root, false))
+        {
+            std::swap(lower, upper);
+        }
+        else if (!(edge_key(this->root, true) < edge_key(other.root, false)))
+        {
+            throw std::invalid_argument("joined trees have overlapping key ranges");
+        }
+
+        // the smallest key of the upper tree becomes the separator between the two roots, buried or not
+        K separator = edge_key(upper->root, false);
+        bool buried = upper->is_buried(separator);
+        upper->remove_key(separator);
+
+        this->tombstones.insert(other.tombstones.begin(), other.tombstones.end());
+        other.tombstones.clear();
+        if (buried)
+        {
+            this->tombstones.insert(separator);
+        }
+
+        Block *left = lower->root;
+        Block *right = upper->root;
+        other.root = new_block(b_count);
+        join_roots(left, height(left), separator, right, height(right));
+
+        // grafting moved separators under any finger set while joining
+        invalidate_cache();
+    }
+
+    // keys in this tree or other, as a new tree with this tree's b_count
+    B_Tree<K> set_union(B_Tree<K> &other)
+    {
+        flush_buffer();
+        other.flush_buffer();
+
+        std::vector<K> result;
+        result.reserve(this->size() + other.size());
+        Cursor a(this->root, &this->tombstones);
+        Cursor b(other.root, &other.tombstones);
+
+        while (a.valid() || b.valid())
+        {
+            if (!b.valid() || (a.valid() && a.key() < b.key()))
+            {
+                result.push_back(a.key());
+                a.next();
+            }
+            else if (!a.valid() || b.key() < a.key())
+            {
+                result.push_back(b.key());
+                b.next();
+            }
+            else
+            {
+                result.push_back(a.key());
+                a.next();
+                b.next();
+            }
+        }
+        return from_sorted(result);
+    }
+
+    // keys in both this tree and other. whichever side is behind gallops to the other's key,
+    // so runs that do not overlap are skipped a subtree at a time
+    B_Tree<K> set_intersection(B_Tree<K> &other)
+    {
+        flush_buffer();
+        other.flush_buffer();
+
+        std::vector<K> result;
+        Cursor a(this->root, &this->tombstones);
+        Cursor b(other.root, &other.tombstones);
+
+        while (a.valid() && b.valid())
+        {
+            if (a.key() < b.key())
+            {
+                a.advance_to(b.key());
+            }
+            else if (b.key() < a.key())
+            {
+                b.advance_to(a.key());
+            }
+            else
+            {
+                result.push_back(a.key());
+                a.next();
+                b.next();
+            }
+        }
+        return from_sorted(result);
+    }
+
+    // keys in this tree but not in other
+    B_Tree<K> set_difference(B_Tree<K> &other)
+    {
+        flush_buffer();
+        other.flush_buffer();
+
+        std::vector<K> result;
+        Cursor a(this->root, &this->tombstones);
+        Cursor b(other.root, &other.tombstones);
+
+        while (a.valid())
+        {
+            if (!b.valid() || a.key() < b.key())
+            {
+                result.push_back(a.key());
+                a.next();
+            }
+            else if (b.key() < a.key())
+            {
+                b.advance_to(a.key());
+            }
+            else
+            {
+                a.next();
+                b.next();
+            }
+        }
+        return from_sorted(result);
+    }
+
+    // remove every key in [low, high) and return how many were removed. the range is cut
+    // out with two splits, its blocks are freed wholesale and the outer trees are joined back, so
+    // only the boundary spines are rebalanced
+    int erase_range(K low, K high)
+    {
+        // buffered inserts into the range have to reach the blocks to be cut out with them
+        flush_buffer();
+
+        if (!(low < high) || is_empty(this->root))
+        {
+            return 0;
+        }
+
+        B_Tree<K> middle = split(low);
+        B_Tree<K> upper = middle.split(high);
+        int erased = middle.size();
+
+        join(upper);
+        return erased;
+    }
+};
+
+// read only snapshot of a tree in Eytzinger order : the keys sit in one array laid out like a
+// binary heap, the root at 1 and the children of k at 2k and 2k + 1, so there are no pointers and
+// the top levels every search shares stay packed in a few cache lines
+
+template <typename K>
+
+class Frozen_Tree
+{
+private:
+    // keys.at(0) is unused so the children of k are 2k and 2k + 1
+    std::vector<K> keys;
+    int count;
+
+    // lay sorted out into the slots of k's subtree in order, returning the next unused index
+    int place(std::vector<K> &sorted, int next, int k)
+    {
+        if (k <= this->count)
+        {
+            next = place(sorted, next, 2 * k);
+            this->keys.at(k) = sorted.at(next++);
+            next = place(sorted, next, 2 * k + 1);
+        }
+        return next;
+    }
+
+    void collect(int k, std::vector<K> &out)
+    {
+        if (k <= this->count)
+        {
+            collect(2 * k, out);
+            out.push_back(this->keys.at(k));
+            collect(2 * k + 1, out);
+        }
+    }
+
+    // the slot of the smallest key >= key, or 0 when every key is smaller. each step moves one
+    // level down without a branch, and the block of descendants four levels below is prefetched
+    int search(K key)
+    {
+        int k = 1;
+
+        while (k <= this->count)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            if (16 * k <= this->count)
+            {
+                __builtin_prefetch(this->keys.data() + 16 * k);
+            }
+#endif
+            k = 2 * k + (this->keys[k] < key);
+        }
+
+        // undo the right turns taken after the last left turn
+        return k >> __builtin_ffs(~k);
+    }
+
+public:
+    // sorted_keys must be sorted and distinct
+    Frozen_Tree(std::vector<K> &sorted_keys)
+    {
+        this->count = sorted_keys.size();
+        this->keys.resize(this->count + 1);
+        place(sorted_keys, 0, 1);
+    }
+
+    bool contains(K key)
+    {
+        int k = search(key);
+        return k != 0 && this->keys.at(k) == key;
+    }
+
+    // copy the smallest key >= key into found_key, returns false when every key is smaller
+    bool lower_bound(K key, K &found_key)
+    {
+        int k = search(key);
+
+        if (k == 0)
+        {
+            return false;
+        }
+
+        found_key = this->keys.at(k);
+        return true;
+    }
+
+    int size()
+    {
+        return this->count;
+    }
+
+    size_t bytes()
+    {
+        return sizeof(*this) + this->keys.capacity() * sizeof(K);
+    }
+
+    // a new mutable tree of the given order holding every key, built bottom up in full leaves
+    B_Tree<K> *thaw(int b_count, std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+    {
+        std::vector<K> sorted;
+        sorted.reserve(this->count);
+        collect(1, sorted);
+
+        B_Tree<K> *tree = new B_Tree<K>(b_count, resource);
+
+        if (!sorted.empty())
+        {
+            tree->release_block(tree->root);
+            tree->root = tree->build_sorted(sorted, b_count, 2 * b_count - 1);
+        }
+        return tree;
+    }
+};
+
+// read only tree over a key set known at compile time, built by a constexpr constructor into
+// static storage so nothing runs at startup. blocks of block_width keys, one cache line of them,
+// are laid out breadth first with no pointers : the children of block k are blocks
+// k * (block_width + 1) + 1 through k * (block_width + 1) + block_width + 1. block_width and
+// height are constants, so the compiler can unroll a lookup's loops completely. K must be a
+// literal type
+
+template <typename K, size_t N>
+
+class Static_Tree
+{
+private:
+    static constexpr int count = N;
+    static constexpr int block_width = std::max<int>(1, 64 / (int)sizeof(K));
+    static constexpr int block_count = (count + block_width - 1) / block_width;
+
+    // levels of the complete (block_width + 1)-ary tree needed to number block_count blocks
+    static constexpr int levels()
+    {
+        int height = 0;
+        long long numbered = 0;
+        long long level_blocks = 1;
+
+        while (numbered < block_count)
+        {
+            numbered += level_blocks;
+            level_blocks *= block_width + 1;
+            height++;
+        }
+        return height;
+    }
+
+    static constexpr int height = levels();
+
+    // slots past the last key repeat it, so every block stays sorted and lookups need no count
+    std::array<K, block_count * block_width> keys{};
+
+    // restore the max heap below root within the first end keys
+    static constexpr void sift_down(std::array<K, N> &heap, int root, int end)
+    {
+        while (2 * root + 1 < end)
+        {
+            int child = 2 * root + 1;
+
+            if (child + 1 < end && heap.at(child) < heap.at(child + 1))
+            {
+                child++;
+            }
+            if (!(heap.at(root) < heap.at(child)))
+            {
+                return;
+            }
+
+            K larger = heap.at(child);
+            heap.at(child) = heap.at(root);
+            heap.at(root) = larger;
+            root = child;
+        }
+    }
+
+    // lay the sorted keys into the slots of block k's subtree in order, returning the next unused index
+    constexpr int place(const std::array<K, N> &sorted, int next, int k)
+    {
+        if (k < block_count)
+        {
+            for (int i = 0; i <= block_width; i++)
+            {
+                next = place(sorted, next, k * (block_width + 1) + i + 1);
+
+                if (i < block_width)
+                {
+                    this->keys.at(k * block_width + i) = sorted.at(next < count ? next : count - 1);
+                    next++;
+                }
+            }
+        }
+        return next;
+    }
+
+public:
+    // throws std::invalid_argument for a repeated key, which fails the build when constant evaluated
+    constexpr Static_Tree(const std::array<K, N> &unsorted)
+    {
+        // heap sort, std::sort is not constexpr before C++20
+        std::array<K, N> sorted = unsorted;
+
+        for (int i = count / 2 - 1; i >= 0; i--)
+        {
+            sift_down(sorted, i, count);
+        }
+        for (int end = count - 1; end > 0; end--)
+        {
+            K largest = sorted.at(0);
+            sorted.at(0) = sorted.at(end);
+            sorted.at(end) = largest;
+            sift_down(sorted, 0, end);
+        }
+
+        for (int i = 1; i < count; i++)
+        {
+            if (!(sorted.at(i - 1) < sorted.at(i)))
+            {
+                throw std::invalid_argument("static tree keys must be distinct");
+            }
+        }
+
+        place(sorted, 0, 0);
+    }
+
+    constexpr bool in_tree(K key) const
+    {
+        int k = 0;
+
+        for (int level = 0; level < height && k < block_count; level++)
+        {
+            // keys of the block smaller than key, counted without branching
+            int index = 0;
+            for (int i = 0; i < block_width; i++)
+            {
+                index += this->keys[k * block_width + i] < key;
+            }
+
+            if (index < block_width && this->keys[k * block_width + index] == key)
+            {
+                return true;
+            }
+            k = k * (block_width + 1) + index + 1;
+        }
+        return false;
+    }
+
+    constexpr int size() const { return count; }
+};
+
+// deduces K and N from a braced list, as in constexpr auto ids = make_static_tree({7, 3, 11});
+template <typename K, size_t N>
+constexpr Static_Tree<K, N> make_static_tree(const K (&keys)[N])
+{
+    std::array<K, N> unsorted{};
+
+    for (size_t i = 0; i < N; i++)
+    {
+        unsorted.at(i) = keys[i];
+    }
+    return Static_Tree<K, N>(unsorted);
+}
+
+// main
+
+std::vector<int> data_gen(int count)
+{
+    std::vector<int> result(count);
+
+    // 1. Fill with 1, 2, 3, ... count
+    // std::iota is a clean way to fill a range with increasing values
+    std::iota(result.begin(), result.end(), 1);
+
+    // 2. Shuffle using a stable random engine
+    static std::random_device rd;
+    static std::mt19937 engine(rd());
+    std::shuffle(result.begin(), result.end(), engine);
+
+    return result;
+}
+
+// insert and remove print every step, so checks driving thousands of them mute the console
+struct Mute_Output
+{
+    std::streambuf *saved;
+
+    Mute_Output()
+    {
+        this->saved = std::cout.rdbuf(nullptr);
+    }
+
+    ~Mute_Output()
+    {
+        std::cout.rdbuf(this->saved);
+        std::cout.clear();
+    }
+};
+
+void report_check(const std::string &name, bool passed)
+{
+    std::cout << "[CHECK] " << std::left << std::setw(48) << name << (passed ? "PASSED" : "FAILED") << "\n";
+}
+
+// whether tree holds exactly the keys of oracle, probing every key in [low, high]
+bool same_keys(B_Tree<int> &tree, std::set<int> &oracle, int low, int high)
+{
+    for (int key = low; key <= high; key++)
+    {
+        if (tree.in_tree(key) != (oracle.count(key) > 0))
+        {
+            return false;
+        }
+    }
+    return tree.size() == (int)oracle.size();
+}
+
+void test_tree(int b_count, int num_of_items)
+{
+    b_count = std::max(2, b_count);
+    B_Tree<int> *tree = new B_Tree<int>(b_count);
+    std::vector<int> nums = data_gen(num_of_items);
+
+    std::cout << "\n------------------------------------------------\n";
+    std::cout << std::endl;
+    std::cout << "Inserting " << num_of_items << " items...";
+    auto i_start = std::chrono::high_resolution_clock::now();
+    for (int num : nums)
+    {
+        tree->insert(num);
+    }
+    auto i_end = std::chrono::high_resolution_clock::now();
+
+    auto i_us = std::chrono::duration_cast<std::chrono::microseconds>(i_end - i_start).count();
+    std::cout << "\n  -> Took: " << i_us << " us ("
+              << std::fixed << std::setprecision(3) << (double)i_us / 1000.0 << " ms)\n\n";
+
+    std::cout << "Searching " << num_of_items << " items...";
+    auto s_start = std::chrono::high_resolution_clock::now();
+    for (int num : nums)
+    {
+        tree->search(num);
+    }
+    auto s_end = std::chrono::high_resolution_clock::now();
+
+    auto s_us = std::chrono::duration_cast<std::chrono::microseconds>(s_end - s_start).count();
+    std::cout << "\n  -> Took: " << s_us << " us ("
+              << (double)s_us / 1000.0 << " ms)\n\n";
+
+    // int fail_count = 0;
+    std::cout << "Removing " << num_of_items << " items...";
+    auto r_start = std::chrono::high_resolution_clock::now();
+    for (int num : nums)
+    {
+        // used for testing remove
+        // if (!tree->in_tree(num))
+        // {
+        //     fail_count++;
+        // }
+        tree->remove(num);
+    }
+    auto r_end = std::chrono::high_resolution_clock::now();
+
+    auto r_us = std::chrono::duration_cast<std::chrono::microseconds>(r_end - r_start).count();
+    std::cout << "\n  -> Took: " << r_us << " us ("
+              << (double)r_us / 1000.0 << " ms)\n";
+
+    std::cout << "\n------------------------------------------------";
+    std::cout << "\nStats:";
+    std::cout << "\nB-Tree Degree (b): " << b_count;
+    // std::cout << "\nFailures: " << fail_count << " / " << num_of_items;
+    std::cout << "\nTotal Time: " << (i_us + s_us + r_us) / 1000000.0 << " seconds" << std::endl;
+    std::cout << std::endl;
+
+    delete tree;
+
+    std::cout << "Checks against std::set:\n";
+    std::mt19937 engine(b_count);
+
+    // bitmap leaves : dense keys pack, random removals and far inserts unpack them again
+    {
+        B_Tree<int> dense(b_count);
+        std::set<int> oracle;
+        bool packed;
+
+        {
+            Mute_Output mute;
+            for (int num : nums)
+            {
+                dense.insert(num);
+                oracle.insert(num);
+            }
+            packed = dense.stats().packed_leaves > 0;
+
+            for (int i = 0; i < num_of_items / 2; i++)
+            {
+                int key = engine() % (num_of_items + 2);
+                dense.remove(key);
+                oracle.erase(key);
+            }
+            for (int i = 0; i < 100; i++)
+            {
+                int key = num_of_items + 1 + i * 97;
+                dense.insert(key);
+                oracle.insert(key);
+            }
+        }
+
+        report_check("bitmap leaves pack dense keys", packed);
+        report_check("bitmap leaves match after removals", same_keys(dense, oracle, 0, num_of_items + 100 * 97));
+    }
+
+    // rank, select and count_range against positions in the sorted oracle
+    {
+        B_Tree<int> ordered(b_count);
+        std::set<int> oracle;
+
+        {
+            Mute_Output mute;
+            for (int i = 0; i < num_of_items; i++)
+            {
+                int key = engine() % (4 * num_of_items);
+                ordered.insert(key);
+                oracle.insert(key);
+            }
+        }
+
+        std::vector<int> sorted(oracle.begin(), oracle.end());
+        bool ok = true;
+
+        for (int i = 0; i < 1000 && ok; i++)
+        {
+            int low = (int)(engine() % (4 * num_of_items + 2)) - 1;
+            int high = low + engine() % 1000;
+            int index = engine() % sorted.size();
+            int low_rank = std::lower_bound(sorted.begin(), sorted.end(), low) - sorted.begin();
+            int high_rank = std::lower_bound(sorted.begin(), sorted.end(), high) - sorted.begin();
+
+            ok = ordered.rank(low) == low_rank && ordered.select(index) == sorted.at(index) &&
+                 ordered.count_range(low, high) == high_rank - low_rank;
+        }
+        report_check("rank, select and count_range", ok);
+    }
+
+    // split at random keys, then join the halves back in either order
+    {
+        B_Tree<int> whole(b_count);
+        std::set<int> oracle;
+        bool ok = true;
+
+        {
+            Mute_Output mute;
+            for (int i = 0; i < num_of_items; i++)
+            {
+                int key = engine() % (4 * num_of_items);
+                whole.insert(key);
+                oracle.insert(key);
+            }
+        }
+
+        for (int round = 0; round < 20 && ok; round++)
+        {
+            int key = (int)(engine() % (4 * num_of_items + 2)) - 1;
+            std::set<int> low_keys(oracle.begin(), oracle.lower_bound(key));
+            std::set<int> high_keys(oracle.lower_bound(key), oracle.end());
+
+            B_Tree<int> right = whole.split(key);
+            ok = same_keys(whole, low_keys, -1, 4 * num_of_items) && same_keys(right, high_keys, -1, 4 * num_of_items);
+
+            if (round % 2 == 0)
+            {
+                whole.join(right);
+            }
+            else
+            {
+                right.join(whole);
+                whole = std::move(right);
+            }
+            ok = ok && same_keys(whole, oracle, -1, 4 * num_of_items) && right.size() == 0;
+        }
+        report_check("split and join", ok);
+    }
+
+    // erase_range drops whole subtrees and reports how many keys went
+    {
+        B_Tree<int> ranged(b_count);
+        std::set<int> oracle;
+        bool ok = true;
+
+        {
+            Mute_Output mute;
+            for (int i = 0; i < num_of_items; i++)
+            {
+                int key = engine() % (4 * num_of_items);
+                ranged.insert(key);
+                oracle.insert(key);
+            }
+        }
+
+        for (int round = 0; round < 20 && ok; round++)
+        {
+            int low = (int)(engine() % (4 * num_of_items + 2)) - 1;
+            int high = low + engine() % (num_of_items / 2 + 1);
+            int expected = std::distance(oracle.lower_bound(low), oracle.lower_bound(high));
+
+            oracle.erase(oracle.lower_bound(low), oracle.lower_bound(high));
+            ok = ranged.erase_range(low, high) == expected && same_keys(ranged, oracle, -1, 4 * num_of_items);
+        }
+        ok = ok && ranged.erase_range(-1, 4 * num_of_items) == (int)oracle.size() && ranged.size() == 0;
+        report_check("erase_range", ok);
+    }
+
+    // union, intersection and difference of two overlapping trees
+    {
+        B_Tree<int> a(b_count);
+        B_Tree<int> b(b_count);
+        std::set<int> a_keys;
+        std::set<int> b_keys;
+
+        {
+            Mute_Output mute;
+            for (int i = 0; i < num_of_items; i++)
+            {
+                int key = engine() % (2 * num_of_items);
+                a.insert(key);
+                a_keys.insert(key);
+
+                key = num_of_items / 2 + engine() % (2 * num_of_items);
+                b.insert(key);
+                b_keys.insert(key);
+            }
+        }
+
+        std::set<int> both;
+        std::set<int> either;
+        std::set<int> only_a;
+        std::set_union(a_keys.begin(), a_keys.end(), b_keys.begin(), b_keys.end(), std::inserter(either, either.end()));
+        std::set_intersection(a_keys.begin(), a_keys.end(), b_keys.begin(), b_keys.end(), std::inserter(both, both.end()));
+        std::set_difference(a_keys.begin(), a_keys.end(), b_keys.begin(), b_keys.end(), std::inserter(only_a, only_a.end()));
+
+        B_Tree<int> union_tree = a.set_union(b);
+        B_Tree<int> intersection_tree = a.set_intersection(b);
+        B_Tree<int> difference_tree = a.set_difference(b);
+        int high = num_of_items / 2 + 2 * num_of_items;
+
+        report_check("set_union, set_intersection and set_difference",
+                     same_keys(union_tree, either, -1, high) && same_keys(intersection_tree, both, -1, high) &&
+                         same_keys(difference_tree, only_a, -1, high) && same_keys(a, a_keys, -1, high) && same_keys(b, b_keys, -1, high));
+    }
+
+    // churn over a small key space so removals keep hitting separators in internal blocks
+    {
+        B_Tree<int> churned(b_count);
+        std::set<int> oracle;
+        bool ok = true;
+
+        for (int i = 0; i < 10 * num_of_items && ok; i++)
+        {
+            int key = engine() % num_of_items;
+            {
+                Mute_Output mute;
+                if (engine() % 2 == 0)
+                {
+                    churned.insert(key);
+                    oracle.insert(key);
+                }
+                else
+                {
+                    churned.remove(key);
+                    oracle.erase(key);
+                }
+            }
+            if ((i + 1) % num_of_items == 0)
+            {
+                ok = same_keys(churned, oracle, 0, num_of_items) && churned.stats().underfull_blocks == 0 &&
+                     churned.count_range(-1, num_of_items) == (int)oracle.size();
+            }
+        }
+
+        std::vector<int> remaining(oracle.begin(), oracle.end());
+        std::shuffle(remaining.begin(), remaining.end(), engine);
+        {
+            Mute_Output mute;
+            for (int key : remaining)
+            {
+                churned.remove(key);
+            }
+        }
+        ok = ok && churned.size() == 0 && churned.stats().blocks == 1;
+        report_check("removals from internal blocks", ok);
+    }
+
+    // ordered queries answer around buried keys without purging them
+    {
+        B_Tree<int> lazy(b_count);
+        B_Tree<int> other(b_count);
+        std::set<int> oracle;
+        std::set<int> other_keys;
+        lazy.set_lazy_delete(true);
+        other.set_lazy_delete(true);
+
         {
-            parent_key_index = to_index - 1;
+            Mute_Output mute;
+            for (int i = 0; i < num_of_items; i++)
+            {
+                int key = engine() % (4 * num_of_items);
+                lazy.insert(key);
+                oracle.insert(key);
+
+                key = engine() % (4 * num_of_items);
+                other.insert(key);
+                other_keys.insert(key);
+            }
+            for (int i = 0; i < num_of_items / 2; i++)
+            {
+                int key = engine() % (4 * num_of_items);
+                lazy.remove(key);
+                oracle.erase(key);
+
+                key = engine() % (4 * num_of_items);
+                other.remove(key);
+                other_keys.erase(key);
+            }
         }
 
-        std::vector<K> &parent_keys = parent->get_keys();
-        std::vector<Block *> &parent_children = parent->get_children();
+        std::vector<int> sorted(oracle.begin(), oracle.end());
+        int buried = lazy.tombstone_count();
+        bool ok = buried > 0 && lazy.size() == (int)oracle.size();
 
-        std::vector<K> &to_keys = to->get_keys();
-        std::vector<K> &from_keys = from->get_keys();
+        for (int i = 0; i < 1000 && ok; i++)
+        {
+            int low = (int)(engine() % (4 * num_of_items + 2)) - 1;
+            int high = low + engine() % 1000;
+            int index = engine() % sorted.size();
+            int low_rank = std::lower_bound(sorted.begin(), sorted.end(), low) - sorted.begin();
+            int high_rank = std::lower_bound(sorted.begin(), sorted.end(), high) - sorted.begin();
 
-        bool leaf = is_leaf(to);
+            ok = lazy.rank(low) == low_rank && lazy.select(index) == sorted.at(index) &&
+                 lazy.count_range(low, high) == high_rank - low_rank;
+        }
+        ok = ok && (int)lazy.freeze().size() == (int)oracle.size() && lazy.tombstone_count() == buried;
 
-        // transfer all keys, erase parent key, erase child pointer and delete block
-        // if not a leaf node, must also handle the transfer of children
+        std::set<int> either;
+        std::set_union(oracle.begin(), oracle.end(), other_keys.begin(), other_keys.end(), std::inserter(either, either.end()));
+        B_Tree<int> union_tree = lazy.set_union(other);
+        ok = ok && same_keys(union_tree, either, -1, 4 * num_of_items);
 
-        if (right_to_left)
+        for (int round = 0; round < 10 && ok; round++)
         {
-            to_keys.push_back(parent_keys.at(parent_key_index));
-            to_keys.insert(to_keys.end(), from_keys.begin(), from_keys.end());
+            int key = (int)(engine() % (4 * num_of_items + 2)) - 1;
+            std::set<int> high_keys(oracle.lower_bound(key), oracle.end());
 
-            if (!leaf)
-            {
-                std::vector<Block *> &to_children = to->get_children();
-                std::vector<Block *> &from_children = from->get_children();
+            B_Tree<int> right = lazy.split(key);
+            ok = same_keys(right, high_keys, -1, 4 * num_of_items) && lazy.size() + right.size() == (int)oracle.size();
+            lazy.join(right);
+            ok = ok && same_keys(lazy, oracle, -1, 4 * num_of_items) && lazy.tombstone_count() == buried;
+        }
+
+        lazy.set_lazy_delete(false);
+        ok = ok && lazy.tombstone_count() == 0 && same_keys(lazy, oracle, -1, 4 * num_of_items);
+        report_check("ordered queries under lazy deletion", ok);
+    }
+
+    // ordered queries read through the buffered messages without flushing them
+    {
+        B_Tree<int> buffered(b_count);
+        std::set<int> oracle;
 
-                to_children.insert(to_children.end(), from_children.begin(), from_children.end());
+        {
+            Mute_Output mute;
+            for (int i = 0; i < num_of_items; i++)
+            {
+                int key = engine() % (4 * num_of_items);
+                buffered.insert(key);
+                oracle.insert(key);
             }
 
-            parent_keys.erase(parent_keys.begin() + parent_key_index);
-            parent_children.erase(parent_children.begin() + get_child_index(parent, from));
-            delete from;
+            // fewer writes than the default capacity, so none of them is flushed yet
+            buffered.set_buffered(true);
+            for (int i = 0; i < std::min(num_of_items, 1000); i++)
+            {
+                int key = engine() % (4 * num_of_items);
+                if (engine() % 2 == 0)
+                {
+                    buffered.insert(key);
+                    oracle.insert(key);
+                }
+                else
+                {
+                    buffered.remove(key);
+                    oracle.erase(key);
+                }
+            }
         }
-        else if (left_to_right)
+
+        std::vector<int> sorted(oracle.begin(), oracle.end());
+        int pending = buffered.buffered_count();
+        bool ok = pending > 0 && buffered.size() == (int)oracle.size();
+
+        for (int i = 0; i < 1000 && ok; i++)
         {
-            to_keys.insert(to_keys.begin(), parent_keys.at(parent_key_index));
-            to_keys.insert(to_keys.begin(), from_keys.begin(), from_keys.end());
+            int low = (int)(engine() % (4 * num_of_items + 2)) - 1;
+            int high = low + engine() % 1000;
+            int index = engine() % sorted.size();
+            int low_rank = std::lower_bound(sorted.begin(), sorted.end(), low) - sorted.begin();
+            int high_rank = std::lower_bound(sorted.begin(), sorted.end(), high) - sorted.begin();
+
+            ok = buffered.rank(low) == low_rank && buffered.select(index) == sorted.at(index) &&
+                 buffered.count_range(low, high) == high_rank - low_rank;
+        }
+        ok = ok && (int)buffered.freeze().size() == (int)oracle.size() && same_keys(buffered, oracle, -1, 4 * num_of_items) &&
+             buffered.buffered_count() == pending;
+
+        buffered.set_buffered(false);
+        ok = ok && buffered.buffered_count() == 0 && same_keys(buffered, oracle, -1, 4 * num_of_items);
+        report_check("ordered queries over buffered writes", ok);
+    }
+
+    // the hot key cache keeps answering correctly while splits, merges, split and join move keys
+    {
+        B_Tree<int> cached(b_count);
+        std::set<int> oracle;
+        cached.set_cache(256);
+        bool ok = true;
 
-            if (!leaf)
+        for (int round = 0; round < 20 && ok; round++)
+        {
             {
-                std::vector<Block *> &to_children = to->get_children();
-                std::vector<Block *> &from_children = from->get_children();
+                Mute_Output mute;
+                for (int i = 0; i < num_of_items / 10; i++)
+                {
+                    int key = engine() % num_of_items;
+                    if (engine() % 3 == 0)
+                    {
+                        cached.remove(key);
+                        oracle.erase(key);
+                    }
+                    else
+                    {
+                        cached.insert(key);
+                        oracle.insert(key);
+                    }
+                }
+            }
 
-                to_children.insert(to_children.begin(), from_children.begin(), from_children.end());
+            // a few hot keys take most of the lookups
+            for (int i = 0; i < 2000 && ok; i++)
+            {
+                int key = engine() % 4 == 0 ? engine() % num_of_items : engine() % 64;
+                ok = cached.in_tree(key) == (oracle.count(key) > 0);
             }
 
-            parent_keys.erase(parent_keys.begin() + parent_key_index);
-            parent_children.erase(parent_children.begin() + get_child_index(parent, from));
-            delete from;
+            if (round % 5 == 4)
+            {
+                int key = engine() % num_of_items;
+                B_Tree<int> right = cached.split(key);
+                cached.join(right);
+            }
         }
+        ok = ok && same_keys(cached, oracle, -1, num_of_items) && cached.cache_hits() > 0 &&
+             cached.cache_hit_rate() > 0 && cached.cache_hit_rate() <= 1;
 
-        if (parent_keys.size() < parent->get_min_keys())
-        {
-            return remove_restructure(parent, path);
-        }
+        cached.clear();
+        ok = ok && !cached.in_tree(*oracle.begin()) && cached.size() == 0;
+        report_check("hot key cache", ok);
     }
+}
 
-public:
-    B_Tree()
+// benchmark : ./b_tree_set --bench [json_path] [max_items] [repetitions]
+// calibration : ./b_tree_set --calibrate [items] [insert_percent] [find_percent] [erase_percent]
+
+// a 32 byte key ordered by its first word, for measuring wider keys
+struct Wide_Key
+{
+    uint64_t words[4];
+
+    bool operator<(const Wide_Key &other) const { return this->words[0] < other.words[0]; }
+    bool operator>(const Wide_Key &other) const { return this->words[0] > other.words[0]; }
+    bool operator<=(const Wide_Key &other) const { return this->words[0] <= other.words[0]; }
+    bool operator>=(const Wide_Key &other) const { return this->words[0] >= other.words[0]; }
+    bool operator==(const Wide_Key &other) const { return this->words[0] == other.words[0]; }
+    bool operator!=(const Wide_Key &other) const { return this->words[0] != other.words[0]; }
+};
+
+std::ostream &operator<<(std::ostream &out, const Wide_Key &key)
+{
+    return out << key.words[0];
+}
+
+struct Benchmark
+{
+    struct Result
     {
-        this->root = new Block(2);
-    }
+        std::string container;
+        std::string distribution;
+        std::string operation;
+        int b_count;
+        int key_bytes;
+        int items;
+        double ns_per_op;
+        double stddev_ns;
+    };
+
+    int max_items;
+    int repetitions;
+    std::vector<Result> results;
 
-    B_Tree(int b_count)
+    // checksum of every lookup, so the compiler cannot drop them
+    uint64_t found;
+
+    Benchmark(int max_items, int repetitions)
     {
-        this->root = new Block(b_count);
+        this->max_items = max_items;
+        this->repetitions = std::max(2, repetitions);
+        this->found = 0;
     }
 
-    void insert(K key)
+    // bijective 64 bit mix, so distinct inputs stay distinct
+    static uint64_t mix(uint64_t x)
     {
-        std::vector<Block *> path;
-        search_helper(this->root, key, path);
-
-        if (path.empty())
-            return;
-
-        Block *last_block_seen = path.back();
-        path.pop_back();
-        int index = get_index(last_block_seen, key);
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
 
-        if (index > 0 && last_block_seen->get_keys().at(index - 1) == key)
+    template <typename K>
+    static K make_key(uint64_t x)
+    {
+        if constexpr (std::is_same<K, Wide_Key>::value)
         {
-            std::cout << std::left << std::setw(7) << "is already in the tree.\n";
+            return Wide_Key{{x, ~x, x * 31, 0}};
         }
         else
         {
-            insert_helper(last_block_seen, key, path);
-            std::cout << std::left << std::setw(7) << key << " was added to the tree.\n";
+            return (K)x;
         }
     }
 
-    void remove(K key)
+    // keys in insertion order. sequential ascends, uniform and zipf are distinct random words,
+    // clustered inserts runs of 64 consecutive keys starting at random bases
+    static std::vector<uint64_t> insert_stream(const std::string &distribution, int count)
     {
-        std::vector<Block *> path;
-        search_helper(this->root, key, path);
+        std::vector<uint64_t> keys(count);
 
-        if (path.empty() || path.back() == nullptr)
-            return;
+        for (int i = 0; i < count; i++)
+        {
+            if (distribution == "sequential")
+            {
+                keys.at(i) = i;
+            }
+            else if (distribution == "clustered")
+            {
+                keys.at(i) = (mix(i / 64) >> 7 << 6) + i % 64;
+            }
+            else
+            {
+                // the top bit is left clear so keys also fit signed types
+                keys.at(i) = mix(i) >> 1;
+            }
+        }
+        return keys;
+    }
+
+    // zipf ranks with skew theta over [0, count), rank 0 the hottest
+    class Zipf
+    {
+    private:
+        uint64_t count;
+        double theta;
+        double zeta_n;
+        double alpha;
+        double eta;
+
+    public:
+        Zipf(uint64_t count, double theta)
+        {
+            this->count = count;
+            this->theta = theta;
+
+            double zeta_2 = 1.0 + std::pow(0.5, theta);
+            this->zeta_n = 0;
+            for (uint64_t i = 1; i <= count; i++)
+            {
+                this->zeta_n += 1.0 / std::pow((double)i, theta);
+            }
+
+            this->alpha = 1.0 / (1.0 - theta);
+            this->eta = (1.0 - std::pow(2.0 / count, 1.0 - theta)) / (1.0 - zeta_2 / this->zeta_n);
+        }
+
+        uint64_t next(std::mt19937_64 &rng)
+        {
+            double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+            double uz = u * this->zeta_n;
+
+            if (uz < 1.0)
+            {
+                return 0;
+            }
 
-        Block *target_block = path.back();
-        std::vector<K> &keys = target_block->get_keys();
+            if (uz < 1.0 + std::pow(0.5, this->theta))
+            {
+                return 1;
+            }
+            return std::min<uint64_t>(this->count - 1, this->count * std::pow(this->eta * u - this->eta + 1.0, this->alpha));
+        }
+    };
 
-        int index = get_index(target_block, key);
+    // the keys looked up, one per stored key. sequential walks them in order, zipf favours a few
+    // hot keys scattered over the key space, the rest pick stored keys uniformly
+    static std::vector<uint64_t> lookup_stream(const std::string &distribution, std::vector<uint64_t> &keys)
+    {
+        std::vector<uint64_t> lookups(keys.size());
+        std::mt19937_64 rng(42);
 
-        if (index > 0 && keys.at(index - 1) == key)
+        if (distribution == "sequential")
         {
-            path.pop_back();
-            remove_helper(target_block, key, path);
-            std::cout << std::left << std::setw(7) << key << " was removed from the tree.\n";
+            lookups = keys;
+        }
+        else if (distribution == "zipf")
+        {
+            Zipf zipf(keys.size(), 0.99);
+            for (uint64_t &key : lookups)
+            {
+                key = keys.at(zipf.next(rng));
+            }
         }
         else
         {
-            std::cout << std::left << std::setw(7) << key << " is NOT in the tree.\n";
+            for (uint64_t &key : lookups)
+            {
+                key = keys.at(rng() % keys.size());
+            }
         }
+        return lookups;
     }
 
-    void search(K key)
+    // time repetitions runs of ops operations each and record the mean and standard deviation
+    // per operation. run() returns the nanoseconds spent on its timed part
+    template <typename Run>
+    void measure(Result result, int ops, Run run)
     {
-        if (in_tree(key))
+        std::vector<double> samples;
+
+        for (int r = 0; r < this->repetitions; r++)
         {
-            std::cout << std::left << std::setw(7) << key << " is in the tree.\n";
+            samples.push_back(run() / ops);
         }
-        else
+
+        double mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+        double variance = 0;
+        for (double sample : samples)
         {
-            std::cout << std::left << std::setw(7) << key << " is NOT in the tree.\n";
+            variance += (sample - mean) * (sample - mean);
         }
+
+        result.items = ops;
+        result.ns_per_op = mean;
+        result.stddev_ns = std::sqrt(variance / (samples.size() - 1));
+        this->results.push_back(result);
+
+        std::cout << std::left << std::setw(14) << result.container << std::setw(12) << result.distribution
+                  << std::setw(8) << result.operation << "b=" << std::setw(4) << result.b_count
+                  << "key=" << std::setw(4) << result.key_bytes << "n=" << std::setw(10) << result.items
+                  << std::right << std::fixed << std::setprecision(1) << std::setw(9) << result.ns_per_op
+                  << " ns/op +- " << result.stddev_ns << std::endl;
     }
 
-    bool in_tree(K key)
+    template <typename Fn>
+    static double time_ns(Fn fn)
     {
-        std::vector<Block *> path;
-        search_helper(this->root, key, path);
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count();
+    }
 
-        if (path.empty())
-            return false;
+    // adapters give every container the same insert, find and erase
+    template <typename K>
+    struct Tree_Adapter
+    {
+        B_Tree<K> tree;
 
-        Block *last_block_seen = path.back();
-        path.pop_back();
+        Tree_Adapter(int b_count, std::pmr::memory_resource *resource = std::pmr::get_default_resource()) : tree(b_count, resource) {}
+        void insert(std::vector<K> &keys)
+        {
+            for (K &key : keys)
+            {
+                this->tree.insert_key(key);
+            }
+        }
+        bool find(K key) { return this->tree.in_tree(key); }
+        void erase(K key) { this->tree.remove_key(key); }
+    };
+
+    // a monotonic arena, held in a base so it is built before the tree and released after it
+    struct Arena
+    {
+        std::pmr::monotonic_buffer_resource arena;
+    };
 
-        int index = get_index(last_block_seen, key);
+    // the same tree with every block carved from an arena that is dropped all at once
+    template <typename K>
+    struct Arena_Tree_Adapter : Arena, Tree_Adapter<K>
+    {
+        Arena_Tree_Adapter(int b_count) : Tree_Adapter<K>(b_count, &this->arena) {}
+    };
+
+    template <typename K>
+    struct Std_Set_Adapter
+    {
+        std::set<K> set;
 
-        if (index > 0 && last_block_seen->get_keys().at(index - 1) == key)
+        Std_Set_Adapter(int) {}
+        void insert(std::vector<K> &keys)
         {
-            return true;
+            for (K &key : keys)
+            {
+                this->set.insert(key);
+            }
         }
-        return false;
-    }
-};
+        bool find(K key) { return this->set.count(key) > 0; }
+        void erase(K key) { this->set.erase(key); }
+    };
 
-// main
+    // a sorted vector is built in bulk and has no cheap erase, so it only measures build and find
+    template <typename K>
+    struct Sorted_Vector_Adapter
+    {
+        std::vector<K> keys;
 
-std::vector<int> data_gen(int count)
-{
-    std::vector<int> result(count);
+        Sorted_Vector_Adapter(int) {}
+        void insert(std::vector<K> &keys)
+        {
+            this->keys = keys;
+            std::sort(this->keys.begin(), this->keys.end());
+        }
+        bool find(K key) { return std::binary_search(this->keys.begin(), this->keys.end(), key); }
+    };
 
-    // 1. Fill with 1, 2, 3, ... count
-    // std::iota is a clean way to fill a range with increasing values
-    std::iota(result.begin(), result.end(), 1);
+    template <typename Adapter, typename K>
+    void run_container(const std::string &container, int b_count, const std::string &distribution, int items)
+    {
+        std::vector<uint64_t> raw_keys = insert_stream(distribution, items);
+        std::vector<uint64_t> raw_lookups = lookup_stream(distribution, raw_keys);
+        std::vector<K> keys;
+        std::vector<K> lookups;
 
-    // 2. Shuffle using a stable random engine
-    static std::random_device rd;
-    static std::mt19937 engine(rd());
-    std::shuffle(result.begin(), result.end(), engine);
+        for (int i = 0; i < items; i++)
+        {
+            keys.push_back(make_key<K>(raw_keys.at(i)));
+            lookups.push_back(make_key<K>(raw_lookups.at(i)));
+        }
 
-    return result;
-}
+        Result result{container, distribution, "", b_count, (int)sizeof(K), items, 0, 0};
 
-void test_tree(int b_count, int num_of_items)
-{
-    b_count = std::max(2, b_count);
-    B_Tree<int> *tree = new B_Tree<int>(b_count);
-    std::vector<int> nums = data_gen(num_of_items);
+        result.operation = "insert";
+        measure(result, items, [&]()
+                {
+                    Adapter adapter(b_count);
+                    return time_ns([&]() { adapter.insert(keys); }); });
 
-    std::cout << "\n------------------------------------------------\n";
-    std::cout << std::endl;
-    std::cout << "Inserting " << num_of_items << " items...";
-    auto i_start = std::chrono::high_resolution_clock::now();
-    for (int num : nums)
-    {
-        tree->insert(num);
-    }
-    auto i_end = std::chrono::high_resolution_clock::now();
+        Adapter adapter(b_count);
+        adapter.insert(keys);
 
-    auto i_us = std::chrono::duration_cast<std::chrono::microseconds>(i_end - i_start).count();
-    std::cout << "\n  -> Took: " << i_us << " us ("
-              << std::fixed << std::setprecision(3) << (double)i_us / 1000.0 << " ms)\n\n";
+        result.operation = "find";
+        measure(result, items, [&]()
+                { return time_ns([&]()
+                                 {
+                                     for (K &key : lookups)
+                                     {
+                                         this->found += adapter.find(key);
+                                     } }); });
 
-    std::cout << "Searching " << num_of_items << " items...";
-    auto s_start = std::chrono::high_resolution_clock::now();
-    for (int num : nums)
+        if constexpr (!std::is_same<Adapter, Sorted_Vector_Adapter<K>>::value)
+        {
+            result.operation = "erase";
+            measure(result, items, [&]()
+                    {
+                        Adapter fresh(b_count);
+                        fresh.insert(keys);
+                        return time_ns([&]()
+                                       {
+                                           for (K &key : keys)
+                                           {
+                                               fresh.erase(key);
+                                           } }); });
+        }
+    }
+
+    template <typename K>
+    void run_key_type()
     {
-        tree->search(num);
+        std::vector<std::string> distributions = {"sequential", "uniform", "zipf", "clustered"};
+        std::vector<int> b_counts = {4, 16, 64};
+
+        // sizes grow by 16x from cache resident up to max_items, past the last level cache by default
+        for (long long items = 1 << 10; items <= this->max_items; items *= 16)
+        {
+            for (std::string &distribution : distributions)
+            {
+                for (int b_count : b_counts)
+                {
+                    run_container<Tree_Adapter<K>, K>("B_Tree", b_count, distribution, items);
+                }
+                run_container<Arena_Tree_Adapter<K>, K>("B_Tree_arena", 16, distribution, items);
+                run_container<Std_Set_Adapter<K>, K>("std::set", 0, distribution, items);
+                run_container<Sorted_Vector_Adapter<K>, K>("sorted_vector", 0, distribution, items);
+            }
+        }
     }
-    auto s_end = std::chrono::high_resolution_clock::now();
 
-    auto s_us = std::chrono::duration_cast<std::chrono::microseconds>(s_end - s_start).count();
-    std::cout << "\n  -> Took: " << s_us << " us ("
-              << (double)s_us / 1000.0 << " ms)\n\n";
+    void write_json(const std::string &path)
+    {
+        std::ofstream out(path);
 
-    // int fail_count = 0;
-    std::cout << "Removing " << num_of_items << " items...";
-    auto r_start = std::chrono::high_resolution_clock::now();
-    for (int num : nums)
+        if (!out)
+        {
+            throw std::runtime_error("cannot write " + path);
+        }
+
+        out << "{\n  \"benchmark\": \"b_tree_set\",\n  \"repetitions\": " << this->repetitions << ",\n  \"results\": [\n";
+        for (size_t i = 0; i < this->results.size(); i++)
+        {
+            Result &result = this->results.at(i);
+            out << "    {\"container\": \"" << result.container << "\", \"distribution\": \"" << result.distribution
+                << "\", \"operation\": \"" << result.operation << "\", \"b_count\": " << result.b_count
+                << ", \"key_bytes\": " << result.key_bytes << ", \"items\": " << result.items
+                << ", \"ns_per_op\": " << std::fixed << std::setprecision(2) << result.ns_per_op
+                << ", \"stddev_ns\": " << result.stddev_ns << "}" << (i + 1 < this->results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+};
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && std::strcmp(argv[1], "--bench") == 0)
     {
-        // used for testing remove
-        // if (!tree->in_tree(num))
-        // {
-        //     fail_count++;
-        // }
-        tree->remove(num);
+        std::string json_path = argc > 2 ? argv[2] : "bench_set.json";
+        int max_items = argc > 3 ? std::atoi(argv[3]) : 1 << 22;
+        int repetitions = argc > 4 ? std::atoi(argv[4]) : 5;
+
+        Benchmark benchmark(max_items, repetitions);
+        benchmark.run_key_type<uint64_t>();
+        benchmark.run_key_type<Wide_Key>();
+        benchmark.write_json(json_path);
+
+        std::cout << "results written to " << json_path << " (checksum " << benchmark.found << ")" << std::endl;
+        return 0;
     }
-    auto r_end = std::chrono::high_resolution_clock::now();
 
-    auto r_us = std::chrono::duration_cast<std::chrono::microseconds>(r_end - r_start).count();
-    std::cout << "\n  -> Took: " << r_us << " us ("
-              << (double)r_us / 1000.0 << " ms)\n";
+    if (argc > 1 && std::strcmp(argv[1], "--calibrate") == 0)
+    {
+        int items = argc > 2 ? std::atoi(argv[2]) : 1 << 18;
+        Operation_Mix mix;
+        mix.insert_percent = argc > 3 ? std::atoi(argv[3]) : 50;
+        mix.find_percent = argc > 4 ? std::atoi(argv[4]) : 50;
+        mix.erase_percent = argc > 5 ? std::atoi(argv[5]) : 0;
 
-    std::cout << "\n------------------------------------------------";
-    std::cout << "\nStats:";
-    std::cout << "\nB-Tree Degree (b): " << b_count;
-    // std::cout << "\nFailures: " << fail_count << " / " << num_of_items;
-    std::cout << "\nTotal Time: " << (i_us + s_us + r_us) / 1000000.0 << " seconds" << std::endl;
-    std::cout << std::endl;
+        std::mt19937_64 engine(1);
+        std::vector<uint64_t> sample_keys(items);
+        for (uint64_t &key : sample_keys)
+        {
+            key = engine();
+        }
 
-    delete tree;
-}
+        std::vector<std::pair<int, double>> scores;
+        int best = B_Tree<uint64_t>::calibrate(sample_keys, mix, &scores);
+
+        for (std::pair<int, double> &score : scores)
+        {
+            std::cout << "b = " << std::setw(3) << score.first << " : " << std::fixed << std::setprecision(1) << score.second << " ns/op\n";
+        }
+        std::cout << "calibrated b = " << best << ", default b = " << B_Tree<uint64_t>::default_b_count() << std::endl;
+        return 0;
+    }
 
-int main()
-{
     test_tree(2, 100000);
+    test_tree(B_Tree<int>::default_b_count(), 100000);
     return 0;
 }
\ No newline at end of file